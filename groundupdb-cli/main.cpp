@@ -138,7 +138,7 @@ int main(int argc, char* argv[]) {
         std::unique_ptr<groundupdb::IDatabase> db(GroundUpDB::loadDB(dbname));
         groundupdb::BucketQuery bq(b);
         std::unique_ptr<groundupdb::IQueryResult> res = db->query(bq);
-        const groundupdb::KeySet& recordKeys = res->recordKeys();
+        const groundupdb::SharedKeySet& recordKeys = res->recordKeys();
         //cout << recordKeys.get()->size() << endl;
         for (auto it = recordKeys.get()->begin(); it != recordKeys.get()->end();it++) {
           groundupdb::Bytes bytes = it->data();
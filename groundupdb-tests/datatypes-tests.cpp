@@ -248,6 +248,213 @@ TEST_CASE("datatypes-container-memory", "[datatypes][container][memory]") {
   }
 }
 
+TEST_CASE("datatypes-typed-values", "[datatypes][basic][typed]") {
+  // Story:-
+  //   [Who]   As an app programmer
+  //   [What]  I need numbers and strings to come back as the type I stored
+  //   [Value] So I can use stored values without parsing them
+  SECTION("datatypes-typed-encoding") {
+    groundupdb::EncodedValue i32((int)0x01020304);
+    REQUIRE(groundupdb::Type::INT32 == i32.type());
+    REQUIRE(4 == i32.length());
+    REQUIRE(std::byte(0x04) == i32.data()[0]); // little endian
+    REQUIRE(std::byte(0x01) == i32.data()[3]);
+
+    // Narrower integers are widened to their tag's width
+    REQUIRE(groundupdb::Type::INT32 == groundupdb::EncodedValue((short int)-3).type());
+    REQUIRE(-3 == groundupdb::EncodedValue((short int)-3).asInt32().value());
+    REQUIRE(groundupdb::Type::UINT64 == groundupdb::EncodedValue((unsigned char)200).type());
+    REQUIRE(200 == groundupdb::EncodedValue((unsigned char)200).asUInt64().value());
+    REQUIRE(groundupdb::Type::DOUBLE == groundupdb::EncodedValue(1.5f).type());
+    REQUIRE(1.5 == groundupdb::EncodedValue(1.5f).asDouble().value());
+    REQUIRE(groundupdb::Type::STRING == groundupdb::EncodedValue("a literal").type());
+    REQUIRE(groundupdb::Type::CONTAINER == groundupdb::EncodedValue(std::vector<int>{1,2,3}).type());
+
+    // Getters only decode their own type, except that INT64 accepts INT32
+    REQUIRE(!i32.asDouble().has_value());
+    REQUIRE(!i32.asString().has_value());
+    REQUIRE(0x01020304 == i32.asInt64().value());
+    REQUIRE(!groundupdb::EncodedValue((long long int)5).asInt32().has_value());
+  }
+
+  SECTION("datatypes-typed-roundtrip") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(
+        groundupdb::GroundUpDB::createEmptyDB(dbname));
+
+    db->setKeyValue(std::string("int32"), groundupdb::EncodedValue((int)-147));
+    db->setKeyValue(std::string("int64"), groundupdb::EncodedValue(-(1LL << 40)));
+    db->setKeyValue(std::string("uint64"), groundupdb::EncodedValue(~(std::uint64_t)0));
+    db->setKeyValue(std::string("double"), groundupdb::EncodedValue(-3.1415927));
+    db->setKeyValue(std::string("string"), groundupdb::EncodedValue(std::string("some\nlines")));
+
+    REQUIRE(-147 == db->getKeyValue(std::string("int32")).asInt32().value());
+    REQUIRE(-(1LL << 40) == db->getKeyValue(std::string("int64")).asInt64().value());
+    REQUIRE(~(std::uint64_t)0 == db->getKeyValue(std::string("uint64")).asUInt64().value());
+    REQUIRE(-3.1415927 == db->getKeyValue(std::string("double")).asDouble().value());
+    REQUIRE("some\nlines" == db->getKeyValue(std::string("string")).asString().value());
+
+    // And again from disk, so the type tags are persisted too
+    std::unique_ptr<groundupdb::IDatabase> loaded(groundupdb::GroundUpDB::loadDB(dbname));
+    REQUIRE(groundupdb::Type::INT32 == loaded->getKeyValue(std::string("int32")).type());
+    REQUIRE(-147 == loaded->getKeyValue(std::string("int32")).asInt32().value());
+    REQUIRE(-3.1415927 == loaded->getKeyValue(std::string("double")).asDouble().value());
+    REQUIRE("some\nlines" == loaded->getKeyValue(std::string("string")).asString().value());
+
+    db->destroy();
+  }
+}
+
+TEST_CASE("datatypes-container-access", "[datatypes][container][typed]") {
+  // Story:-
+  //   [Who]   As an app programmer
+  //   [What]  I need to read one element of a stored container
+  //   [Value] So I don't pay to decode large values I only need part of
+  SECTION("datatypes-container-sequence") {
+    std::vector<std::string> list{"zero", "one", "", "three"};
+    groundupdb::EncodedValue ev(list);
+    auto view = ev.asContainer();
+    REQUIRE(view.has_value());
+    REQUIRE(!view->keyed());
+    REQUIRE(4 == view->size());
+    for (std::size_t i = 0; i < list.size(); i++) {
+      REQUIRE(groundupdb::Type::STRING == (*view)[i].type());
+      REQUIRE(list[i] == (*view)[i].asString().value());
+    }
+    REQUIRE_THROWS_AS((*view)[4], std::out_of_range);
+    REQUIRE_THROWS_AS(view->key(0), std::logic_error);
+
+    std::vector<std::vector<int>> nested{{1, 2}, {}, {-3}};
+    groundupdb::EncodedValue nev(nested);
+    auto outer = nev.asContainer();
+    REQUIRE(3 == outer->size());
+    REQUIRE(0 == (*outer)[1].asContainer()->size());
+    REQUIRE(2 == (*(*outer)[0].asContainer())[1].asInt32().value());
+    REQUIRE(-3 == (*(*outer)[2].asContainer())[0].asInt32().value());
+
+    REQUIRE(0 == groundupdb::EncodedValue(std::vector<int>()).asContainer()->size());
+    REQUIRE(!groundupdb::EncodedValue(std::string("not a container")).asContainer().has_value());
+  }
+
+  SECTION("datatypes-container-keyed") {
+    std::map<std::string, double> map;
+    for (int i = 0; i < 100; i++) {
+      map.emplace("field" + std::to_string(i), i * 0.5);
+    }
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(
+        groundupdb::GroundUpDB::createEmptyDB(dbname));
+    db->setKeyValue(std::string("map"), groundupdb::EncodedValue(map));
+    groundupdb::EncodedValue ev = db->getKeyValue(std::string("map"));
+    auto view = ev.asContainer();
+    REQUIRE(view->keyed());
+    REQUIRE(100 == view->size());
+    // keeps the map's own order
+    REQUIRE("field0" == view->key(0).asString().value());
+    REQUIRE("field10" == view->key(2).asString().value());
+    for (int i = 0; i < 100; i++) {
+      auto found = view->find(groundupdb::EncodedValue("field" + std::to_string(i)));
+      REQUIRE(found.has_value());
+      REQUIRE(i * 0.5 == found->asDouble().value());
+    }
+    REQUIRE(!view->find(groundupdb::EncodedValue(std::string("field100"))).has_value());
+    REQUIRE(!view->find(groundupdb::EncodedValue(5)).has_value()); // wrong key type
+    db->destroy();
+
+    std::multimap<int, std::string> mmap{{2, "first two"}, {1, "one"}, {2, "second two"}};
+    groundupdb::EncodedValue mev(mmap);
+    REQUIRE("first two" == mev.asContainer()->find(groundupdb::EncodedValue(2))->asString().value());
+    REQUIRE("one" == (*mev.asContainer())[0].asString().value());
+  }
+
+  SECTION("datatypes-container-corrupt") {
+    // Offsets and key order are read from the value itself, so damaged ones must not be trusted
+    auto word = [](groundupdb::Bytes& data, std::size_t at, std::uint32_t value) {
+      groundupdb::writeLittleEndian(data.data() + at * sizeof(std::uint32_t), value);
+    };
+    groundupdb::Bytes list = groundupdb::EncodedValue(std::vector<int>{1, 2, 3}).data();
+    word(list, 2 + 2, 1000); // second element ends past the value
+    word(list, 2 + 3, 0);    // third element ends before it starts
+    groundupdb::ValueView listView(groundupdb::Type::CONTAINER, list.data(), list.size());
+    auto corrupt = listView.asContainer();
+    REQUIRE(corrupt.has_value());
+    REQUIRE(1 == (*corrupt)[0].asInt32().value());
+    REQUIRE(groundupdb::Type::UNKNOWN == (*corrupt)[1].type());
+    REQUIRE(0 == (*corrupt)[1].length());
+    REQUIRE(groundupdb::Type::UNKNOWN == (*corrupt)[2].type());
+
+    groundupdb::Bytes map = groundupdb::EncodedValue(std::map<int, int>{{1, 10}, {2, 20}}).data();
+    word(map, 2 + 2 * 2 + 1, 7); // first key order entry names an entry that does not exist
+    groundupdb::ValueView mapView(groundupdb::Type::CONTAINER, map.data(), map.size());
+    REQUIRE(!mapView.asContainer()->find(groundupdb::EncodedValue(1)).has_value());
+  }
+}
+
+TEST_CASE("datatypes-integer-lists", "[datatypes][integers]") {
+  // Story:-
+  //   [Who]   As an app programmer
+  //   [What]  I need to store long lists of integer IDs compactly
+  //   [Value] So my ID lists use far less disk and memory
+  SECTION("datatypes-varint") {
+    std::vector<std::uint64_t> values{0, 1, 127, 128, 16383, 16384, ~(std::uint64_t)0};
+    groundupdb::Bytes data;
+    for (auto v : values) {
+      groundupdb::encodeVarint(data, v);
+    }
+    REQUIRE(1 + 1 + 1 + 2 + 2 + 3 + 10 == data.size());
+    const std::byte* in = data.data();
+    for (auto v : values) {
+      REQUIRE(v == groundupdb::decodeVarint(in, data.data() + data.size()).value());
+    }
+    REQUIRE(!groundupdb::decodeVarint(in, data.data() + data.size()).has_value());
+  }
+
+  SECTION("datatypes-integer-list-roundtrip") {
+    // Counts either side of the block size, unsorted, and up to full width values
+    for (std::size_t count : {0, 1, 127, 128, 129, 300}) {
+      std::vector<std::uint64_t> values;
+      for (std::size_t i = 0; i < count; i++) {
+        values.push_back((i * 0x9E3779B97F4A7C15ull) >> (i % 64));
+      }
+      groundupdb::EncodedValue ev = groundupdb::compactIntegers(values);
+      REQUIRE(groundupdb::Type::INTEGERS == ev.type());
+      REQUIRE(values == ev.asIntegers().value());
+    }
+    REQUIRE(!groundupdb::EncodedValue(5).asIntegers().has_value());
+
+    groundupdb::Bytes data;
+    groundupdb::IntegerList::encode(data, {10, 20, 30});
+    data.pop_back();
+    REQUIRE(!groundupdb::IntegerList::decode(data.data(), data.size()).has_value());
+  }
+
+  SECTION("datatypes-integer-list-sorted") {
+    // Dense sorted IDs delta encode to a bit or two each, rather than 8 bytes
+    std::vector<std::uint64_t> ids;
+    for (std::uint64_t i = 0; i < 100000; i++) {
+      ids.push_back(5000000000ull + i * 2 + (i % 3 == 0));
+    }
+    groundupdb::EncodedValue ev = groundupdb::compactIntegers(ids);
+    REQUIRE(ev.length() < ids.size() * sizeof(std::uint64_t) / 16);
+    REQUIRE(ids == ev.asIntegers().value());
+
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(
+        groundupdb::GroundUpDB::createEmptyDB(dbname));
+    db->setKeyValue(std::string("ids"), std::move(ev));
+    std::unique_ptr<groundupdb::IDatabase> loaded(groundupdb::GroundUpDB::loadDB(dbname));
+    REQUIRE(ids == loaded->getKeyValue(std::string("ids")).asIntegers().value());
+
+    // Any vector of uint64 is stored this way, including an odd count that half fills a lane
+    ids.pop_back();
+    groundupdb::EncodedValue plain(ids);
+    REQUIRE(groundupdb::Type::INTEGERS == plain.type());
+    REQUIRE(plain == groundupdb::compactIntegers(ids));
+    REQUIRE(ids == plain.asIntegers().value());
+    db->destroy();
+  }
+}
+
 // TODO get this working. Hidden now so the feature can be finished
 TEST_CASE("datatypes-customtypes-memory", "[.][datatypes][customtypes][memory]") {
   // Story:-
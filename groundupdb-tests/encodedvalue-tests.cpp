@@ -48,8 +48,8 @@ TEST_CASE("encodedvalue","[types][encodedvalue]") {
     REQUIRE(0 != ev1.hash());
     REQUIRE(0 != ev2.hash());
     REQUIRE(ev1.hash() == ev2.hash());
-    REQUIRE(groundupdb::Type::CPP == ev1.type());
-    REQUIRE(groundupdb::Type::CPP == ev2.type());
+    REQUIRE(groundupdb::Type::STRING == ev1.type());
+    REQUIRE(groundupdb::Type::STRING == ev2.type());
 
     // elements of == function
     REQUIRE(ev1.hasValue()==ev2.hasValue());
@@ -99,4 +99,177 @@ TEST_CASE("Hashing","[set,get]") {
     REQUIRE(8 == sizeof (hv3));
   }
 
+  SECTION("Batch hashing matches per-key hashing") {
+    // Mixed lengths so some keys share whole packets and some fall to the scalar path
+    std::vector<std::string> keys;
+    std::vector<groundupdb::Bytes> bytes;
+    for (int i = 0;i < 19;i++) {
+      keys.push_back(std::string(i * 7,'k') + std::to_string(i));
+      const std::byte* start = reinterpret_cast<const std::byte*>(keys.back().data());
+      bytes.emplace_back(start,start + keys.back().length());
+    }
+    groundupdb::DefaultHash h{1,2,3,4};
+    std::vector<std::size_t> results = h.batch(bytes);
+    std::vector<groundupdb::HashedKey> hashed = groundupdb::hashKeys(keys);
+
+    REQUIRE(results.size() == keys.size());
+    REQUIRE(hashed.size() == keys.size());
+    for (std::size_t i = 0;i < keys.size();i++) {
+      groundupdb::HashedKey single(keys[i]);
+      REQUIRE(results[i] == single.hash());
+      REQUIRE(hashed[i] == single);
+    }
+  }
+
+  SECTION("Compile time key hashes match runtime hashes") {
+    constexpr groundupdb::StaticKey literal("A literal key");
+    static_assert(0 != literal.hash(),"literal should be hashed at compile time");
+    REQUIRE(literal.hash() == groundupdb::HashedKey(std::string("A literal key")).hash());
+    REQUIRE(groundupdb::HashedKey(literal) == groundupdb::HashedKey(std::string("A literal key")));
+
+    // Longer than one 32 byte packet, so appending crosses packet boundaries
+    constexpr groundupdb::StaticKey prefix("a prefix that is longer than one highwayhash packet::");
+    for (std::size_t length = 0;length < 70;length += 3) {
+      std::string suffix(length,'s');
+      groundupdb::HashedKey appended = prefix.append(suffix);
+      groundupdb::HashedKey runtime(std::string(prefix.data()) + suffix);
+      REQUIRE(appended.hash() == runtime.hash());
+      REQUIRE(appended == runtime);
+    }
+  }
+
+  SECTION("Set hashing reuses stored hashes") {
+    // Rather than a weak byte-wise XOR, or rehashing on every set operation
+    std::string text("A set member");
+    groundupdb::EncodedValue value(text);
+    groundupdb::Key<std::string> key(text);
+    REQUIRE(std::hash<groundupdb::EncodedValue>{}(value) == value.hash());
+    REQUIRE(std::hash<groundupdb::HashedValue>{}(groundupdb::HashedValue(text)) == value.hash());
+    REQUIRE(std::hash<groundupdb::Key<std::string>>{}(key) == groundupdb::HashedKey(key).hash());
+
+    // Narrowed hashes (see DefaultHash::setWidth) are narrowed the same way for every type
+    struct NarrowHashes {
+      NarrowHashes() { groundupdb::DefaultHash::setWidth(8); }
+      ~NarrowHashes() { groundupdb::DefaultHash::setWidth(64); }
+    } narrow;
+    REQUIRE(std::hash<groundupdb::Key<std::string>>{}(key) == groundupdb::HashedKey(key).hash());
+    REQUIRE(std::hash<groundupdb::Key<std::string>>{}(key) < 256);
+  }
+
+}
+
+// Turns fingerprint mode on for one test, and back off even if it fails
+struct FingerprintMode {
+  FingerprintMode() { groundupdb::DefaultHash::setFingerprintMode(true); }
+  ~FingerprintMode() { groundupdb::DefaultHash::setFingerprintMode(false); }
+};
+
+TEST_CASE("Fingerprinted keys","[set,get]") {
+  FingerprintMode mode;
+
+  SECTION("Fingerprints decide equality") {
+    groundupdb::HashedKey key(std::string("a fingerprinted key"));
+    groundupdb::HashedKey same(std::string("a fingerprinted key"));
+    groundupdb::HashedKey other(std::string("another fingerprinted key"));
+    REQUIRE(key.hasFingerprint());
+    REQUIRE(key == same);
+    REQUIRE(key != other);
+
+    groundupdb::HashedKey stripped = key.fingerprintOnly();
+    REQUIRE(stripped.data().empty());
+    REQUIRE(stripped.length() == key.length());
+    REQUIRE(stripped == same);
+    REQUIRE(stripped != other.fingerprintOnly());
+  }
+
+  SECTION("Every hashing path gives the same fingerprint") {
+    constexpr groundupdb::StaticKey prefix("a prefix that is longer than one highwayhash packet::");
+    constexpr groundupdb::Fingerprint literal = prefix.fingerprint();
+    static_assert(0 != literal.high,"literal should be fingerprinted at compile time");
+
+    std::vector<std::string> keys;
+    for (std::size_t length = 0;length < 70;length += 3) {
+      keys.push_back(std::string(prefix.data()) + std::string(length,'s'));
+    }
+    std::vector<groundupdb::HashedKey> hashed = groundupdb::hashKeys(keys);
+    for (std::size_t i = 0;i < keys.size();i++) {
+      groundupdb::HashedKey runtime(keys[i]);
+      groundupdb::HashedKey appended = prefix.append(std::string(i * 3,'s'));
+      REQUIRE(runtime.hasFingerprint());
+      REQUIRE(appended.fingerprint().low == runtime.fingerprint().low);
+      REQUIRE(appended.fingerprint().high == runtime.fingerprint().high);
+      REQUIRE(hashed[i].fingerprint().high == runtime.fingerprint().high);
+      REQUIRE(hashed[i] == runtime);
+    }
+    groundupdb::HashedKey fromLiteral(prefix);
+    REQUIRE(fromLiteral.fingerprint().high == literal.high);
+    REQUIRE(fromLiteral == groundupdb::HashedKey(std::string(prefix.data())));
+  }
+
+  SECTION("Memory store works on fingerprints alone") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    for (int i = 0;i < 100;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(std::string("value ") + std::to_string(i)));
+    }
+    for (int i = 0;i < 100;i++) {
+      REQUIRE(db->getKeyValue(std::string("key ") + std::to_string(i)) == groundupdb::EncodedValue(std::string("value ") + std::to_string(i)));
+    }
+    REQUIRE(!db->getKeyValue(std::string("not a key")).hasValue());
+    db->destroy();
+  }
+
+  SECTION("Query results keep their key bytes") {
+    // Only the fingerprint is held in memory when a cached store holds the bytes, otherwise the whole key
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> memoryDb(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::unique_ptr<groundupdb::IDatabase> cachedDb(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string bucket("fingerprinted");
+    for (auto db : {memoryDb.get(),cachedDb.get()}) {
+      db->setKeyValue(std::string("alpha"),groundupdb::EncodedValue(1),bucket);
+      db->setKeyValue(std::string("beta"),groundupdb::EncodedValue(2),bucket);
+      groundupdb::BucketQuery bq(bucket);
+      for (auto& key : *db->query(bq)->recordKeys()) {
+        REQUIRE(key.data().size() == key.length());
+      }
+      std::vector<groundupdb::HashedKey> batch;
+      REQUIRE(db->queryCursor(bq)->next(batch,10));
+      REQUIRE(batch.size() == 2);
+      for (auto& key : batch) {
+        REQUIRE(key.data().size() == key.length());
+      }
+      for (auto& [key,value] : db->queryWithValues(bq)) {
+        REQUIRE(key.data().size() == key.length());
+      }
+      REQUIRE(db->queryWithValues(bq).size() == 2);
+    }
+    memoryDb->destroy();
+    cachedDb->destroy();
+  }
+
+  SECTION("Prefix and range listing compare whole keys") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> unordered = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> ordered = std::make_unique<groundupdbext::MemoryKeyValueStore>(true);
+    std::vector<std::unique_ptr<groundupdb::IDatabase>> dbs;
+    dbs.push_back(groundupdb::GroundUpDB::createEmptyDB(dbname,unordered));
+    dbs.push_back(groundupdb::GroundUpDB::createEmptyDB(dbname,ordered));
+    dbs.push_back(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    for (auto& db : dbs) {
+      db->setKeyValue(std::string("alpha"),groundupdb::EncodedValue(1));
+      db->setKeyValue(std::string("alps"),groundupdb::EncodedValue(2));
+      db->setKeyValue(std::string("beta"),groundupdb::EncodedValue(3));
+      std::vector<groundupdb::HashedKey> prefixed = db->keysWithPrefix("al");
+      REQUIRE(prefixed.size() == 2);
+      REQUIRE(prefixed[0] == groundupdb::HashedKey(std::string("alpha")));
+      REQUIRE(db->keysInRange("alpz","c").size() == 1);
+    }
+    for (auto& db : dbs) {
+      db->destroy();
+    }
+  }
 }
@@ -18,8 +18,44 @@ under the License.
 #include "catch.hpp"
 
 #include "groundupdb/groundupdb.h"
+#include "groundupdb/groundupdbext.h"
 
+#include <array>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <map>
+#include <new>
+#include <string_view>
+#include <unordered_set>
+
+// Counts allocations made on this thread while an AllocationCounter is alive, so a test can
+// check a path allocates nothing. Other tests, and other threads, are never counted.
+static thread_local std::size_t* t_allocations = nullptr;
+
+struct AllocationCounter {
+  std::size_t allocations = 0;
+  AllocationCounter() { t_allocations = &allocations; }
+  ~AllocationCounter() { t_allocations = nullptr; }
+};
+
+void* operator new(std::size_t size) {
+  if (nullptr != t_allocations) {
+    ++*t_allocations;
+  }
+  if (void* p = std::malloc(0 == size ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p,std::size_t) noexcept {
+  std::free(p);
+}
 
 TEST_CASE("keyvalue","[setKeyValue,getKeyValue]") {
 
@@ -49,7 +85,7 @@ TEST_CASE("keyvalue","[setKeyValue,getKeyValue]") {
     ev1chars[pos] = '\0';
     REQUIRE(0 == strcmp(val.c_str(),ev1chars));
     REQUIRE(0 != ev1.hash());
-    REQUIRE(groundupdb::Type::CPP == ev1.type());
+    REQUIRE(groundupdb::Type::STRING == ev1.type());
     REQUIRE(value == ev1);
 
     groundupdb::EncodedValue value2("Some highly valuable value number 2");
@@ -82,7 +118,62 @@ TEST_CASE("keyvalue","[setKeyValue,getKeyValue]") {
     db->destroy();
   }
 
+  //   [Who]   As a database user
+  //   [What]  I need to fetch many values in one call
+  //   [Value] So bulk reads don't pay per-key overheads
+  SECTION("keyvalue-multiget") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+
+    std::vector<std::string> keys{"first","second","third"};
+    for (auto& k : keys) {
+      db->setKeyValue(k,groundupdb::EncodedValue(k + " value"));
+    }
+    keys.push_back("missing");
+
+    std::vector<groundupdb::EncodedValue> values = db->getKeyValues(keys);
+    REQUIRE(values.size() == 4);
+    REQUIRE(values[0] == groundupdb::EncodedValue(std::string("first value")));
+    REQUIRE(values[1] == groundupdb::EncodedValue(std::string("second value")));
+    REQUIRE(values[2] == groundupdb::EncodedValue(std::string("third value")));
+    REQUIRE(!values[3].hasValue());
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I need to look up keys I only hold as a string_view or raw bytes
+  //   [Value] So cache style GETs, which mostly miss, cost no allocations
+  SECTION("keyvalue-keyview") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    db->setKeyValue(std::string("present"),groundupdb::EncodedValue(std::string("a value")));
+
+    std::string_view present("present and more",7);
+    REQUIRE(groundupdb::HashedKey(present) == groundupdb::HashedKey(std::string("present")));
+    REQUIRE(groundupdb::KeyView(present).hash() == groundupdb::HashedKey(std::string("present")).hash());
+    REQUIRE(db->getKeyValue(groundupdb::KeyView(present)) == groundupdb::EncodedValue(std::string("a value")));
 
+    const char raw[] = "missing key";
+    std::size_t allocated = 0;
+    groundupdb::EncodedValue missing;
+    {
+      AllocationCounter counter;
+      missing = db->getKeyValue(groundupdb::KeyView(std::string_view(raw)));
+      allocated = counter.allocations;
+    }
+    REQUIRE(!missing.hasValue());
+    REQUIRE(0 == allocated);
+
+    // Views of byte ranges hash as their bytes do
+    groundupdb::Bytes bytes{std::byte{'p'},std::byte{'r'},std::byte{'e'},std::byte{'s'},std::byte{'e'},std::byte{'n'},std::byte{'t'}};
+    std::array<std::byte,7> array;
+    std::copy(bytes.begin(),bytes.end(),array.begin());
+    REQUIRE(db->getKeyValue(groundupdb::KeyView(bytes)) == groundupdb::EncodedValue(std::string("a value")));
+    REQUIRE(groundupdb::KeyView(array).hash() == groundupdb::KeyView(present).hash());
+
+    db->destroy();
+  }
 }
 
 TEST_CASE("keyvalue-set","setKeyValue(std::string,std::unordered_set<std::string>),getKeyValueSet") {
@@ -113,4 +204,327 @@ TEST_CASE("keyvalue-set","setKeyValue(std::string,std::unordered_set<std::string
 
     db->destroy();
   }
+
+  SECTION("Binary set values in the file store") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>(".groundupdb/" + dbname);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,fileStore));
+
+    std::string key("binaryset");
+    groundupdb::Set set = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    set->insert(groundupdb::EncodedValue(std::string("two\nlines")));
+    set->insert(groundupdb::EncodedValue((long long int)-1));
+    set->insert(groundupdb::compactIntegers({1,2,3,5,8,13}));
+    // hashed as every stored value is, since members' hashes are computed again when read
+    set->insert(groundupdb::EncodedValue(groundupdb::Type::CPP,groundupdb::Bytes(),0,groundupdb::KeyView(groundupdb::Bytes()).hash()));
+    db->setKeyValue(key,set);
+    auto result = db->getKeyValueSet(key);
+    REQUIRE(result->size() == 4);
+    for (auto& value : *set) {
+      REQUIRE(result->find(value) != result->end());
+    }
+
+    // Members are stored as just their type, length and bytes, and hashed again when read
+    groundupdb::HashedKey numbersKey(std::string("numbers"));
+    groundupdb::Set numbers = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    for (int i = 0;i < 1000;i++) {
+      numbers->insert(groundupdb::EncodedValue(i));
+    }
+    db->setKeyValue(numbersKey,numbers);
+    std::string numbersFile(".groundupdb/" + dbname + "/" + std::to_string(numbersKey.hash()) + ".kv");
+    REQUIRE(std::filesystem::file_size(numbersFile) < 1000 * 8);
+    groundupdb::Set reread = groundupdbext::FileKeyValueStore(".groundupdb/" + dbname).getKeyValueSet(numbersKey);
+    REQUIRE(*reread == *numbers);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to add and remove single members of a large set
+  //   [Value] Without the cost of rewriting the whole set each time
+  SECTION("Set member changes") {
+    std::string path(".groundupdb/setmembers");
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>(path);
+    groundupdbext::MemoryKeyValueStore store(fileStore);
+    groundupdb::HashedKey key(std::string("members"));
+
+    groundupdb::Set initial = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    initial->insert(groundupdb::EncodedValue(std::string("first")));
+    store.setKeyValue(key,initial);
+    for (int i = 0;i < 50;i++) {
+      store.addToKeyValueSet(key,groundupdb::EncodedValue(i));
+    }
+    store.addToKeyValueSet(key,groundupdb::EncodedValue(7)); // already a member
+    for (int i = 0;i < 50;i += 2) {
+      store.removeFromKeyValueSet(key,groundupdb::EncodedValue(i));
+    }
+    REQUIRE(store.getKeyValueSet(key)->size() == 26);
+    REQUIRE(store.keyValueSetSize(key) == 26);
+    REQUIRE(store.keyValueSetContains(key,groundupdb::EncodedValue(7)));
+    REQUIRE(!store.keyValueSetContains(key,groundupdb::EncodedValue(8)));
+
+    // Logs are folded in by the changes that grow them, so reading rewrites nothing
+    auto files = [&path]() {
+      std::map<std::string,std::pair<std::uintmax_t,std::filesystem::file_time_type>> found;
+      for (auto& p : std::filesystem::directory_iterator(path)) {
+        found[p.path().filename().string()] = {p.file_size(),p.last_write_time()};
+      }
+      return found;
+    };
+    auto before = files();
+    for (auto& [name,file] : before) {
+      if (".log" == std::filesystem::path(name).extension()) {
+        INFO("  Log file: " << name);
+        REQUIRE(file.first <= before.at(std::filesystem::path(name).stem().string()).first);
+      }
+    }
+    REQUIRE(groundupdbext::FileKeyValueStore(path).getKeyValueSet(key)->size() == 26);
+    REQUIRE(files() == before);
+
+    // A new file store must see every change, whether folded in or still in the log
+    for (int reload = 0;reload < 2;reload++) {
+      groundupdbext::FileKeyValueStore reloaded(path);
+      groundupdb::Set members = reloaded.getKeyValueSet(key);
+      REQUIRE(members->size() == 26);
+      REQUIRE(members->count(groundupdb::EncodedValue(std::string("first"))) == 1);
+      REQUIRE(members->count(groundupdb::EncodedValue(7)) == 1);
+      REQUIRE(members->count(groundupdb::EncodedValue(8)) == 0);
+      REQUIRE(reloaded.keyValueSetSize(key) == 26);
+      REQUIRE(reloaded.keyValueSetContains(key,groundupdb::EncodedValue(std::string("first"))));
+      REQUIRE(reloaded.keyValueSetContains(key,groundupdb::EncodedValue(7)));
+      REQUIRE(!reloaded.keyValueSetContains(key,groundupdb::EncodedValue(8)));
+      REQUIRE(!reloaded.keyValueSetContains(key,groundupdb::EncodedValue(50)));
+    }
+
+    // Size and membership are read from the log and data file without loading the set
+    {
+      groundupdbext::FileKeyValueStore direct(path);
+      direct.removeFromKeyValueSet(key,groundupdb::EncodedValue(std::string("first"))); // in the data file
+      direct.addToKeyValueSet(key,groundupdb::EncodedValue(8)); // removed earlier
+      direct.addToKeyValueSet(key,groundupdb::EncodedValue(100));
+      direct.removeFromKeyValueSet(key,groundupdb::EncodedValue(100)); // added then removed
+      direct.addToKeyValueSet(key,groundupdb::EncodedValue(7)); // already a member
+      REQUIRE(direct.keyValueSetSize(key) == 26);
+      REQUIRE(direct.keyValueSetSize(key) == direct.getKeyValueSet(key)->size());
+      REQUIRE(!direct.keyValueSetContains(key,groundupdb::EncodedValue(std::string("first"))));
+      REQUIRE(direct.keyValueSetContains(key,groundupdb::EncodedValue(8)));
+      REQUIRE(!direct.keyValueSetContains(key,groundupdb::EncodedValue(100)));
+      REQUIRE(direct.keyValueSetContains(key,groundupdb::EncodedValue(7)));
+    }
+
+    // Adding to a missing set creates it
+    groundupdb::HashedKey newKey(std::string("new members"));
+    store.addToKeyValueSet(newKey,groundupdb::EncodedValue(std::string("only")));
+    REQUIRE(groundupdbext::FileKeyValueStore(path).getKeyValueSet(newKey)->size() == 1);
+
+    store.clear();
+  }
+}
+
+void checkKeyRanges(const std::unique_ptr<groundupdb::IDatabase>& db) {
+  for (int tenant = 40;tenant < 44;tenant++) {
+    for (int i = 0;i < 5;i++) {
+      db->setKeyValue(std::string("user:") + std::to_string(tenant) + ":" + std::to_string(i),groundupdb::EncodedValue(i));
+    }
+  }
+  groundupdb::Set set = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+  set->insert(groundupdb::EncodedValue(1));
+  db->setKeyValue(std::string("user:42:set"),set);
+  db->setKeyValue(std::string("user:420"),groundupdb::EncodedValue(0));
+
+  std::vector<groundupdb::HashedKey> keys = db->keysWithPrefix("user:42:");
+  std::vector<groundupdb::HashedKey> expected;
+  for (auto key : {"user:42:0","user:42:1","user:42:2","user:42:3","user:42:4","user:42:set"}) {
+    expected.emplace_back(std::string(key));
+  }
+  REQUIRE(keys == expected);
+
+  keys = db->keysInRange("user:41:3","user:42:1");
+  REQUIRE(keys.size() == 4); // 41:3, 41:4, 420 ('0' sorts before ':') and 42:0
+  REQUIRE(keys.front() == groundupdb::HashedKey(std::string("user:41:3")));
+  REQUIRE(keys.back() == groundupdb::HashedKey(std::string("user:42:0")));
+  REQUIRE(db->keysWithPrefix("user:").size() == 22);
+  REQUIRE(db->keysWithPrefix("nobody").empty());
+  REQUIRE(db->keysInRange("b","a").empty());
+}
+
+TEST_CASE("keyvalue-ranges","[keysWithPrefix,keysInRange]") {
+
+  //   [Who]   As a database user
+  //   [What]  I want to list the keys starting with a prefix, or in a range
+  //   [Value] So I can enumerate one tenant's keys without reading every key
+  SECTION("ranges-ordered-memorystore") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>(true);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore));
+    checkKeyRanges(db);
+    db->destroy();
+  }
+
+  SECTION("ranges-filestore") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    checkKeyRanges(db);
+    db->destroy();
+  }
+
+  SECTION("ranges-ordered-reload") {
+    // Keys already on disk, including sets, must be in the ordered keys from the start
+    std::string dbname("myemptydb");
+    std::string path("./groundupdb/" + dbname);
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>(path);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,fileStore));
+    checkKeyRanges(db);
+    db.reset();
+    std::unique_ptr<groundupdb::KeyValueStore> reloaded = std::make_unique<groundupdbext::FileKeyValueStore>(path);
+    std::unique_ptr<groundupdb::KeyValueStore> cache = std::make_unique<groundupdbext::MemoryKeyValueStore>(reloaded,true);
+    db = groundupdb::GroundUpDB::createEmptyDB(dbname,cache);
+    REQUIRE(db->keysWithPrefix("user:42:").size() == 6);
+    db->destroy();
+  }
+}
+
+// Forces every hash into a tiny range for the life of a test, so keys collide
+struct TinyHashWidth {
+  TinyHashWidth(unsigned int bits) { groundupdb::DefaultHash::setWidth(bits); }
+  ~TinyHashWidth() { groundupdb::DefaultHash::setWidth(64); }
+};
+
+void checkCollidingKeys(const std::unique_ptr<groundupdb::IDatabase>& db,int total) {
+  for (int i = 0;i < total;i++) {
+    db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(std::string("value ") + std::to_string(i)));
+  }
+  // overwrite some, to be sure the rest of the chain survives a rewrite
+  for (int i = 0;i < total;i += 3) {
+    db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(std::string("new value ") + std::to_string(i)));
+  }
+  for (int i = 0;i < total;i++) {
+    std::string expected((0 == i % 3 ? "new value " : "value ") + std::to_string(i));
+    REQUIRE(db->getKeyValue(std::string("key ") + std::to_string(i)) == groundupdb::EncodedValue(expected));
+  }
+  REQUIRE(!db->getKeyValue(std::string("not a key")).hasValue());
+}
+
+TEST_CASE("keyvalue-collisions","[setKeyValue,getKeyValue][collisions]") {
+
+  //   [Who]   As a database administrator
+  //   [What]  I need keys whose hashes collide to be stored separately
+  //   [Value] So I can choose smaller, faster hashes without losing data
+  SECTION("collisions-memorystore") {
+    TinyHashWidth width(3);
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    checkCollidingKeys(db,50);
+    db->destroy();
+  }
+
+  SECTION("collisions-filestore") {
+    TinyHashWidth width(3);
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>(".groundupdb/" + dbname);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,fileStore));
+    checkCollidingKeys(db,50);
+    db->destroy();
+  }
+
+  SECTION("collisions-filestore-sets") {
+    // Sets and values share collision chains, and must both be written and read back from disk
+    TinyHashWidth width(3);
+    std::string path(".groundupdb/collidingsets");
+    {
+      groundupdbext::FileKeyValueStore store(path);
+      for (int i = 0;i < 20;i++) {
+        groundupdb::Set set = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+        set->insert(groundupdb::EncodedValue(i));
+        set->insert(groundupdb::EncodedValue(std::string("member ") + std::to_string(i)));
+        store.setKeyValue(groundupdb::HashedKey(std::string("set ") + std::to_string(i)),set);
+        store.setKeyValue(groundupdb::HashedKey(std::string("value ") + std::to_string(i)),groundupdb::EncodedValue(i));
+      }
+    }
+    groundupdbext::FileKeyValueStore reloaded(path);
+    for (int i = 0;i < 20;i++) {
+      groundupdb::HashedKey key(std::string("set ") + std::to_string(i));
+      groundupdb::Set members = reloaded.getKeyValueSet(key);
+      REQUIRE(members->size() == 2);
+      REQUIRE(members->count(groundupdb::EncodedValue(i)) == 1);
+      REQUIRE(members->count(groundupdb::EncodedValue(std::string("member ") + std::to_string(i))) == 1);
+      REQUIRE(reloaded.keyValueSetSize(key) == 2);
+      REQUIRE(reloaded.getKeyValue(groundupdb::HashedKey(std::string("value ") + std::to_string(i))) == groundupdb::EncodedValue(i));
+    }
+
+    // The first key stored under each hash is read from its data file alone, without its chain
+    for (auto& p : std::filesystem::directory_iterator(path)) {
+      if (".key" == p.path().extension()) {
+        std::filesystem::remove(p.path());
+      }
+    }
+    std::unordered_set<std::size_t> hashes;
+    for (int i = 0;i < 20;i++) {
+      groundupdb::HashedKey set(std::string("set ") + std::to_string(i));
+      if (hashes.insert(set.hash()).second) {
+        REQUIRE(reloaded.getKeyValueSet(set)->count(groundupdb::EncodedValue(i)) == 1);
+        REQUIRE(reloaded.keyValueSetContains(set,groundupdb::EncodedValue(i)));
+      }
+      groundupdb::HashedKey value(std::string("value ") + std::to_string(i));
+      if (hashes.insert(value.hash()).second) {
+        REQUIRE(reloaded.getKeyValue(value) == groundupdb::EncodedValue(i));
+        REQUIRE(reloaded.hasKey(groundupdb::KeyView(value)));
+      }
+    }
+    REQUIRE(!hashes.empty());
+    reloaded.clear();
+  }
+
+  //   [Who]   As a database administrator
+  //   [What]  I need to know what queries return when key hashes collide
+  //   [Value] So I only narrow hashes where that is acceptable
+  SECTION("collisions-queries") {
+    // Indexes hold key hashes, so a key sharing a hash with a match is returned with it
+    TinyHashWidth width(3);
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string bucket("few");
+    groundupdb::HashedKey first(std::string("key 0"));
+    groundupdb::HashedKey second(std::string("key 1"));
+    db->setKeyValue(first,groundupdb::EncodedValue(0),bucket);
+    db->setKeyValue(second,groundupdb::EncodedValue(1),bucket);
+    std::unordered_set<groundupdb::HashedKey> expected{first,second};
+    for (int i = 2;i < 20;i++) {
+      groundupdb::HashedKey key(std::string("key ") + std::to_string(i));
+      db->setKeyValue(key,groundupdb::EncodedValue(i));
+      if (key.hash() == first.hash() || key.hash() == second.hash()) {
+        expected.insert(key);
+      }
+    }
+    REQUIRE(expected.size() > 2);
+
+    groundupdb::BucketQuery bq(bucket);
+    REQUIRE(*db->query(bq)->recordKeys() == expected);
+    groundupdb::QueryCursor cursor = db->queryCursor(bq);
+    std::unordered_set<groundupdb::HashedKey> streamed;
+    std::vector<groundupdb::HashedKey> batch;
+    while (cursor->next(batch,100)) {
+      streamed.insert(batch.begin(),batch.end());
+    }
+    REQUIRE(streamed == expected);
+    db->destroy();
+  }
+
+  SECTION("collisions-reload") {
+    TinyHashWidth width(3);
+    std::string dbname("myemptydb");
+    {
+      std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+      checkCollidingKeys(db,50);
+    }
+    // Memory store is rebuilt from every chain on disk
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::loadDB(dbname));
+    REQUIRE(db->getKeyValue(std::string("key 0")) == groundupdb::EncodedValue(std::string("new value 0")));
+    REQUIRE(db->getKeyValue(std::string("key 49")) == groundupdb::EncodedValue(std::string("value 49")));
+    db->destroy();
+  }
 }
@@ -18,7 +18,10 @@ under the License.
 #define CATCH_CONFIG_ENABLE_BENCHMARKING 1
 #include "catch.hpp"
 
+#include <algorithm>
+#include <random>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <chrono>
 #include <string>
@@ -317,7 +320,7 @@ TEST_CASE("query-performance","[!hide][performance][query]") {
     begin = std::chrono::steady_clock::now();
     std::unique_ptr<groundupdb::IQueryResult> res(db->query(bq));
     std::cout << "Retrieving results" << std::endl;
-    const groundupdb::KeySet& recordKeys = res->recordKeys();
+    const groundupdb::SharedKeySet& recordKeys = res->recordKeys();
     end = std::chrono::steady_clock::now();
     auto queryTimeMicro = (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0);
     std::cout << "  Query completed in "
@@ -335,6 +338,199 @@ TEST_CASE("query-performance","[!hide][performance][query]") {
     std::cout << "Tests complete" << std::endl;
     db->destroy();
   }
+  SECTION("Query with values vs. query then get - File key-value store") {
+    std::cout << "====== File key-value store performance test - Query with values ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>("./groundupdb/" + dbname);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,fileStore));
+    std::string bucket("my bucket");
+    int total = 5'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(std::to_string(i)),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::unique_ptr<groundupdb::IQueryResult> res(db->query(bq));
+    std::size_t fetched = 0;
+    for (auto& key : *res->recordKeys()) {
+      fetched += db->getKeyValue(key).hasValue() ? 1 : 0;
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  Query then get of " << fetched << " values in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    groundupdb::QueryValues values = db->queryWithValues(bq);
+    end = std::chrono::steady_clock::now();
+    std::cout << "  Query with values of " << values.size() << " values in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    REQUIRE(fetched == (std::size_t)total);
+    REQUIRE(values.size() == (std::size_t)total);
+    db->destroy();
+  }
+  SECTION("Aggregate vs. query with values - In-memory key-value store") {
+    std::cout << "====== In-memory key-value store performance test - Aggregate ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore));
+    std::string bucket("my bucket");
+    int total = 100'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(i * 0.5),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    double clientSum = 0;
+    for (auto& kv : db->queryWithValues(bq)) {
+      clientSum += kv.second.view().asDouble().value_or(0);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  Query with values then sum in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    std::optional<double> sum = db->aggregate(bq,groundupdb::Aggregate::Sum);
+    end = std::chrono::steady_clock::now();
+    std::cout << "  Aggregate sum in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    REQUIRE(sum == clientSum);
+    db->destroy();
+  }
+  SECTION("Filter scan vs. query with values - In-memory key-value store") {
+    std::cout << "====== In-memory key-value store performance test - Filter scan ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string bucket("my bucket");
+    int total = 100'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(std::string("value number ") + std::to_string(i)),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::size_t clientMatches = 0;
+    for (auto& kv : db->queryWithValues(bq)) {
+      std::optional<std::string> text = kv.second.asString();
+      if (text && std::string::npos != text->find("number 99")) {
+        clientMatches++;
+      }
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  Query with values then find in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    groundupdb::FilterQuery contains(groundupdb::Filter::Contains,groundupdb::EncodedValue(std::string("number 99")));
+    begin = std::chrono::steady_clock::now();
+    std::size_t matches = db->query(contains)->recordKeys()->size();
+    end = std::chrono::steady_clock::now();
+    std::cout << "  Filter scan in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    REQUIRE(matches == clientMatches);
+    db->destroy();
+  }
+  SECTION("Repeated bucket query performance test - In-memory key-value store") {
+    std::cout << "====== In-memory key-value store performance test - Repeated bucket query ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string bucket("my bucket");
+    int total = 100'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(i),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(bq);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  First query of " << res->recordKeys()->size() << " keys in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    int repeats = 1'000;
+    std::size_t found = 0;
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0;i < repeats;i++) {
+      found += db->query(bq)->recordKeys()->size();
+    }
+    end = std::chrono::steady_clock::now();
+    std::cout << "  " << repeats << " repeated queries in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    REQUIRE(found == (std::size_t)total * repeats);
+    db->destroy();
+  }
+  SECTION("Parallel compound query performance test - In-memory key-value store") {
+    std::cout << "====== In-memory key-value store performance test - Parallel AND/OR ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string low("low");
+    std::string high("high");
+    int total = 400'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(i),(i < total / 2) ? low : high);
+      if (0 == i % 2) {
+        db->setKeyValue(std::to_string(i),groundupdb::EncodedValue(i),(i < total / 2) ? high : low);
+      }
+    }
+    std::vector<std::string> buckets{low,high};
+    groundupdb::AndQuery both(buckets);
+    groundupdb::OrQuery either(buckets);
+    for (std::size_t threads : {std::size_t{1},std::size_t{0}}) {
+      db->setQueryThreads(threads);
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      std::optional<double> matched = db->aggregate(both,groundupdb::Aggregate::Count);
+      std::optional<double> sum = db->aggregate(either,groundupdb::Aggregate::Sum);
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      std::cout << "  " << (1 == threads ? std::string("1") : std::string("hardware")) << " thread(s): AND then OR sum in "
+                << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+                << " seconds" << std::endl;
+      REQUIRE(matched == total / 2);
+      REQUIRE(sum == (total - 1.0) * total / 2);
+    }
+    db->destroy();
+  }
+  SECTION("Prefix scan performance test - Ordered vs. unordered in-memory key-value store") {
+    std::cout << "====== In-memory key-value store performance test - Prefix scan ======" << std::endl;
+    int tenants = 20'000;
+    int perTenant = 10;
+    for (bool ordered : {false,true}) {
+      std::string dbname("myemptydb");
+      std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>(ordered);
+      std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore));
+      for (int t = 0;t < tenants;t++) {
+        for (int i = 0;i < perTenant;i++) {
+          db->setKeyValue(std::string("user:") + std::to_string(t) + ":" + std::to_string(i),groundupdb::EncodedValue(i));
+        }
+      }
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      std::vector<groundupdb::HashedKey> keys = db->keysWithPrefix("user:4242:");
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      std::cout << "  " << (ordered ? "Ordered" : "Unordered") << " store, " << keys.size() << " of "
+                << (tenants * perTenant) << " keys in "
+                << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+                << " seconds" << std::endl;
+      REQUIRE(keys.size() == (std::size_t)perTenant);
+      db->destroy();
+    }
+  }
 }
 
 TEST_CASE("profiling-100k","[!hide][performance][memory][100k]") {
@@ -495,4 +691,200 @@ TEST_CASE("profiling-1m","[!hide][performance][memory][1m]") {
     db->destroy();
   }
 
-}
\ No newline at end of file
+}
+TEST_CASE("hashing-batch-performance","[!hide][performance][hashing]") {
+
+  SECTION("Batch vs per-key hashing of 64 byte keys") {
+    std::cout << "====== Key hashing performance test - batch vs per-key ======" << std::endl;
+    int total = 1'000'000;
+    std::size_t batchSize = 16;
+
+    std::vector<std::string> keys;
+    keys.reserve(total);
+    for (int i = 0; i < total;i++) {
+      std::string k = std::to_string(i);
+      keys.push_back(std::string(64 - k.length(),'k') + k);
+    }
+
+    std::cout << "====== PER-KEY ======" << std::endl;
+    std::size_t check = 0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (auto& k : keys) {
+      check ^= groundupdb::HashedKey(k).hash();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    auto perKeyMicro = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    std::cout << "  " << keys.size() << " completed in " << (perKeyMicro / 1000000.0) << " seconds" << std::endl;
+    std::cout << "  " << (keys.size() * 1000000.0 / perKeyMicro) << " keys per second" << std::endl;
+
+    std::cout << "====== BATCH OF " << batchSize << " ======" << std::endl;
+    std::size_t batchCheck = 0;
+    begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0;i < keys.size();i += batchSize) {
+      std::vector<std::string> batch(keys.begin() + i,keys.begin() + std::min(i + batchSize,keys.size()));
+      for (auto& hk : groundupdb::hashKeys(batch)) {
+        batchCheck ^= hk.hash();
+      }
+    }
+    end = std::chrono::steady_clock::now();
+    auto batchMicro = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    std::cout << "  " << keys.size() << " completed in " << (batchMicro / 1000000.0) << " seconds" << std::endl;
+    std::cout << "  " << (keys.size() * 1000000.0 / batchMicro) << " keys per second" << std::endl;
+
+    REQUIRE(check == batchCheck);
+    REQUIRE(batchMicro < perKeyMicro);
+  }
+}
+
+TEST_CASE("bucket-index-performance","[!hide][performance][query][index]") {
+
+  SECTION("Bucket index set insert and lookup with 200 000 members") {
+    std::cout << "====== Bucket index container performance test ======" << std::endl;
+    int total = 200'000;
+
+    std::vector<groundupdb::HashedKey> keys;
+    keys.reserve(total);
+    for (int i = 0; i < total;i++) {
+      keys.emplace_back(std::string("user:") + std::to_string(i));
+    }
+
+    // Same container and element type as a bucket index (see EmbeddedDatabase::Impl::indexForBucket)
+    groundupdb::Set members = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    std::cout << "====== INSERT ======" << std::endl;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (auto& key : keys) {
+      members->emplace(groundupdb::Type::KEY,key.data(),key.length(),key.hash());
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  " << keys.size() << " completed in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    std::cout << "====== LOOKUP ======" << std::endl;
+    std::size_t found = 0;
+    begin = std::chrono::steady_clock::now();
+    for (auto& key : keys) {
+      found += members->count(groundupdb::EncodedValue(groundupdb::Type::KEY,key.data(),key.length(),key.hash()));
+    }
+    end = std::chrono::steady_clock::now();
+    std::cout << "  " << keys.size() << " completed in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    // A well distributed hash keeps hash table chains short
+    std::size_t longest = 0;
+    for (std::size_t b = 0;b < members->bucket_count();b++) {
+      longest = std::max(longest,members->bucket_size(b));
+    }
+    std::cout << "  Longest hash table chain: " << longest << std::endl;
+
+    REQUIRE(found == keys.size());
+    REQUIRE(members->size() == keys.size());
+    REQUIRE(longest < 32);
+  }
+
+  SECTION("Bucketed inserts of 20 000 keys in to one bucket") {
+    std::cout << "====== Bucketed insert performance test ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string bucket("perf bucket");
+    int total = 20'000;
+
+    // Each insert only appends to the bucket index, so time per key should stay flat
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::string("user:") + std::to_string(i),groundupdb::EncodedValue(i),bucket);
+      if (0 == (i + 1) % 5'000) {
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        std::cout << "  " << (i + 1) << " completed in "
+                  << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+                  << " seconds" << std::endl;
+      }
+    }
+
+    groundupdb::BucketQuery bq(bucket);
+    REQUIRE(db->query(bq)->recordKeys()->size() == (std::size_t)total);
+    db->destroy();
+  }
+
+  SECTION("Sorted hash list intersection of 1 000 000 members") {
+    std::cout << "====== Sorted hash list intersection performance test ======" << std::endl;
+    std::mt19937_64 rng(1);
+    auto randomList = [&rng](std::size_t length) {
+      std::vector<std::uint64_t> list(length);
+      for (auto& v : list) {
+        v = rng() % (length * 2); // roughly half of each pair of lists overlaps
+      }
+      std::sort(list.begin(),list.end());
+      list.erase(std::unique(list.begin(),list.end()),list.end());
+      return list;
+    };
+    std::vector<std::uint64_t> a = randomList(1'000'000);
+    std::vector<std::uint64_t> b = randomList(1'000'000);
+    std::vector<std::uint64_t> small = randomList(1'000);
+
+    std::unordered_set<std::uint64_t> lookup(a.begin(),a.end());
+    for (auto* other : {&b,&small}) {
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      std::vector<std::uint64_t> result = groundupdb::intersectSorted(a,*other);
+      std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+      std::cout << "  " << a.size() << " with " << other->size() << " -> " << result.size() << " completed in "
+                << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+                << " seconds" << std::endl;
+
+      // The same intersection through a hash set, as a client would do it today
+      begin = std::chrono::steady_clock::now();
+      std::size_t found = 0;
+      for (auto v : *other) {
+        found += lookup.count(v);
+      }
+      end = std::chrono::steady_clock::now();
+      std::cout << "  unordered_set probe completed in "
+                << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+                << " seconds (excluding building the set)" << std::endl;
+      REQUIRE(found == result.size());
+    }
+  }
+
+  SECTION("First batch from a cursor over 100 000 bucket members") {
+    std::cout << "====== Query cursor performance test ======" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string bucket("large bucket");
+    int total = 100'000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::string("user:") + std::to_string(i),groundupdb::EncodedValue(i),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::size_t all = db->query(bq)->recordKeys()->size();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    std::cout << "  Full result of " << all << " keys in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    std::vector<groundupdb::HashedKey> batch;
+    groundupdb::QueryCursor cursor = db->queryCursor(bq);
+    cursor->next(batch,100);
+    end = std::chrono::steady_clock::now();
+    std::cout << "  First batch of " << batch.size() << " keys in "
+              << (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() / 1000000.0)
+              << " seconds" << std::endl;
+
+    begin = std::chrono::steady_clock::now();
+    std::size_t counted = db->count(bucket);
+    end = std::chrono::steady_clock::now();
+    std::cout << "  Count from the index of " << counted << " keys in "
+              << (std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / 1000000000.0)
+              << " seconds" << std::endl;
+
+    REQUIRE(all == (std::size_t)total);
+    REQUIRE(batch.size() == 100);
+    REQUIRE(counted == (std::size_t)total);
+    db->destroy();
+  }
+}
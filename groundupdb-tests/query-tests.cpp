@@ -20,7 +20,32 @@ under the License.
 #include "groundupdb/groundupdb.h"
 #include "groundupdb/groundupdbext.h"
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <random>
+#include <unordered_set>
+
+// An index store that counts how often a set is read, to show which queries read no store
+class SetReadCounter : public groundupdbext::MemoryKeyValueStore {
+public:
+  std::size_t reads = 0;
+
+  groundupdb::Set getKeyValueSet(const groundupdb::HashedValue& key) {
+    reads++;
+    return MemoryKeyValueStore::getKeyValueSet(key);
+  }
+  std::size_t keyValueSetSize(const groundupdb::HashedValue& key) {
+    reads++;
+    return MemoryKeyValueStore::keyValueSetSize(key);
+  }
+  bool keyValueSetContains(const groundupdb::HashedValue& key,const groundupdb::EncodedValue& member) {
+    reads++;
+    return MemoryKeyValueStore::keyValueSetContains(key,member);
+  }
+};
 
 TEST_CASE("query","[query]") {
 
@@ -58,7 +83,7 @@ TEST_CASE("query","[query]") {
     std::cout << "Executing query" << std::endl;
     std::unique_ptr<groundupdb::IQueryResult> res = db->query(bq);
     std::cout << "Retrieving results" << std::endl;
-    const groundupdb::KeySet& recordKeys = res->recordKeys();
+    const groundupdb::SharedKeySet& recordKeys = res->recordKeys();
 
     std::cout << "Processing results" << std::endl;
     std::vector<std::string> keys;
@@ -130,7 +155,7 @@ TEST_CASE("query","[query]") {
     std::cout << "Executing query" << std::endl;
     std::unique_ptr<groundupdb::IQueryResult> res = db->query(bq);
     std::cout << "Retrieving results" << std::endl;
-    const groundupdb::KeySet& recordKeys = res->recordKeys();
+    const groundupdb::SharedKeySet& recordKeys = res->recordKeys();
 
     std::cout << "Processing results" << std::endl;
     std::vector<std::string> keys;
@@ -170,4 +195,755 @@ TEST_CASE("query","[query]") {
     db->destroy();
   }
 
+  //   [Who]   As a database user
+  //   [What]  I want bucket membership to be cheap to store and reload
+  //   [Value] So large buckets do not dominate my database's footprint
+  SECTION("query-bucket-index") {
+    std::cout << "Creating DB" << std::endl;
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+
+    std::string bucket("bucket 1");
+    std::vector<std::string> keys;
+    for (int i = 0;i < 100;i++) {
+      keys.push_back(std::string("user:") + std::to_string(i));
+      db->setKeyValue(keys.back(),groundupdb::EncodedValue("member"),bucket);
+    }
+    // Re-adding a member must not duplicate it
+    db->setKeyValue(keys.front(),groundupdb::EncodedValue("updated"),bucket);
+    db->setKeyValue(std::string("outside"),groundupdb::EncodedValue("not a member"));
+
+    groundupdb::BucketQuery bq(bucket);
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(bq);
+    const groundupdb::SharedKeySet& recordKeys = res->recordKeys();
+    REQUIRE(recordKeys->size() == keys.size());
+    for (auto& key : keys) {
+      INFO("  Key expected in bucket: " << key);
+      REQUIRE(recordKeys->find(key) != recordKeys->end());
+    }
+    REQUIRE(recordKeys->find(std::string("outside")) == recordKeys->end());
+
+    // Member keys are resolved from their hashes, so must survive a reload
+    std::cout << "Reloading DB" << std::endl;
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    std::unique_ptr<groundupdb::IQueryResult> reloaded = db->query(bq);
+    REQUIRE(reloaded->recordKeys()->size() == keys.size());
+    REQUIRE(reloaded->recordKeys()->find(keys.back()) != reloaded->recordKeys()->end());
+
+    std::cout << "Destroying db" << std::endl;
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want buckets and value indexes to stay correct as they grow and change
+  //   [Value] So I can rely on them however many keys I add, move or reload
+  SECTION("query-bucket-index-changes") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    db->createValueIndex("by parity");
+
+    // Enough changes for each index to be rewritten at least once
+    std::string bucket("big bucket");
+    const int total = 3000;
+    for (int i = 0;i < total;i++) {
+      db->setKeyValue(std::string("user:") + std::to_string(i),groundupdb::EncodedValue(i % 2 == 0 ? "even" : "odd"),bucket);
+    }
+    // Moving keys between value index entries removes them from the one they leave
+    for (int i = 0;i < total;i += 2) {
+      db->setKeyValue(std::string("user:") + std::to_string(i),groundupdb::EncodedValue("odd"));
+    }
+    groundupdb::BucketQuery bq(bucket);
+    groundupdb::ValueQuery even("by parity",groundupdb::EncodedValue("even"));
+    groundupdb::ValueQuery odd("by parity",groundupdb::EncodedValue("odd"));
+    auto check = [&]() {
+      REQUIRE(db->count(bucket) == total);
+      REQUIRE(db->query(bq)->recordKeys()->size() == total);
+      REQUIRE(db->bucketContains(bucket,std::string("user:0")));
+      REQUIRE(db->bucketContains(bucket,std::string("user:2999")));
+      REQUIRE(!db->bucketContains(bucket,std::string("user:3000")));
+      REQUIRE(db->query(even)->recordKeys()->empty());
+      REQUIRE(db->query(odd)->recordKeys()->size() == total);
+    };
+    check();
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    check();
+    db->destroy();
+
+    // Indexes written by older versions are sets of whole keys or of key hashes
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    groundupdb::HashedKey whole(std::string("user:1"));
+    groundupdb::HashedKey hashed(std::string("user:2"));
+    groundupdb::Set legacy = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    legacy->insert(groundupdb::EncodedValue(groundupdb::Type::KEY,whole.data(),whole.length(),whole.hash()));
+    legacy->insert(groundupdb::EncodedValue(static_cast<std::uint64_t>(hashed.hash())));
+    memoryIndexStore->setKeyValue(groundupdb::HashedKey(std::string("bucket::old")),legacy);
+    db = groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore);
+    db->setKeyValue(whole,groundupdb::EncodedValue("one"));
+    db->setKeyValue(hashed,groundupdb::EncodedValue("two"));
+    std::string oldBucket("old");
+    db->setKeyValue(std::string("user:3"),groundupdb::EncodedValue("three"),oldBucket);
+    REQUIRE(db->count(oldBucket) == 3);
+    REQUIRE(db->bucketContains(oldBucket,whole));
+    groundupdb::BucketQuery old(oldBucket);
+    REQUIRE(db->query(old)->recordKeys()->count(whole) == 1);
+    REQUIRE(db->query(old)->recordKeys()->count(hashed) == 1);
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to combine bucket queries with AND, OR and NOT
+  //   [Value] So I do not have to fetch and intersect whole buckets myself
+  SECTION("query-compound") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+
+    // Key i is in bucket "two" if i is even, "three" if divisible by three
+    for (int i = 0;i < 60;i++) {
+      std::string key(std::string("key ") + std::to_string(i));
+      db->setKeyValue(key,groundupdb::EncodedValue(i),"all");
+      if (0 == i % 2) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),"two");
+      }
+      if (0 == i % 3) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),"three");
+      }
+    }
+
+    groundupdb::AndQuery both(std::vector<std::string>{"two","three"});
+    REQUIRE(db->query(both)->recordKeys()->size() == 10);
+    REQUIRE(db->query(both)->recordKeys()->count(std::string("key 6")) == 1);
+
+    groundupdb::OrQuery either(std::vector<std::string>{"two","three"});
+    REQUIRE(db->query(either)->recordKeys()->size() == 40);
+
+    // Nested, and via the Query base class
+    std::string two("two");
+    std::string three("three");
+    std::string all("all");
+    std::vector<std::unique_ptr<groundupdb::Query>> clauses;
+    clauses.push_back(std::make_unique<groundupdb::BucketQuery>(two));
+    std::unique_ptr<groundupdb::Query> notThree = std::make_unique<groundupdb::NotQuery>(
+      std::make_unique<groundupdb::BucketQuery>(all),
+      std::make_unique<groundupdb::BucketQuery>(three));
+    clauses.push_back(std::move(notThree));
+    std::unique_ptr<groundupdb::Query> nested = std::make_unique<groundupdb::AndQuery>(std::move(clauses));
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(*nested);
+    const groundupdb::SharedKeySet& evenNotThree = res->recordKeys();
+    REQUIRE(evenNotThree->size() == 20);
+    REQUIRE(evenNotThree->count(std::string("key 4")) == 1);
+    REQUIRE(evenNotThree->count(std::string("key 6")) == 0);
+
+    groundupdb::AndQuery missing(std::vector<std::string>{"two","no such bucket"});
+    REQUIRE(db->query(missing)->recordKeys()->empty());
+
+    db->destroy();
+  }
+
+  SECTION("query-sorted-set-operations") {
+    // Compare against the standard library over a range of size ratios, so both
+    // the block compare and the galloping paths are used
+    std::mt19937_64 rng(42);
+    for (std::size_t longLength : {0,3,10,1000,50000}) {
+      for (std::size_t shortLength : {0,1,5,100,1000}) {
+        std::vector<std::uint64_t> a;
+        std::vector<std::uint64_t> b;
+        for (std::size_t i = 0;i < longLength;i++) {
+          a.push_back(rng() % (longLength * 4 + 1));
+        }
+        for (std::size_t i = 0;i < shortLength;i++) {
+          b.push_back(rng() % (longLength * 4 + 1));
+        }
+        for (auto* v : {&a,&b}) {
+          std::sort(v->begin(),v->end());
+          v->erase(std::unique(v->begin(),v->end()),v->end());
+        }
+        std::vector<std::uint64_t> expected;
+        std::set_intersection(a.begin(),a.end(),b.begin(),b.end(),std::back_inserter(expected));
+        INFO("Lengths " << a.size() << " and " << b.size());
+        REQUIRE(groundupdb::intersectSorted(a,b) == expected);
+        REQUIRE(groundupdb::intersectSorted(b,a) == expected);
+        expected.clear();
+        std::set_union(a.begin(),a.end(),b.begin(),b.end(),std::back_inserter(expected));
+        REQUIRE(groundupdb::unionSorted(a,b) == expected);
+        expected.clear();
+        std::set_difference(b.begin(),b.end(),a.begin(),a.end(),std::back_inserter(expected));
+        REQUIRE(groundupdb::differenceSorted(b,a) == expected);
+      }
+    }
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to page through the keys matching a query
+  //   [Value] So large results do not have to be held in memory all at once
+  SECTION("query-cursor") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string bucket("paged");
+    for (int i = 0;i < 25;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i),bucket);
+    }
+    groundupdb::BucketQuery bq(bucket);
+
+    std::vector<groundupdb::HashedKey> batch;
+    std::unordered_set<groundupdb::HashedKey> seen;
+    std::vector<std::size_t> sizes;
+    groundupdb::QueryCursor cursor = db->queryCursor(bq);
+    while (cursor->next(batch,10)) {
+      sizes.push_back(batch.size());
+      seen.insert(batch.begin(),batch.end());
+    }
+    REQUIRE(sizes == std::vector<std::size_t>{10,10,5});
+    REQUIRE(seen == *db->query(bq)->recordKeys());
+    REQUIRE(!cursor->next(batch,10)); // stays finished
+
+    // Offset and limit
+    groundupdb::QueryCursor page = db->queryCursor(bq,20,3);
+    REQUIRE(page->next(batch,10));
+    REQUIRE(batch.size() == 3);
+    REQUIRE(!page->next(batch,10));
+    REQUIRE(!db->queryCursor(bq,25,10)->next(batch,10));
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want the values of the keys my query matches
+  //   [Value] Without a separate round trip per key
+  SECTION("query-with-values") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> fileStore = std::make_unique<groundupdbext::FileKeyValueStore>("./groundupdb/" + dbname);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,fileStore));
+    std::string bucket("with values");
+    for (int i = 0;i < 20;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i * 10),bucket);
+    }
+    db->setKeyValue(std::string("outside"),groundupdb::EncodedValue(-1));
+
+    groundupdb::BucketQuery bq(bucket);
+    groundupdb::QueryValues values = db->queryWithValues(bq);
+    REQUIRE(values.size() == 20);
+    for (auto& [key,value] : values) {
+      REQUIRE(db->getKeyValue(key) == value);
+    }
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to count a bucket, and check keys exist, without fetching them
+  //   [Value] So cardinality checks are cheap
+  SECTION("query-count-exists") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string bucket("counted");
+    for (int i = 0;i < 30;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i),bucket);
+    }
+    db->setKeyValue(std::string("key 0"),groundupdb::EncodedValue(100),bucket); // not counted twice
+    db->setKeyValue(std::string("outside"),groundupdb::EncodedValue(-1));
+    groundupdb::Set set = std::make_unique<std::unordered_set<groundupdb::EncodedValue>>();
+    set->insert(groundupdb::EncodedValue(1));
+    db->setKeyValue(std::string("a set"),set);
+
+    REQUIRE(db->count(bucket) == 30);
+    REQUIRE(db->count("no such bucket") == 0);
+    REQUIRE(db->bucketContains(bucket,std::string("key 29")));
+    REQUIRE(!db->bucketContains(bucket,std::string("outside")));
+    REQUIRE(db->exists(std::string("outside")));
+    REQUIRE(db->exists(groundupdb::KeyView(std::string_view("key 3"))));
+    REQUIRE(db->exists(std::string("a set")));
+    REQUIRE(!db->exists(std::string("not stored")));
+
+    // After a reload the index is read back from its file
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    REQUIRE(db->count(bucket) == 30);
+    REQUIRE(db->bucketContains(bucket,std::string("key 0")));
+    REQUIRE(db->exists(std::string("a set")));
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to find the keys whose value, or a field of their value, is X
+  //   [Value] Without scanning every value in the database
+  SECTION("query-value-index") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    auto user = [](const std::string& city,const std::string& plan) {
+      return groundupdb::EncodedValue(std::map<std::string,std::string>{{"city",city},{"plan",plan}});
+    };
+    db->setKeyValue(std::string("user:1"),user("Leeds","free"));
+    db->setKeyValue(std::string("user:2"),user("York","paid"));
+
+    // Existing values are indexed on creation, later ones as they are set
+    db->createValueIndex("by city","city");
+    db->createValueIndex("whole value");
+    db->setKeyValue(std::string("user:3"),user("Leeds","paid"),"paying");
+    db->setKeyValue(std::string("user:4"),user("Hull","paid"),"paying");
+    db->setKeyValue(std::string("note"),groundupdb::EncodedValue(std::string("Leeds")));
+
+    groundupdb::ValueQuery leeds("by city",groundupdb::EncodedValue(std::string("Leeds")));
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(leeds);
+    REQUIRE(res->recordKeys()->size() == 2);
+    REQUIRE(res->recordKeys()->count(std::string("user:1")) == 1);
+    REQUIRE(res->recordKeys()->count(std::string("user:3")) == 1);
+
+    groundupdb::ValueQuery note("whole value",groundupdb::EncodedValue(std::string("Leeds")));
+    REQUIRE(db->query(note)->recordKeys()->size() == 1);
+    REQUIRE(db->query(note)->recordKeys()->count(std::string("note")) == 1);
+
+    // Changing a value moves its key to the new entry
+    db->setKeyValue(std::string("user:1"),user("York","free"));
+    REQUIRE(db->query(leeds)->recordKeys()->size() == 1);
+    groundupdb::ValueQuery york("by city",groundupdb::EncodedValue(std::string("York")));
+    REQUIRE(db->query(york)->recordKeys()->size() == 2);
+
+    // Definitions survive a reload, and combine with other queries
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    db->setKeyValue(std::string("user:5"),user("Leeds","paid"),"paying");
+    std::vector<std::unique_ptr<groundupdb::Query>> clauses;
+    clauses.push_back(std::make_unique<groundupdb::ValueQuery>("by city",groundupdb::EncodedValue(std::string("Leeds"))));
+    std::string paying("paying");
+    clauses.push_back(std::make_unique<groundupdb::BucketQuery>(paying));
+    groundupdb::AndQuery payingInLeeds(std::move(clauses));
+    std::unique_ptr<groundupdb::IQueryResult> combined = db->query(payingInLeeds);
+    REQUIRE(combined->recordKeys()->size() == 2);
+    REQUIRE(combined->recordKeys()->count(std::string("user:5")) == 1);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to find keys whose numeric value is within a range, or is among the highest
+  //   [Value] Without reading and sorting every value myself
+  SECTION("query-range-index") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    // Mixed numeric types are ordered together
+    for (int i = 0;i < 50;i++) {
+      std::string key(std::string("score ") + std::to_string(i));
+      if (0 == i % 2) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i * 10));
+      } else {
+        db->setKeyValue(key,groundupdb::EncodedValue(i * 10.0));
+      }
+    }
+    db->setKeyValue(std::string("not a number"),groundupdb::EncodedValue(std::string("150")));
+    db->createRangeIndex("score");
+    db->createRangeIndex("age","age");
+    db->setKeyValue(std::string("alice"),groundupdb::EncodedValue(std::map<std::string,long long int>{{"age",34}}));
+    db->setKeyValue(std::string("bob"),groundupdb::EncodedValue(std::map<std::string,long long int>{{"age",71}}));
+
+    groundupdb::RangeQuery between("score",100,200);
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(between);
+    REQUIRE(res->recordKeys()->size() == 11);
+    REQUIRE(res->recordKeys()->count(std::string("score 10")) == 1);
+    REQUIRE(res->recordKeys()->count(std::string("score 20")) == 1);
+    REQUIRE(res->recordKeys()->count(std::string("score 21")) == 0);
+
+    groundupdb::RangeQuery top3("score",-std::numeric_limits<double>::infinity(),std::numeric_limits<double>::infinity(),3,true);
+    res = db->query(top3);
+    REQUIRE(res->recordKeys()->size() == 3);
+    REQUIRE(res->recordKeys()->count(std::string("score 47")) == 1);
+
+    groundupdb::RangeQuery over65("age",65,std::numeric_limits<double>::infinity());
+    REQUIRE(db->query(over65)->recordKeys()->size() == 1);
+
+    // Changing a value moves it in the order, and the indexes are rebuilt on reload
+    db->setKeyValue(std::string("score 49"),groundupdb::EncodedValue(-5));
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    groundupdb::RangeQuery negative("score",-10,-1);
+    res = db->query(negative);
+    REQUIRE(res->recordKeys()->size() == 1);
+    REQUIRE(res->recordKeys()->count(std::string("score 49")) == 1);
+    REQUIRE(db->query(top3)->recordKeys()->count(std::string("score 49")) == 0);
+    REQUIRE(db->query(between)->recordKeys()->size() == 11);
+    REQUIRE(db->query(over65)->recordKeys()->size() == 1);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to find keys whose text contains some words, or an exact phrase
+  //   [Value] Without scanning and splitting every value myself
+  SECTION("query-text-index") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    db->setKeyValue(std::string("doc 1"),groundupdb::EncodedValue(std::string("The quick brown fox")));
+    db->setKeyValue(std::string("doc 2"),groundupdb::EncodedValue(std::string("A brown, QUICK dog!")));
+    db->setKeyValue(std::string("doc 3"),groundupdb::EncodedValue(42));
+    db->createTextIndex("body");
+    db->createTextIndex("bio","bio");
+    db->setKeyValue(std::string("doc 4"),groundupdb::EncodedValue(std::string("quick brown quick brown")));
+    db->setKeyValue(std::string("alice"),groundupdb::EncodedValue(std::map<std::string,std::string>{{"bio","Likes foxes"}}));
+
+    // Words match regardless of case and punctuation, and every word must be present
+    groundupdb::TextQuery quick("body","Quick");
+    std::unique_ptr<groundupdb::IQueryResult> res = db->query(quick);
+    REQUIRE(res->recordKeys()->size() == 3);
+    groundupdb::TextQuery dogs("body","quick dog");
+    res = db->query(dogs);
+    REQUIRE(res->recordKeys()->size() == 1);
+    REQUIRE(res->recordKeys()->count(std::string("doc 2")) == 1);
+    groundupdb::TextQuery nothing("body"," ,. ");
+    REQUIRE(db->query(nothing)->recordKeys()->size() == 0);
+
+    // A phrase needs its words adjacent and in order
+    groundupdb::PhraseQuery quickBrown("body","quick brown");
+    res = db->query(quickBrown);
+    REQUIRE(res->recordKeys()->size() == 2);
+    REQUIRE(res->recordKeys()->count(std::string("doc 2")) == 0);
+    groundupdb::PhraseQuery repeated("body","brown quick brown");
+    REQUIRE(db->query(repeated)->recordKeys()->size() == 1);
+
+    groundupdb::TextQuery foxes("bio","foxes");
+    REQUIRE(db->query(foxes)->recordKeys()->size() == 1);
+    groundupdb::TextQuery fox("bio","fox");
+    REQUIRE(db->query(fox)->recordKeys()->size() == 0);
+
+    // Changing a value moves its postings, and the index survives a reload
+    db->setKeyValue(std::string("doc 1"),groundupdb::EncodedValue(std::string("A lazy dog")));
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    REQUIRE(db->query(quickBrown)->recordKeys()->size() == 1);
+    groundupdb::TextQuery dog("body","dog");
+    res = db->query(dog);
+    REQUIRE(res->recordKeys()->size() == 2);
+    REQUIRE(res->recordKeys()->count(std::string("doc 1")) == 1);
+    db->destroy();
+
+    // Each word's keys are a packed hash list held in memory, so a query copies no sets, and
+    // positions are only read for the keys that have every word of a phrase
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    SetReadCounter* counter = new SetReadCounter();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore(counter);
+    db = groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore);
+    db->createTextIndex("body");
+    for (int i = 0;i < 100;i++) {
+      db->setKeyValue(std::string("doc ") + std::to_string(i),groundupdb::EncodedValue(std::string(0 == i % 10 ? "red fox" : "fox red")));
+    }
+    counter->reads = 0;
+    groundupdb::PhraseQuery redFox("body","red fox");
+    REQUIRE(db->query(redFox)->recordKeys()->size() == 10);
+    REQUIRE(counter->reads == 0);
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want sums, averages, counts, minimums and maximums of the values my query matches
+  //   [Value] Without pulling every value out of the database to compute them
+  SECTION("query-aggregate") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string bucket("scores");
+    // Mixed numeric types, with odd lengths so the vector loops have a tail
+    for (int i = 1;i <= 11;i++) {
+      std::string key(std::string("score ") + std::to_string(i));
+      if (0 == i % 2) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),bucket);
+      } else {
+        db->setKeyValue(key,groundupdb::EncodedValue(i * 1.0),bucket);
+      }
+    }
+    db->setKeyValue(std::string("not a number"),groundupdb::EncodedValue(std::string("100")),bucket);
+    std::string peopleBucket("people");
+    db->setKeyValue(std::string("alice"),groundupdb::EncodedValue(std::map<std::string,long long int>{{"age",34}}),peopleBucket);
+    db->setKeyValue(std::string("bob"),groundupdb::EncodedValue(std::map<std::string,long long int>{{"age",71}}),peopleBucket);
+
+    groundupdb::BucketQuery scores(bucket);
+    REQUIRE(db->aggregate(scores,groundupdb::Aggregate::Count) == 11);
+    REQUIRE(db->aggregate(scores,groundupdb::Aggregate::Sum) == 66);
+    REQUIRE(db->aggregate(scores,groundupdb::Aggregate::Min) == 1);
+    REQUIRE(db->aggregate(scores,groundupdb::Aggregate::Max) == 11);
+    REQUIRE(db->aggregate(scores,groundupdb::Aggregate::Average) == 6);
+
+    groundupdb::BucketQuery people(peopleBucket);
+    REQUIRE(db->aggregate(people,groundupdb::Aggregate::Max,"age") == 71);
+    REQUIRE(db->aggregate(people,groundupdb::Aggregate::Average,"age") == 52.5);
+    REQUIRE(!db->aggregate(people,groundupdb::Aggregate::Sum).has_value());
+    REQUIRE(db->aggregate(people,groundupdb::Aggregate::Count) == 0);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want approximate distinct key counts and value frequencies for very large buckets
+  //   [Value] In a small fixed amount of memory, and combined across databases
+  SECTION("query-bucket-sketches") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string shardA("shard a");
+    std::string shardB("shard b");
+    // Members added before and after enabling are both counted
+    for (int i = 0;i < 3000;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i % 10),shardA);
+    }
+    db->enableBucketSketches(shardA);
+    db->enableBucketSketches(shardB);
+    for (int i = 3000;i < 5000;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i % 10),shardA);
+    }
+    for (int i = 4000;i < 8000;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i % 10),shardB);
+    }
+    REQUIRE(!db->bucketSketches("no sketches").has_value());
+
+    std::optional<groundupdb::BucketSketches> a = db->bucketSketches(shardA);
+    REQUIRE(a.has_value());
+    REQUIRE(a->keys.estimate() == Approx(5000).epsilon(0.05));
+    std::uint64_t threes = a->values.estimate(groundupdb::EncodedValue(3).hash());
+    REQUIRE(threes >= 500);
+    REQUIRE(threes <= 550);
+
+    // Keys in both shards are only counted once when merged
+    std::optional<groundupdb::BucketSketches> b = db->bucketSketches(shardB);
+    a->keys.merge(b->keys);
+    a->values.merge(b->values);
+    REQUIRE(a->keys.estimate() == Approx(8000).epsilon(0.05));
+    REQUIRE(a->values.estimate(groundupdb::EncodedValue(3).hash()) >= 900);
+
+    // Saved when the database is closed
+    double estimate = b->keys.estimate();
+    db.reset();
+    db = groundupdb::GroundUpDB::loadDB(dbname);
+    b = db->bucketSketches(shardB);
+    REQUIRE(b.has_value());
+    REQUIRE(b->keys.estimate() == estimate);
+
+    // Changing a bucket discards its saved sketches, so a database loaded without this one
+    // being closed (as after a crash) rebuilds them rather than loading stale ones
+    for (int i = 8000;i < 9000;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i % 10),shardB);
+    }
+    {
+      std::unique_ptr<groundupdb::IDatabase> afterCrash(groundupdb::GroundUpDB::loadDB(dbname));
+      REQUIRE(afterCrash->bucketSketches(shardB)->keys.estimate() == Approx(5000).epsilon(0.05));
+    }
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want repeated queries to return quickly
+  //   [Value] Without re-evaluating them while the data they read is unchanged
+  SECTION("query-result-cache") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname));
+    std::string red("red");
+    std::string blue("blue");
+    for (int i = 0;i < 20;i++) {
+      db->setKeyValue(std::string("key ") + std::to_string(i),groundupdb::EncodedValue(i % 2),(0 == i % 2) ? red : blue);
+    }
+    db->createValueIndex("parity");
+
+    auto shared = [](const std::unique_ptr<groundupdb::IQueryResult>& result) {
+      return result->recordKeys().get();
+    };
+
+    // A repeated query shares the first result's keys
+    groundupdb::BucketQuery redQuery(red);
+    std::unique_ptr<groundupdb::IQueryResult> first = db->query(redQuery);
+    std::unique_ptr<groundupdb::IQueryResult> second = db->query(redQuery);
+    REQUIRE(first->recordKeys()->size() == 10);
+    REQUIRE(shared(first) == shared(second));
+
+    // Shared keys are read only, so no result needs a copy of its own
+    static_assert(std::is_const_v<std::remove_reference_t<decltype(*first->recordKeys())>>);
+
+    // So does an equivalent query, with its clauses in another order
+    groundupdb::OrQuery redOrBlue(std::vector<std::string>{red,blue});
+    groundupdb::OrQuery blueOrRed(std::vector<std::string>{blue,red});
+    first = db->query(redOrBlue);
+    REQUIRE(first->recordKeys()->size() == 20);
+    REQUIRE(shared(first) == shared(db->query(blueOrRed)));
+
+    // Writing to another bucket leaves the result cached, writing to its bucket does not
+    first = db->query(redQuery);
+    db->setKeyValue(std::string("key 20"),groundupdb::EncodedValue(3),blue);
+    REQUIRE(shared(first) == shared(db->query(redQuery)));
+    db->setKeyValue(std::string("key 21"),groundupdb::EncodedValue(3),red);
+    second = db->query(redQuery);
+    REQUIRE(shared(first) != shared(second));
+    REQUIRE(first->recordKeys()->size() == 10); // earlier results are unchanged
+    REQUIRE(second->recordKeys()->size() == 11);
+    REQUIRE(db->query(blueOrRed)->recordKeys()->size() == 22);
+
+    // Value changes invalidate index queries
+    groundupdb::ValueQuery odd("parity",groundupdb::EncodedValue(1));
+    REQUIRE(db->query(odd)->recordKeys()->size() == 10);
+    db->setKeyValue(std::string("key 0"),groundupdb::EncodedValue(1));
+    REQUIRE(db->query(odd)->recordKeys()->size() == 11);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want large compound queries and aggregates to use every core
+  //   [Value] So they finish sooner on big buckets
+  SECTION("query-parallel") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    // Large enough to be split across threads
+    std::string low("low");
+    std::string high("high");
+    for (int i = 0;i < 75'000;i++) {
+      std::string key(std::to_string(i));
+      if (i < 50'000) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),low);
+      }
+      if (i >= 25'000) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),high);
+      }
+    }
+    std::vector<std::string> buckets{low,high};
+    groundupdb::AndQuery both(buckets);
+    groundupdb::OrQuery either(buckets);
+    groundupdb::NotQuery lowOnly(std::make_unique<groundupdb::BucketQuery>(low),std::make_unique<groundupdb::BucketQuery>(high));
+
+    // Aggregates are not cached, so each thread count evaluates the queries again
+    for (std::size_t threads : {1,4}) {
+      db->setQueryThreads(threads);
+      REQUIRE(db->aggregate(both,groundupdb::Aggregate::Count) == 25'000);
+      REQUIRE(db->aggregate(lowOnly,groundupdb::Aggregate::Max) == 24'999);
+      REQUIRE(db->aggregate(either,groundupdb::Aggregate::Count) == 75'000);
+      REQUIRE(db->aggregate(either,groundupdb::Aggregate::Sum) == 2'812'462'500.0);
+      REQUIRE(db->aggregate(either,groundupdb::Aggregate::Average) == 37'499.5);
+      REQUIRE(db->aggregate(either,groundupdb::Aggregate::Min) == 0);
+      REQUIRE(db->aggregate(either,groundupdb::Aggregate::Max) == 74'999);
+    }
+    REQUIRE(db->query(both)->recordKeys()->count(std::string("30000")) == 1);
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want compound queries to start from their most selective clause, and to see how they ran
+  //   [Value] So they read as little as possible, and I can tell why a query is slow
+  SECTION("query-plan") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    SetReadCounter* counter = new SetReadCounter();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore(counter);
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string common("common");
+    std::string rare("rare");
+    for (int i = 0;i < 1000;i++) {
+      std::string key(std::to_string(i));
+      db->setKeyValue(key,groundupdb::EncodedValue(i),common);
+      if (0 == i % 100) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),rare);
+      }
+    }
+    db->createRangeIndex("number");
+
+    // The most selective clause is evaluated first, and a far larger one is only probed
+    groundupdb::AndQuery both(std::vector<std::string>{common,rare});
+    groundupdb::QueryPlan plan = db->explain(both);
+    INFO(plan.toString());
+    REQUIRE(plan.operation == "AND");
+    REQUIRE(plan.actualKeys == 10);
+    REQUIRE(plan.clauses.size() == 2);
+    REQUIRE(plan.clauses[0].operation == "bucket rare");
+    REQUIRE(plan.clauses[0].estimatedKeys == 10);
+    REQUIRE(plan.clauses[1].operation == "bucket common");
+    REQUIRE(plan.clauses[1].strategy == "probe");
+    REQUIRE(plan.clauses[1].actualKeys == 10);
+    REQUIRE(db->query(both)->recordKeys()->size() == 10);
+
+    // Only clauses whose indexes are held in memory are probed, so probing reads no store
+    counter->reads = 0;
+    plan = db->explain(both);
+    REQUIRE(plan.clauses[1].strategy == "probe");
+    REQUIRE(counter->reads == 0);
+
+    // Range estimates come from a histogram, so are close but not exact
+    std::vector<std::unique_ptr<groundupdb::Query>> clauses;
+    clauses.push_back(std::make_unique<groundupdb::BucketQuery>(common));
+    clauses.push_back(std::make_unique<groundupdb::RangeQuery>("number",0,99));
+    groundupdb::AndQuery lowNumbers(std::move(clauses));
+    plan = db->explain(lowNumbers);
+    INFO(plan.toString());
+    REQUIRE(plan.clauses[0].operation == "range number [0,99]");
+    REQUIRE(plan.clauses[0].estimatedKeys >= 100);
+    REQUIRE(plan.clauses[0].estimatedKeys <= 150);
+    REQUIRE(plan.clauses[0].actualKeys == 100);
+    REQUIRE(plan.actualKeys == 100);
+
+    // Nothing after an empty clause is evaluated
+    std::string none("none");
+    groundupdb::AndQuery empty(std::vector<std::string>{common,none});
+    plan = db->explain(empty);
+    REQUIRE(plan.actualKeys == 0);
+    REQUIRE(plan.clauses[0].operation == "bucket none");
+    REQUIRE(plan.clauses[1].strategy == "skipped");
+
+    db->destroy();
+  }
+
+  //   [Who]   As a database user
+  //   [What]  I want to find keys by value without declaring an index first
+  //   [Value] For ad hoc questions I do not ask often enough to index
+  SECTION("query-filter") {
+    std::string dbname("myemptydb");
+    std::unique_ptr<groundupdb::KeyValueStore> memoryStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::KeyValueStore> memoryIndexStore = std::make_unique<groundupdbext::MemoryKeyValueStore>();
+    std::unique_ptr<groundupdb::IDatabase> db(groundupdb::GroundUpDB::createEmptyDB(dbname,memoryStore,memoryIndexStore));
+    std::string numbers("numbers");
+    // More values than fit in one scan batch, of mixed numeric types
+    for (int i = 0;i < 3000;i++) {
+      std::string key(std::string("number ") + std::to_string(i));
+      if (0 == i % 2) {
+        db->setKeyValue(key,groundupdb::EncodedValue(i),numbers);
+      } else {
+        db->setKeyValue(key,groundupdb::EncodedValue(i * 1.0),numbers);
+      }
+    }
+    std::string texts("texts");
+    db->setKeyValue(std::string("short"),groundupdb::EncodedValue(std::string("needle")),texts);
+    db->setKeyValue(std::string("long"),groundupdb::EncodedValue(
+                      std::string("a haystack long enough to be searched 16 bytes at a time, then a needle")),texts);
+    db->setKeyValue(std::string("near miss"),groundupdb::EncodedValue(
+                      std::string("a haystack long enough to be searched 16 bytes at a time, with a neeedle")),texts);
+    db->setKeyValue(std::string("bytes"),groundupdb::EncodedValue(groundupdb::Bytes{std::byte{'n'},std::byte{'e'}}),texts);
+    db->setKeyValue(std::string("alice"),groundupdb::EncodedValue(std::map<std::string,std::string>{{"name","Alice"}}));
+    db->setKeyValue(std::string("bob"),groundupdb::EncodedValue(std::map<std::string,std::string>{{"name","Bob"}}));
+
+    groundupdb::FilterQuery between(100,199.5);
+    REQUIRE(db->query(between)->recordKeys()->size() == 100);
+    groundupdb::FilterQuery equal(groundupdb::Filter::Equal,groundupdb::EncodedValue(std::string("needle")));
+    REQUIRE(db->query(equal)->recordKeys()->size() == 1);
+    groundupdb::FilterQuery prefix(groundupdb::Filter::Prefix,groundupdb::EncodedValue(std::string("ne")));
+    REQUIRE(db->query(prefix)->recordKeys()->size() == 2); // "needle" and the bytes
+    groundupdb::FilterQuery contains(groundupdb::Filter::Contains,groundupdb::EncodedValue(std::string("needle")));
+    auto found = db->query(contains);
+    REQUIRE(found->recordKeys()->size() == 2);
+    REQUIRE(found->recordKeys()->count(groundupdb::HashedKey(std::string("long"))) == 1);
+    groundupdb::FilterQuery field(groundupdb::Filter::Equal,groundupdb::EncodedValue(std::string("Bob")),"name");
+    auto bob = db->query(field);
+    REQUIRE(bob->recordKeys()->size() == 1);
+    REQUIRE(bob->recordKeys()->count(groundupdb::HashedKey(std::string("bob"))) == 1);
+
+    // Within an AND only the other clauses' keys are filtered, and each write is seen at once
+    std::vector<std::unique_ptr<groundupdb::Query>> clauses;
+    clauses.push_back(std::make_unique<groundupdb::FilterQuery>(groundupdb::Filter::Prefix,groundupdb::EncodedValue(std::string("a"))));
+    clauses.push_back(std::make_unique<groundupdb::BucketQuery>(texts));
+    groundupdb::AndQuery textsStartingA(std::move(clauses));
+    groundupdb::QueryPlan plan = db->explain(textsStartingA);
+    INFO(plan.toString());
+    REQUIRE(plan.actualKeys == 2);
+    REQUIRE(plan.clauses[0].operation == "bucket texts");
+    REQUIRE(plan.clauses[1].strategy == "filter");
+    db->setKeyValue(std::string("short"),groundupdb::EncodedValue(std::string("a needle")),texts);
+    REQUIRE(db->query(textsStartingA)->recordKeys()->size() == 3);
+
+    db->destroy();
+  }
 }
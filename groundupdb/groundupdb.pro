@@ -4,6 +4,7 @@ TEMPLATE = lib
 CONFIG += staticlib
 
 CONFIG += c++17
+CONFIG += thread
 
 QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.15
 
@@ -21,25 +22,37 @@ QMAKE_CXXFLAGS += -O2 -fPIC
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    src/aggregates.cpp \
     src/database.cpp \
     src/filekeyvaluestore.cpp \
+    src/filters.cpp \
     src/groundupdb.cpp \
     src/hashes.cpp \
     src/highwayhash.cpp \
+    src/integerlist.cpp \
     src/memorykeyvaluestore.cpp \
     src/query.cpp \
+    src/sketches.cpp \
+    src/sortedsets.cpp \
+    src/threadpool.cpp \
     src/types.cpp
 
 HEADERS += \
     groundupdb.h \
     groundupdbext.h \
+    include/aggregates.h \
     include/database.h \
     include/extensions/extdatabase.h \
     include/extensions/extquery.h \
     include/extensions/highwayhash.h \
+    include/extensions/threadpool.h \
+    include/filters.h \
     include/groundupdb.h \
     include/hashes.h \
+    include/integerlist.h \
     include/query.h \
+    include/sketches.h \
+    include/sortedsets.h \
     include/types.h
 
 HH = ../../highwayhash
@@ -0,0 +1,46 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include <cstddef>
+#include <optional>
+
+namespace groundupdb {
+
+enum class Aggregate {
+  Count,
+  Sum,
+  Min,
+  Max,
+  Average
+};
+
+/**
+ * @brief Reduces a flat array of numbers to one value.
+ *
+ * Used to answer aggregate queries inside the database once matching values
+ * have been decoded. Sums, minimums and maximums take two doubles at a time
+ * in each of two accumulators where SSE2 is available. Returns nothing for an
+ * empty array, except for Count which returns zero.
+ */
+std::optional<double> aggregateOf(Aggregate function,const double* values,std::size_t count);
+
+} // end namespace
+
+#endif // AGGREGATES_H
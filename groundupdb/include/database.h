@@ -18,11 +18,16 @@ under the License.
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "aggregates.h"
 #include "query.h"
+#include "sketches.h"
 #include "types.h"
 
 #include <string>
 #include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace groundupdb {
 
@@ -41,15 +46,34 @@ public:
   virtual void                            setKeyValue(const HashedValue& key,EncodedValue&& value) = 0;
   //virtual void                            setKeyValue(const HashedKey& key,std::string value, std::string bucket) = 0;
   virtual EncodedValue                    getKeyValue(const HashedValue& key) = 0;
+  virtual EncodedValue                    getKeyValue(const KeyView& key) = 0;
   virtual void                            setKeyValue(const HashedValue& key,const Set& value) = 0;
   virtual Set                             getKeyValueSet(const HashedValue& key) = 0;
+  // Change one member of a set in place, without reading or rewriting the whole set
+  virtual void                            addToKeyValueSet(const HashedValue& key,EncodedValue&& member) = 0;
+  virtual void                            removeFromKeyValueSet(const HashedValue& key,const EncodedValue& member) = 0;
+  // Answered without copying values or sets out of the store
+  virtual bool                            hasKey(const KeyView& key) = 0; // as a value or a set
+  virtual std::size_t                     keyValueSetSize(const HashedValue& key) = 0;
+  virtual bool                            keyValueSetContains(const HashedValue& key,const EncodedValue& member) = 0;
 
   // Key-value management functions
+  // Every stored key (value or set) with this hash. Usually one, more only on a hash collision.
+  virtual std::vector<HashedValue>        keysForHash(std::size_t hash) = 0;
+  // Every stored key (value or set) from <= key < to in byte order, sorted. An empty to has no upper bound.
+  virtual std::vector<HashedValue>        keysInRange(const Bytes& from,const Bytes& to) = 0;
+  // Calls back with every key-value (not set) stored under one of the sorted hashes, in one pass
+  virtual void                            loadEntriesInto(const std::vector<std::uint64_t>& hashes,
+                                                          std::function<void(const HashedValue& key,EncodedValue value)> callback) = 0;
   virtual void                            loadKeysInto(std::function<void(const HashedValue& key,EncodedValue value)> callback) = 0;
+  // Calls back with every key-value (not set) a ValueBatch at a time, lending values rather than copying where possible
+  virtual void                            scanValues(std::function<void(const ValueBatch& batch)> callback) = 0;
   virtual void                            clear() = 0;
 };
 
 using QueryResult = std::unique_ptr<IQueryResult>;
+using QueryCursor = std::unique_ptr<IQueryCursor>;
+using QueryValues = std::vector<std::pair<HashedKey,EncodedValue>>;
 
 class IDatabase
 {
@@ -62,14 +86,70 @@ public:
   virtual void                            setKeyValue(const HashedValue& key,EncodedValue&& value) = 0;
   virtual void                            setKeyValue(const HashedValue& key,EncodedValue&& value,const std::string& bucket) = 0;
   virtual EncodedValue                    getKeyValue(const HashedValue& key) = 0;
+  virtual EncodedValue                    getKeyValue(const KeyView& key) = 0; // E.g. getKeyValue(KeyView(stringView)) without allocating a key
+  virtual std::vector<EncodedValue>       getKeyValues(const std::vector<HashedValue>& keys) = 0;
+  virtual std::vector<EncodedValue>       getKeyValues(const std::vector<std::string>& keys) = 0;
   virtual void                            setKeyValue(const HashedValue& key,const Set& value) = 0;
   virtual void                            setKeyValue(const HashedValue& key,const Set& value,const std::string& bucket) = 0;
   virtual Set                             getKeyValueSet(const HashedValue& key) = 0;
+  virtual bool                            exists(const HashedValue& key) const = 0; // as a value or a set
+  virtual bool                            exists(const KeyView& key) const = 0;
+  // Stored keys in byte order. Fast with a MemoryKeyValueStore keeping ordered keys, otherwise a scan.
+  virtual std::vector<HashedKey>          keysWithPrefix(std::string_view prefix) const = 0;
+  virtual std::vector<HashedKey>          keysInRange(std::string_view from,std::string_view to) const = 0; // from <= key < to
+
+  // Secondary index functions
+  // Indexes whole values, or one field of keyed container (e.g. std::map) values, so that
+  // ValueQuery can find the keys with a given value. Existing values are indexed immediately.
+  // Only key-values are indexed, not sets.
+  virtual void createValueIndex(const std::string& name) = 0;
+  virtual void createValueIndex(const std::string& name,const std::string& field) = 0;
+  // As above, but ordered by numeric (int32, int64, uint64 or double) value, for RangeQuery.
+  // Values are compared as doubles. Held in memory only, and rebuilt from the stored values
+  // when the database is loaded.
+  virtual void createRangeIndex(const std::string& name) = 0;
+  virtual void createRangeIndex(const std::string& name,const std::string& field) = 0;
+  // As above, but splitting string values in to words, for TextQuery and PhraseQuery
+  virtual void createTextIndex(const std::string& name) = 0;
+  virtual void createTextIndex(const std::string& name,const std::string& field) = 0;
 
   // Query records functions
+  // Indexes hold key hashes rather than keys, so a key with the same hash as a matching key
+  // is returned too. Not expected with full width hashes, but common after DefaultHash::setWidth.
   virtual QueryResult query(Query& query) const = 0;
   // TODO replace the below with just the generic polymorphic function
   virtual QueryResult query(BucketQuery& query) const = 0;
+  // As query, but streamed. Skips the first offset keys and returns at most limit keys.
+  // A cursor must not outlive its database.
+  virtual QueryCursor queryCursor(Query& query) const = 0;
+  virtual QueryCursor queryCursor(Query& query,std::size_t offset,std::size_t limit) const = 0;
+  // As query, but also fetches each matching key's value, in one pass over the store.
+  // Keys holding sets are not included.
+  virtual QueryValues queryWithValues(Query& query) const = 0;
+  // Evaluates a query (without using or filling the result cache), recording the order its
+  // clauses were evaluated in, how, and their estimated and actual numbers of keys
+  virtual QueryPlan   explain(Query& query) const = 0;
+  // Sum, minimum etc. of the numeric (int32, int64, uint64 or double) values of the keys
+  // matching a query, or of one field of keyed container values. Other values are skipped.
+  // Computed inside the database in one pass, without returning any values.
+  virtual std::optional<double> aggregate(Query& query,Aggregate function) const = 0;
+  virtual std::optional<double> aggregate(Query& query,Aggregate function,const std::string& field) const = 0;
+  // Answered from the bucket index alone. The index holds key hashes, so count() is the number
+  // of distinct hashes, and keys sharing a hash count once (see query).
+  virtual std::size_t count(const std::string& bucket) const = 0;
+  virtual bool        bucketContains(const std::string& bucket,const HashedValue& key) const = 0;
+  // Approximate distinct key and value frequency counts for very large buckets, in about 20KB
+  // per bucket however many keys it holds. Existing members are counted when enabled. Every
+  // value written in to the bucket is counted, overwritten values are not subtracted.
+  // Sketches are saved when the database is closed, or rebuilt on load if it was not closed
+  // cleanly after they changed. Those of databases holding parts of the same bucket can be
+  // merged.
+  virtual void                          enableBucketSketches(const std::string& bucket) = 0;
+  virtual std::optional<BucketSketches> bucketSketches(const std::string& bucket) const = 0;
+  // Large compound queries and aggregates are split by key hash in to this many parts, each
+  // evaluated on its own thread. 0 (the default) uses one per hardware thread, 1 runs every
+  // query on the calling thread.
+  virtual void                          setQueryThreads(std::size_t threads) = 0;
 
   // management functions
   static const std::unique_ptr<IDatabase>       createEmpty(std::string dbname);
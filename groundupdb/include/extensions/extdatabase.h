@@ -32,16 +32,31 @@ class MemoryKeyValueStore : public KeyValueStore {
 public:
   MemoryKeyValueStore();
   MemoryKeyValueStore(std::unique_ptr<KeyValueStore>& toCache);
+  // With orderedKeys, also keeps every key in byte order so keysInRange costs O(log N + matches)
+  // rather than a scan of every key
+  explicit MemoryKeyValueStore(bool orderedKeys);
+  MemoryKeyValueStore(std::unique_ptr<KeyValueStore>& toCache,bool orderedKeys);
   ~MemoryKeyValueStore();
 
   // Key-Value user functions
   void                            setKeyValue(const HashedValue& key,EncodedValue&& value);
   EncodedValue                    getKeyValue(const HashedValue& key);
+  EncodedValue                    getKeyValue(const KeyView& key);
   void                            setKeyValue(const HashedValue& key,const Set& value);
   Set                             getKeyValueSet(const HashedValue& key);
+  void                            addToKeyValueSet(const HashedValue& key,EncodedValue&& member);
+  void                            removeFromKeyValueSet(const HashedValue& key,const EncodedValue& member);
+  bool                            hasKey(const KeyView& key);
+  std::size_t                     keyValueSetSize(const HashedValue& key);
+  bool                            keyValueSetContains(const HashedValue& key,const EncodedValue& member);
 
   // Key-value management functions
+  std::vector<HashedValue>        keysForHash(std::size_t hash);
+  std::vector<HashedValue>        keysInRange(const Bytes& from,const Bytes& to);
+  void                            loadEntriesInto(const std::vector<std::uint64_t>& hashes,
+                                                  std::function<void(const HashedValue& key,EncodedValue value)> callback);
   void                            loadKeysInto(std::function<void(const HashedValue& key,EncodedValue value)> callback);
+  void                            scanValues(std::function<void(const ValueBatch& batch)> callback);
   void                            clear();
 
 private:
@@ -57,10 +72,21 @@ public:
   // Key-Value use cases
   void                            setKeyValue(const HashedValue& key,EncodedValue&& value);
   EncodedValue                    getKeyValue(const HashedValue& key);
+  EncodedValue                    getKeyValue(const KeyView& key);
   void                            setKeyValue(const HashedValue& key,const Set& value);
   Set                             getKeyValueSet(const HashedValue& key);
-
+  void                            addToKeyValueSet(const HashedValue& key,EncodedValue&& member);
+  void                            removeFromKeyValueSet(const HashedValue& key,const EncodedValue& member);
+  bool                            hasKey(const KeyView& key);
+  std::size_t                     keyValueSetSize(const HashedValue& key);
+  bool                            keyValueSetContains(const HashedValue& key,const EncodedValue& member);
+
+  std::vector<HashedValue>        keysForHash(std::size_t hash);
+  std::vector<HashedValue>        keysInRange(const Bytes& from,const Bytes& to);
+  void                            loadEntriesInto(const std::vector<std::uint64_t>& hashes,
+                                                  std::function<void(const HashedValue& key,EncodedValue value)> callback);
   void                            loadKeysInto(std::function<void(const HashedValue& key,EncodedValue value)> callback);
+  void                            scanValues(std::function<void(const ValueBatch& batch)> callback);
   void                            clear();
 
 private:
@@ -84,13 +110,39 @@ public:
   void                                        setKeyValue(const HashedValue& key,EncodedValue&& value);
   void                                        setKeyValue(const HashedValue& key,EncodedValue&& value,const std::string& bucket);
   EncodedValue                                getKeyValue(const HashedValue& key);
+  EncodedValue                                getKeyValue(const KeyView& key);
+  std::vector<EncodedValue>                   getKeyValues(const std::vector<HashedValue>& keys);
+  std::vector<EncodedValue>                   getKeyValues(const std::vector<std::string>& keys);
   void                                        setKeyValue(const HashedValue& key,const Set& value);
   void                                        setKeyValue(const HashedValue& key,const Set& value,const std::string& bucket);
   Set                                         getKeyValueSet(const HashedValue& key);
+  bool                                        exists(const HashedValue& key) const;
+  bool                                        exists(const KeyView& key) const;
+  std::vector<HashedKey>                      keysWithPrefix(std::string_view prefix) const;
+  std::vector<HashedKey>                      keysInRange(std::string_view from,std::string_view to) const;
+
+  // Secondary index functions
+  void                                        createValueIndex(const std::string& name);
+  void                                        createValueIndex(const std::string& name,const std::string& field);
+  void                                        createRangeIndex(const std::string& name);
+  void                                        createRangeIndex(const std::string& name,const std::string& field);
+  void                                        createTextIndex(const std::string& name);
+  void                                        createTextIndex(const std::string& name,const std::string& field);
 
   // Query records functions
   std::unique_ptr<IQueryResult>                query(Query& query) const;
   std::unique_ptr<IQueryResult>                query(BucketQuery& query) const = 0;
+  std::unique_ptr<IQueryCursor>                queryCursor(Query& query) const;
+  std::unique_ptr<IQueryCursor>                queryCursor(Query& query,std::size_t offset,std::size_t limit) const;
+  QueryValues                                  queryWithValues(Query& query) const;
+  QueryPlan                                    explain(Query& query) const;
+  std::optional<double>                        aggregate(Query& query,Aggregate function) const;
+  std::optional<double>                        aggregate(Query& query,Aggregate function,const std::string& field) const;
+  std::size_t                                  count(const std::string& bucket) const;
+  bool                                         bucketContains(const std::string& bucket,const HashedValue& key) const;
+  void                                         enableBucketSketches(const std::string& bucket);
+  std::optional<BucketSketches>                bucketSketches(const std::string& bucket) const;
+  void                                         setQueryThreads(std::size_t threads);
 
   // management functions
   static  const std::unique_ptr<IDatabase>    createEmpty(std::string dbname);
@@ -20,6 +20,11 @@ under the License.
 
 #include "../query.h"
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
 namespace groundupdbext {
 
 using namespace groundupdb;
@@ -29,11 +34,32 @@ public:
   DefaultQueryResult();
   DefaultQueryResult(KeySet&& recordKeys);
   DefaultQueryResult(Set&& recordKeys);
+  // Shares keys with other results, E.g. those of repeated identical queries, without a copy
+  DefaultQueryResult(SharedKeySet recordKeys);
   virtual ~DefaultQueryResult() = default;
 
-  const KeySet& recordKeys();
+  const SharedKeySet& recordKeys();
+private:
+  SharedKeySet m_recordKeys;
+};
+
+// Walks a sorted list of key hashes, resolving each to its key(s) as it is pulled.
+// The offset counts hashes, which is the same as counting keys unless hashes collide.
+class DefaultQueryCursor: public IQueryCursor {
+public:
+  using KeysForHash = std::function<std::vector<HashedValue>(std::size_t hash)>;
+
+  DefaultQueryCursor(std::vector<std::uint64_t>&& hashes,KeysForHash keysForHash,
+                     std::size_t offset,std::size_t limit);
+  virtual ~DefaultQueryCursor() = default;
+
+  bool next(std::vector<HashedKey>& batch,std::size_t max);
 private:
-  KeySet m_recordKeys;
+  std::vector<std::uint64_t> m_hashes;
+  KeysForHash m_keysForHash;
+  std::size_t m_position;
+  std::size_t m_remaining; // limit left
+  std::vector<HashedValue> m_pending; // colliding keys that did not fit in the last batch
 };
 
 }
@@ -37,10 +37,16 @@ public:
   std::size_t operator() (const std::string& s) const noexcept;
   std::size_t operator() (const groundupdb::Bytes& bytes) const noexcept;
   std::size_t operator() (const char* data,std::size_t length) const noexcept;
+  groundupdb::Fingerprint fingerprint(const char* data,std::size_t length) const noexcept;
+
+  // Hashes count inputs at once, advancing several independent hash states in lock step
+  void batch(const char* const* data,const std::size_t* lengths,std::size_t count,std::size_t* results) const noexcept;
+  void batch(const char* const* data,const std::size_t* lengths,std::size_t count,groundupdb::Fingerprint* results) const noexcept;
 private:
+  template <typename Out>
+  void batchImpl(const char* const* data,const std::size_t* lengths,std::size_t count,Out* results) const noexcept;
+
   HHKey m_key HH_ALIGNAS(64); // defining as const will delete copy ctor in Windows MSVCC feature-15
-  HighwayHashCatT<HH_TARGET>* m_hh;
-  HHResult64* m_result;
 };
 
 }
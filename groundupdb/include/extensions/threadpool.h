@@ -0,0 +1,50 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace groundupdbext {
+
+/**
+ * @brief A fixed set of worker threads for splitting one query's work in to parts.
+ *
+ * The thread calling parallelFor also works on the parts, so a pool of one
+ * thread starts no workers and runs everything on the caller.
+ */
+class ThreadPool {
+public:
+  ThreadPool(std::size_t threads); // 0 for one per hardware thread
+  ~ThreadPool();
+
+  std::size_t size() const;
+  // Calls task(0) to task(count - 1) across the pool, returning once every call has finished.
+  // Rethrows the first exception thrown by any call.
+  void        parallelFor(std::size_t count,const std::function<void(std::size_t)>& task);
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+}
+
+#endif // THREADPOOL_H
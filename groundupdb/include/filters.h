@@ -0,0 +1,56 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include "query.h"
+#include "types.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace groundupdb {
+
+/**
+ * @brief A FilterQuery compiled once, then applied to a whole ValueBatch at a time.
+ *
+ * Each batch is first reduced to one flat column (the viewed field, or numbers decoded to
+ * doubles) which a tight loop tests against the operand. Between compares two doubles at a time,
+ * and Contains tests the operand's first and last bytes at 16 positions at once, where SSE2 is
+ * available. Only candidates passing those are compared byte by byte.
+ */
+class ValueFilter {
+public:
+  explicit ValueFilter(const FilterQuery& query);
+
+  // Appends the key hash of each entry in batch that passes, in batch order
+  void select(const ValueBatch& batch,std::vector<std::uint64_t>& hashes) const;
+
+private:
+  Filter m_match;
+  Type m_type;
+  Bytes m_operand;
+  double m_min;
+  double m_max;
+  std::optional<EncodedValue> m_field;
+};
+
+} // end namespace
+
+#endif // FILTERS_H
@@ -23,10 +23,15 @@ under the License.
 // WARNING: This should ONLY include Client API files
 // i.e. NOT anything within include/extensions!
 
+#include "aggregates.h"
 #include "database.h"
+#include "filters.h"
 #include "hashes.h"
+#include "integerlist.h"
 #include "is_container.h"
 #include "query.h"
+#include "sketches.h"
+#include "sortedsets.h"
 #include "types.h"
 
 namespace groundupdb {
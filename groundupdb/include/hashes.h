@@ -19,8 +19,11 @@ under the License.
 #define HASHES_H
 
 #include "types.h"
+#include <cstdint>
+#include <cstddef>
 #include <string>
 #include <memory>
+#include <vector>
 
 namespace groundupdb {
 
@@ -28,6 +31,14 @@ namespace groundupdb {
 class HashedValue;
 class EncodedValue;
 
+/**
+ * @brief A 128 bit HighwayHash of a key. low doubles as the key's 64 bit hash.
+ */
+struct Fingerprint {
+  std::uint64_t low;
+  std::uint64_t high;
+};
+
 class DefaultHash {
 public:
   DefaultHash();
@@ -40,10 +51,172 @@ public:
   std::size_t operator() (const std::vector<std::byte>& bytes) const noexcept;
   std::size_t operator() (const char* data,std::size_t length) const noexcept;
 
+  // 128 bit fingerprints. Not narrowed by setWidth - the caller narrows low when using it as a hash.
+  Fingerprint fingerprint(const std::vector<std::byte>& bytes) const noexcept;
+  Fingerprint fingerprint(const char* data,std::size_t length) const noexcept;
+
+  // Batch hashing of many inputs in one call. Each result is written to the same index as its input.
+  void batch(const char* const* data,const std::size_t* lengths,std::size_t count,std::size_t* results) const noexcept;
+  std::vector<std::size_t> batch(const std::vector<std::vector<std::byte>>& inputs) const;
+  void batch(const char* const* data,const std::size_t* lengths,std::size_t count,Fingerprint* results) const noexcept;
+
+  // The hasher seeded as all key and value hashes are. Shared, so hashing needs no hasher of its own.
+  static const DefaultHash& standard();
+
+  // Test mode: keep only the lowest bits of every key and value hash so that
+  // collisions become common. Set before creating any values. 64 is normal.
+  // Query results then also include keys that only share a hash with a match.
+  static void setWidth(unsigned int bits) noexcept;
+  static unsigned int width() noexcept;
+  // Applies the current width to a hash computed elsewhere (E.g. by StaticHash)
+  static std::size_t narrow(std::size_t hash) noexcept;
+
+  // Fingerprint mode: keys carry a 128 bit fingerprint, so key equality is decided
+  // without comparing key bytes, and in memory stores keep only the fingerprint.
+  // Hash values differ from normal mode, so choose before creating or loading a database.
+  static void setFingerprintMode(bool enabled) noexcept;
+  static bool fingerprintMode() noexcept;
+
   class Impl;
 private:
   std::unique_ptr<Impl> mImpl;
 };
 
+/**
+ * @brief A portable HighwayHash that can be evaluated at compile time.
+ *
+ * Produces the same value as DefaultHash for the same seed and input, so keys
+ * hashed here match keys hashed at runtime. Input is appended incrementally,
+ * and a copy of a part-appended hash can be reused to hash a common prefix once.
+ */
+class StaticHash {
+public:
+  constexpr StaticHash(std::uint64_t s1,std::uint64_t s2,std::uint64_t s3,std::uint64_t s4)
+    : m_v0{}, m_v1{}, m_mul0{0xdbe6d5d5fe4cce2full,0xa4093822299f31d0ull,0x13198a2e03707344ull,0x243f6a8885a308d3ull},
+      m_mul1{0x3bd39e10cb0ef593ull,0xc0acf169b5f18a8cull,0xbe5466cf34e90c6cull,0x452821e638d01377ull},
+      m_buffer{}, m_buffered(0)
+  {
+    const std::uint64_t seed[4] = {s1,s2,s3,s4};
+    for (int i = 0;i < 4;i++) {
+      m_v0[i] = m_mul0[i] ^ seed[i];
+      m_v1[i] = m_mul1[i] ^ ((seed[i] >> 32) | (seed[i] << 32));
+    }
+  }
+
+  constexpr StaticHash& append(const char* data,std::size_t length) {
+    for (std::size_t i = 0;i < length;i++) {
+      m_buffer[m_buffered++] = data[i];
+      if (sizeof(m_buffer) == m_buffered) {
+        updatePacket(m_buffer);
+        m_buffered = 0;
+      }
+    }
+    return *this;
+  }
+
+  constexpr std::size_t finalize() const {
+    StaticHash done(*this); // finalising is destructive, so work on a copy
+    if (0 != done.m_buffered) {
+      done.updateRemainder();
+    }
+    for (int i = 0;i < 4;i++) {
+      done.permuteAndUpdate();
+    }
+    return done.m_v0[0] + done.m_v1[0] + done.m_mul0[0] + done.m_mul1[0];
+  }
+
+  constexpr Fingerprint finalize128() const {
+    StaticHash done(*this);
+    if (0 != done.m_buffered) {
+      done.updateRemainder();
+    }
+    for (int i = 0;i < 6;i++) {
+      done.permuteAndUpdate();
+    }
+    return Fingerprint{done.m_v0[0] + done.m_mul0[0] + done.m_v1[2] + done.m_mul1[2],
+                       done.m_v0[1] + done.m_mul0[1] + done.m_v1[3] + done.m_mul1[3]};
+  }
+
+private:
+  static constexpr void zipperMergeAndAdd(std::uint64_t v1,std::uint64_t v0,std::uint64_t& add1,std::uint64_t& add0) {
+    add0 += (((v0 & 0xff000000ull) | (v1 & 0xff00000000ull)) >> 24) |
+            (((v0 & 0xff0000000000ull) | (v1 & 0xff000000000000ull)) >> 16) |
+            (v0 & 0xff0000ull) | ((v0 & 0xff00ull) << 32) |
+            ((v1 & 0xff00000000000000ull) >> 8) | (v0 << 56);
+    add1 += (((v1 & 0xff000000ull) | (v0 & 0xff00000000ull)) >> 24) |
+            (v1 & 0xff0000ull) | ((v1 & 0xff0000000000ull) >> 16) |
+            ((v1 & 0xff00ull) << 24) | ((v0 & 0xff000000000000ull) >> 8) |
+            ((v1 & 0xffull) << 48) | (v0 & 0xff00000000000000ull);
+  }
+
+  constexpr void update(const std::uint64_t (&lanes)[4]) {
+    for (int i = 0;i < 4;i++) {
+      m_v1[i] += m_mul0[i] + lanes[i];
+      m_mul0[i] ^= (m_v1[i] & 0xffffffff) * (m_v0[i] >> 32);
+      m_v0[i] += m_mul1[i];
+      m_mul1[i] ^= (m_v0[i] & 0xffffffff) * (m_v1[i] >> 32);
+    }
+    zipperMergeAndAdd(m_v1[1],m_v1[0],m_v0[1],m_v0[0]);
+    zipperMergeAndAdd(m_v1[3],m_v1[2],m_v0[3],m_v0[2]);
+    zipperMergeAndAdd(m_v0[1],m_v0[0],m_v1[1],m_v1[0]);
+    zipperMergeAndAdd(m_v0[3],m_v0[2],m_v1[3],m_v1[2]);
+  }
+
+  constexpr void updatePacket(const char (&packet)[32]) {
+    std::uint64_t lanes[4] = {0,0,0,0};
+    for (int i = 0;i < 4;i++) {
+      for (int b = 7;b >= 0;b--) { // little endian
+        lanes[i] = (lanes[i] << 8) | static_cast<unsigned char>(packet[i * 8 + b]);
+      }
+    }
+    update(lanes);
+  }
+
+  constexpr void updateRemainder() {
+    const std::size_t size = m_buffered;
+    const std::size_t sizeMod4 = size & 3;
+    const std::size_t remainder = size & ~std::size_t(3);
+    char packet[32] = {};
+    for (int i = 0;i < 4;i++) {
+      m_v0[i] += (static_cast<std::uint64_t>(size) << 32) + size;
+      // rotate each 32 bit half by size bits
+      const std::uint32_t half0 = static_cast<std::uint32_t>(m_v1[i]);
+      const std::uint32_t half1 = static_cast<std::uint32_t>(m_v1[i] >> 32);
+      m_v1[i] = static_cast<std::uint32_t>((half0 << size) | (half0 >> (32 - size))) |
+                (static_cast<std::uint64_t>(static_cast<std::uint32_t>((half1 << size) | (half1 >> (32 - size)))) << 32);
+    }
+    for (std::size_t i = 0;i < remainder;i++) {
+      packet[i] = m_buffer[i];
+    }
+    if (0 != (size & 16)) {
+      for (std::size_t i = 0;i < 4;i++) {
+        packet[28 + i] = m_buffer[remainder + i + sizeMod4 - 4];
+      }
+    } else if (0 != sizeMod4) {
+      packet[16] = m_buffer[remainder];
+      packet[17] = m_buffer[remainder + (sizeMod4 >> 1)];
+      packet[18] = m_buffer[remainder + sizeMod4 - 1];
+    }
+    updatePacket(packet);
+  }
+
+  constexpr void permuteAndUpdate() {
+    const std::uint64_t permuted[4] = {
+      (m_v0[2] >> 32) | (m_v0[2] << 32),
+      (m_v0[3] >> 32) | (m_v0[3] << 32),
+      (m_v0[0] >> 32) | (m_v0[0] << 32),
+      (m_v0[1] >> 32) | (m_v0[1] << 32)
+    };
+    update(permuted);
+  }
+
+  std::uint64_t m_v0[4];
+  std::uint64_t m_v1[4];
+  std::uint64_t m_mul0[4];
+  std::uint64_t m_mul1[4];
+  char m_buffer[32];
+  std::size_t m_buffered;
+};
+
 }
 #endif // HASHES_H
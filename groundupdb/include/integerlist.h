@@ -0,0 +1,67 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef INTEGERLIST_H
+#define INTEGERLIST_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace groundupdb {
+
+/** LEB128 variable length integers. Seven bits per byte, low bits first. **/
+void encodeVarint(Bytes& out,std::uint64_t value);
+// Advances in past the varint. Empty if it runs past end or is longer than 10 bytes.
+std::optional<std::uint64_t> decodeVarint(const std::byte*& in,const std::byte* end);
+
+/**
+ * @brief Compact encoding for lists of integer IDs.
+ *
+ * Layout:-
+ *   flags               varint. Bit 0 set if the list is sorted and stored as deltas
+ *   count               varint
+ *   blocks              one per kBlockSize values (the last may be short). Each is a one byte
+ *                       bit width b, then the block's values packed b bits each into two
+ *                       lanes of little endian 64 bit words. Even values are in lane 0 and
+ *                       odd values in lane 1, and the lanes' words alternate.
+ * Sorted lists store each value's gap from the previous one, so dense ID lists pack into a
+ * few bits per value. Each block is unpacked with a fixed width, branch free loop, which
+ * unpacks both lanes at once where SSE2 is available. Gaps are summed two at a time likewise.
+ */
+class IntegerList {
+public:
+  static constexpr std::size_t kBlockSize = 128;
+
+  static void encode(Bytes& out,const std::vector<std::uint64_t>& values);
+  // Empty if data is not a valid encoding
+  static std::optional<std::vector<std::uint64_t>> decode(const std::byte* data,std::size_t length);
+};
+
+/**
+ * @brief An INTEGERS typed value holding values in the IntegerList encoding
+ *
+ * The same as EncodedValue(values), which stores any std::vector<std::uint64_t> this way.
+ */
+EncodedValue compactIntegers(const std::vector<std::uint64_t>& values);
+
+} // end namespace
+
+#endif // INTEGERLIST_H
@@ -23,6 +23,7 @@ under the License.
 #include <string>
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
 namespace groundupdb {
 
@@ -39,7 +40,31 @@ public:
   IQueryResult() = default;
   virtual ~IQueryResult() = default;
 
-  virtual const KeySet& recordKeys() = 0;
+  // Shared with any other result of the same query, so read only
+  virtual const SharedKeySet& recordKeys() = 0;
+};
+
+// Matching keys pulled a batch at a time. Each key is only looked up when its
+// batch is pulled, so a caller can stop early without paying for the rest.
+class IQueryCursor {
+public:
+  IQueryCursor() = default;
+  virtual ~IQueryCursor() = default;
+
+  // Replaces batch with up to max (at least one) further keys. Returns false once there are no more.
+  virtual bool next(std::vector<HashedKey>& batch,std::size_t max) = 0;
+};
+
+// How a query was evaluated, as returned by IDatabase::explain. Clauses are listed in the
+// order they were evaluated.
+struct QueryPlan {
+  std::string operation; // e.g. "AND" or "bucket customers"
+  std::string strategy; // how its keys were found, e.g. "index", "intersect" or "probe"
+  std::size_t estimatedKeys = 0; // std::numeric_limits<std::size_t>::max() without statistics, e.g. for a FilterQuery
+  std::size_t actualKeys = 0;
+  std::vector<QueryPlan> clauses;
+
+  std::string toString() const; // one line per step, clauses indented under their parent
 };
 
 // MARK: Query Implementation Types
@@ -64,5 +89,132 @@ private:
   std::unique_ptr<Impl> mImpl;
 };
 
+// Keys whose value (or value field) in a value index equals value. See IDatabase::createValueIndex.
+class ValueQuery : public Query {
+public:
+  ValueQuery(const std::string& index,EncodedValue value);
+  virtual ~ValueQuery();
+
+  virtual std::string index() const;
+  virtual const EncodedValue& value() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// Keys whose numeric value (or value field) in a range index is within [min,max].
+// With a limit, only the limit lowest (or highest, if descending) such values match,
+// e.g. RangeQuery(index,min,max,10,true) is the top 10. See IDatabase::createRangeIndex.
+class RangeQuery : public Query {
+public:
+  RangeQuery(const std::string& index,double min,double max);
+  RangeQuery(const std::string& index,double min,double max,std::size_t limit,bool descending);
+  virtual ~RangeQuery();
+
+  virtual std::string index() const;
+  virtual double min() const;
+  virtual double max() const;
+  virtual std::size_t limit() const;
+  virtual bool descending() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// Keys whose string value (or value field) in a text index contains every word of text,
+// in any order. Words are split on anything but letters and digits, ignoring ASCII case.
+// See IDatabase::createTextIndex.
+class TextQuery : public Query {
+public:
+  TextQuery(const std::string& index,const std::string& text);
+  virtual ~TextQuery();
+
+  virtual std::string index() const;
+  virtual std::string text() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// As TextQuery, but the words must appear together and in order
+class PhraseQuery : public Query {
+public:
+  PhraseQuery(const std::string& index,const std::string& phrase);
+  virtual ~PhraseQuery();
+
+  virtual std::string index() const;
+  virtual std::string phrase() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// How a FilterQuery tests each value (or value field)
+enum class Filter {
+  Equal,    // the same type and bytes as the operand
+  Between,  // a number (of any numeric type) within [min,max]
+  Prefix,   // a string or bytes value starting with the operand's bytes
+  Contains  // a string or bytes value containing the operand's bytes
+};
+
+// Keys whose value (or map value field, if field is not empty) passes a filter. Needs no index,
+// as every value is scanned, but within an AND only the other clauses' keys are checked.
+// Results are never cached, as any write may change them.
+class FilterQuery : public Query {
+public:
+  FilterQuery(Filter match,EncodedValue operand,const std::string& field = ""); // Between matches numbers equal to operand
+  FilterQuery(double min,double max,const std::string& field = ""); // Between
+  virtual ~FilterQuery();
+
+  virtual Filter match() const;
+  virtual const EncodedValue& operand() const;
+  virtual double min() const;
+  virtual double max() const;
+  virtual std::string field() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// Keys matching every clause
+class AndQuery : public Query {
+public:
+  AndQuery(std::vector<std::unique_ptr<Query>>&& clauses);
+  AndQuery(const std::vector<std::string>& buckets); // keys in all of these buckets
+  virtual ~AndQuery();
+
+  virtual const std::vector<std::unique_ptr<Query>>& clauses() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// Keys matching any clause
+class OrQuery : public Query {
+public:
+  OrQuery(std::vector<std::unique_ptr<Query>>&& clauses);
+  OrQuery(const std::vector<std::string>& buckets); // keys in any of these buckets
+  virtual ~OrQuery();
+
+  virtual const std::vector<std::unique_ptr<Query>>& clauses() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+// Keys matching from but not excluded. (There is no index of all keys, so NOT
+// is always relative to another query.)
+class NotQuery : public Query {
+public:
+  NotQuery(std::unique_ptr<Query> from,std::unique_ptr<Query> excluded);
+  virtual ~NotQuery();
+
+  virtual const Query& from() const;
+  virtual const Query& excluded() const;
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
 }
 #endif // QUERY_H
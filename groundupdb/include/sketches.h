@@ -0,0 +1,91 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef SKETCHES_H
+#define SKETCHES_H
+
+#include "types.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace groundupdb {
+
+/**
+ * @brief Approximate count of distinct hashes, in 4KB however many are added.
+ *
+ * A HyperLogLog with 4096 registers, so estimates are typically within about
+ * 1.6% of the true count. Two sketches of different data merge in to the
+ * sketch of all of it, e.g. to count the distinct keys of a bucket spread over
+ * several databases.
+ */
+class HyperLogLog {
+public:
+  HyperLogLog();
+
+  void                              add(std::uint64_t hash);
+  void                              merge(const HyperLogLog& other);
+  double                            estimate() const;
+
+  Bytes                             toBytes() const;
+  static std::optional<HyperLogLog> fromBytes(const Bytes& bytes);
+
+  static constexpr unsigned         kPrecision = 12; // bits of the hash choosing a register
+  static constexpr std::size_t      kRegisters = std::size_t{1} << kPrecision;
+
+private:
+  std::array<std::uint8_t,kRegisters> m_registers;
+};
+
+/**
+ * @brief Approximate number of times each hash has been added, in 16KB.
+ *
+ * A count-min sketch of four rows of 1024 counters. An estimate is never
+ * below the true count, and exceeds it by at most 0.27% of the total count
+ * with 98% probability, so it suits finding frequent (heavy hitter) values.
+ * Sketches merge by adding their counters.
+ */
+class CountMinSketch {
+public:
+  CountMinSketch();
+
+  void                                 add(std::uint64_t hash,std::uint32_t count = 1);
+  void                                 merge(const CountMinSketch& other);
+  std::uint64_t                        estimate(std::uint64_t hash) const;
+
+  Bytes                                toBytes() const;
+  static std::optional<CountMinSketch> fromBytes(const Bytes& bytes);
+
+  static constexpr std::size_t         kDepth = 4;
+  static constexpr std::size_t         kWidth = 1024; // a power of two
+
+private:
+  std::vector<std::uint32_t> m_counters; // kDepth rows of kWidth
+};
+
+// The statistics kept for a bucket. keys counts distinct member keys by their hash. values
+// counts each value written in to the bucket by its hash, e.g. values.estimate(EncodedValue(42).hash())
+struct BucketSketches {
+  HyperLogLog    keys;
+  CountMinSketch values;
+};
+
+} // end namespace
+
+#endif // SKETCHES_H
@@ -0,0 +1,63 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef SORTEDSETS_H
+#define SORTEDSETS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace groundupdb {
+
+/**
+ * @brief A read only run of sorted key hashes held elsewhere, E.g. all or part of a vector.
+ *
+ * Lets part of a list be combined without copying it. Valid only while the list it views is.
+ */
+class SortedRange {
+public:
+  SortedRange(const std::vector<std::uint64_t>& values) : m_first(values.data()), m_last(values.data() + values.size()) {}
+  SortedRange(const std::uint64_t* first,const std::uint64_t* last) : m_first(first), m_last(last) {}
+
+  const std::uint64_t* begin() const { return m_first; }
+  const std::uint64_t* end() const { return m_last; }
+  std::size_t size() const { return m_last - m_first; }
+  bool empty() const { return m_first == m_last; }
+  std::uint64_t operator[](std::size_t i) const { return m_first[i]; }
+
+private:
+  const std::uint64_t* m_first;
+  const std::uint64_t* m_last;
+};
+
+/**
+ * @brief Set operations over sorted, duplicate free lists of key hashes.
+ *
+ * Used to combine bucket indexes without building hash sets. Intersection
+ * compares four values at a time where SSE2 is available, and gallops
+ * (exponential then binary search) through the longer list when one list is
+ * much longer than the other. Each result is sorted and duplicate free too.
+ */
+std::vector<std::uint64_t> intersectSorted(SortedRange a,SortedRange b);
+std::vector<std::uint64_t> unionSorted(SortedRange a,SortedRange b);
+// Values in from that are not in excluded
+std::vector<std::uint64_t> differenceSorted(SortedRange from,SortedRange excluded);
+
+} // end namespace
+
+#endif // SORTEDSETS_H
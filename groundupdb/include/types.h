@@ -22,11 +22,19 @@ under the License.
 #include <cstddef>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <unordered_set>
 #include <functional>
 #include <numeric>
 #include <algorithm>
+#include <cstring>
+#include <limits>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
 
 // TODO find a way around including the below (they are internals)
 #include "is_container.h"
@@ -67,7 +75,103 @@ public:
   }
 };
 
+enum class Type {
+  UNKNOWN = 0,
+  KEY = 1,
+  SET = 2,
+  CPP = 3, // TODO determine if we can do this and use refelection, or if we need another way of refering to C++ types
+  INT32 = 4, // 4 byte little endian
+  INT64 = 5, // 8 byte little endian
+  UINT64 = 6, // 8 byte little endian
+  DOUBLE = 7, // 8 byte little endian IEEE 754
+  STRING = 8, // raw characters, no terminator
+  BYTES = 9,
+  CONTAINER = 10,
+  INTEGERS = 11 // compact list of uint64, see IntegerList
+};
+
+std::ostream &operator<<( std::ostream &os, const Type t);
+std::istream &operator>>( std::istream &is, Type t);
+
+/**
+ * @brief The Type tag used to store a C++ value of type VT
+ *
+ * Integers are widened to the width of their tag, and float to double. A std::vector of
+ * uint64 is stored as INTEGERS, and other containers as CONTAINER.
+ */
+template <typename VT>
+constexpr Type typeOf() {
+  using T = std::decay_t<VT>;
+  if constexpr (std::is_same_v<std::string,T> || std::is_same_v<std::string_view,T> ||
+                std::is_same_v<char*,T> || std::is_same_v<const char*,T>) {
+    return Type::STRING;
+  } else if constexpr (std::is_same_v<Bytes,T>) {
+    return Type::BYTES;
+  } else if constexpr (std::is_same_v<std::vector<std::uint64_t>,T>) {
+    return Type::INTEGERS;
+  } else if constexpr (std::numeric_limits<T>::is_integer) {
+    if constexpr (!std::is_signed_v<T>) {
+      return Type::UINT64;
+    } else if constexpr (sizeof(T) <= sizeof(std::int32_t)) {
+      return Type::INT32;
+    } else {
+      return Type::INT64;
+    }
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return Type::DOUBLE;
+  } else if constexpr (is_container<T>::value || is_keyed_container<T>::value) {
+    return Type::CONTAINER;
+  } else {
+    return Type::CPP;
+  }
+}
+
+// Fixed width values are always stored little endian, whatever the host
+template <typename T>
+void writeLittleEndian(std::byte* out,T value) {
+  static_assert(std::is_trivially_copyable_v<T>,"Only trivially copyable types have a fixed width encoding");
+  std::memcpy(out,&value,sizeof(T));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  std::reverse(out,out + sizeof(T));
+#endif
+}
+
+template <typename T>
+void encodeLittleEndian(Bytes& out,T value) {
+  std::size_t at = out.size();
+  out.resize(at + sizeof(T));
+  writeLittleEndian(out.data() + at,value);
+}
+
+template <typename T>
+T decodeLittleEndian(const std::byte* in) {
+  static_assert(std::is_trivially_copyable_v<T>,"Only trivially copyable types have a fixed width encoding");
+  T value;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  std::byte reversed[sizeof(T)];
+  std::reverse_copy(in,in + sizeof(T),reversed);
+  std::memcpy(&value,reversed,sizeof(T));
+#else
+  std::memcpy(&value,in,sizeof(T));
+#endif
+  return value;
+}
+
 class EncodedValue;
+class StaticKey;
+class ValueView;
+class ContainerView;
+
+// Appends values in the IntegerList encoding. See integerlist.h.
+void encodeIntegers(Bytes& out,const std::vector<std::uint64_t>& values);
+
+/**
+ * @brief Appends the binary encoding of from to out, returning its Type tag
+ *
+ * Containers are encoded as described by ContainerView.
+ */
+template <typename VT>
+Type encodeValue(Bytes& out,const VT& from);
 
 template <class U, class T>
 struct is_explicitly_convertible
@@ -82,17 +186,27 @@ struct is_explicitly_convertible
  */
 class HashedValue {
 private:
+  friend class EncodedValue; // decodes typed values in place
+  friend class KeyView;
+  template <typename VT> friend Type encodeValue(Bytes& out,const VT& from);
   bool m_has_value;
   Bytes m_data; // original key data binary representation
   std::size_t m_length; // binary length in bytes
   std::size_t m_hash; // one-way hash of the key binary representation using the server's specified algorithm
+  Fingerprint m_fingerprint; // full 128 bit fingerprint, only set in fingerprint mode
+  bool m_has_fingerprint;
+
+  // Sets m_hash (and the fingerprint in fingerprint mode) from m_data
+  void computeHash();
 public:
   //HashedValue(Bytes data,int length,std::size_t hash);
   HashedValue(const Bytes& data,std::size_t length,std::size_t hash);
+  HashedValue(Bytes&& data,std::size_t length,std::size_t hash);
+  HashedValue(Bytes&& data,std::size_t length,const Fingerprint& fingerprint);
   HashedValue();
   template<class T>
   HashedValue(const Key<T>& from)
-    : m_has_value(true)
+    : m_has_value(true), m_fingerprint{0,0}, m_has_fingerprint(false)
   {
     m_length = from.length();
     //m_data.reserve(m_length);
@@ -103,9 +217,7 @@ public:
     // for (auto& d : from.value()) {
     //   m_data.push_back((std::byte)d);
     // }
-    // TODO use correct hasher for current database connection, with correct initialisation settings
-    DefaultHash h1{};
-    m_hash = h1(from.data());
+    computeHash();
   }
 
   /** Copy/move constuctors and operators **/
@@ -117,6 +229,10 @@ public:
   /** Conversion constuctors **/
   HashedValue(const EncodedValue& from);
   HashedValue(EncodedValue&& from);
+  HashedValue(const StaticKey& from); // reuses the compile time hash
+  HashedValue(std::string_view from);
+  HashedValue(const std::byte* data,std::size_t length);
+  HashedValue(Bytes&& from); // takes over from's buffer
 
   /** Standard type convenience constructors **/
   /**
@@ -125,127 +241,25 @@ public:
  * https://www.internalpointers.com/post/quick-primer-type-traits-modern-cpp
  */
   template <typename VT> //, typename = std::enable_if_t<is_explicitly_convertible<VT,HashedValue>::value>>
-  HashedValue(VT from) : m_has_value(true), m_data(), m_length(0), m_hash(0)
+  HashedValue(const VT& from) : m_has_value(true), m_data(), m_length(0), m_hash(0), m_fingerprint{0,0}, m_has_fingerprint(false)
   {
-    // first remove reference
-    auto v = std::decay_t<VT>(from);
-    // second check if its a basic type and convert to bytes
-    if constexpr(std::is_same_v<std::string, decltype(v)>) {
-      //std::cout << "DECLTYPE std::string" << std::endl;
-      m_length = from.length();
-      m_data.reserve(m_length);
-      std::transform(from.begin(), from.end(), std::back_inserter(m_data),
-                     [](auto c) { return static_cast<std::byte>(c); });
-                     
-    } else if constexpr (std::is_same_v<char *, decltype(v)>) {
-      //std::cout << "DECLTYPE char ptr" << std::endl;
-      std::string s(v);
-      m_length = s.length();
-      m_data.reserve(m_length);
-      std::transform(s.begin(), s.end(), std::back_inserter(m_data),
-                     [](auto c) { return static_cast<std::byte>(c); });
-
-    } else if constexpr (std::is_same_v<const char*, decltype(v)>) {
-      //std::cout << "DECLTYPE char array" << std::endl;
-      std::string s(v);
-      m_length = s.length();
-      m_data.reserve(m_length);
-      std::transform(s.begin(), s.end(), std::back_inserter(m_data),
-                     [](auto c) { return static_cast<std::byte>(c); });
-
-    } else if constexpr(std::numeric_limits<VT>::is_integer) {
-      //std::cout << "DECLTYPE numeric" << std::endl;
-      m_length = sizeof(v) / sizeof(std::byte);
-      auto vcopy = v; // copy ready for modification
-      m_data.reserve(m_length);
-      for (auto i = std::size_t(0); i < m_length; i++)
-      {
-        // NOTE This implements little-endian conversion TODO do we want this?
-        m_data.push_back(static_cast<std::byte>((vcopy & 0xFF)));
-        vcopy = vcopy >> sizeof(std::byte);
-      }
-
-    } else if constexpr(std::is_floating_point_v<VT>) {
-      //std::cout << "DECLTYPE float" << std::endl;
-      m_length = sizeof(v) / sizeof(std::byte);
-      auto vcopy = v; // copy ready for modification
-      unsigned int asInt = *((int *)&vcopy);
-      m_data.reserve(m_length);
-      for (auto i = std::size_t(0); i < m_length; i++)
-      {
-        // NOTE This implements little-endian conversion TODO do we want this?
-        m_data.push_back(static_cast<std::byte>((asInt & 0xFF)));
-        asInt = asInt >> sizeof(std::byte);
-      }
-
-    } else if constexpr (std::is_same_v<Bytes, decltype(v)>) {
-      m_length = from.size();
-      m_data = std::move(from);
-
-    } else if constexpr (is_container<decltype(v)>::value) {
-      // Convert contents to EncodedValue and serialise it
-      // TODO in future this will preserve its runtime type
-      Bytes data; 
-      // ^^^ can't reserve yet - may be dynamic type in container 
-      //     (We MUST do a deep copy)
-      for (auto iter = v.begin();iter != v.end();++iter) {
-        HashedValue hv(*iter); 
-        // ^^^ uses template functions, so a little recursion here
-        Bytes t = hv.data();
-        data.insert(std::end(data),t.begin(),t.end());
-        // https://stackoverflow.com/questions/2551775/appending-a-vector-to-a-vector
-      }
-      // TODO append EncodedValue(CPP,decltype<VT>,...,data) instead
-      m_data.insert(std::end(m_data),data.begin(),data.end());
-      m_length = m_data.size(); // can only know after inserts
-    // } else if constexpr (is_keyed_container<decltype(v)>::value) {
-    //   std::cout << "DECLTYPE keyed container" << std::endl;
-
-    
-    } else if constexpr (is_keyed_container<decltype(v)>::value) {
-      // Convert contents to EncodedValue and serialise it
-      // TODO in future this will preserve its runtime type
-      Bytes data; 
-      // ^^^ can't reserve yet - may be dynamic type in container 
-      //     (We MUST do a deep copy)
-      for (auto iter = v.begin();iter != v.end();++iter) {
-        HashedValue hv(iter->second); 
-        // ^^^ uses template functions, so a little recursion here
-        Bytes t = hv.data();
-        data.insert(std::end(data),t.begin(),t.end());
-        // https://stackoverflow.com/questions/2551775/appending-a-vector-to-a-vector
-      }
-      // TODO append EncodedValue(CPP,decltype<VT>,...,data) instead
-      m_data.insert(std::end(m_data),data.begin(),data.end());
-      m_length = m_data.size(); // can only know after inserts
-      
-
-/*
-    } else if constexpr(std::is_convertible_v<decltype(v),HashedValue> && !std::is_same_v<decltype(v),HashedValue>) {
-      HashedValue hv = v; // calls type cast operator - https://www.cplusplus.com/doc/tutorial/typecasting/
-      m_has_value = hv.m_has_value;
-      m_length = hv.m_length;
-      m_data = std::move(hv.m_data);
-      m_hash = hv.m_hash;
-      return; // no need to recompute hash
-
-      */
-    } else {
-      throw std::runtime_error(typeid(v).name());
-      // TODO we don't support it, fire off a compiler warning
-      //static_assert(false, "Must be a supported type, or convertible to std::vector<std::byte>!");
-    }
-    // TODO use correct hasher for current database connection, with correct initialisation settings
-    DefaultHash h1{1, 2, 3, 4};
-    m_hash = h1(m_data);
+    encodeValue(m_data,from);
+    m_length = m_data.size();
+    computeHash();
   }
 
   virtual ~HashedValue() = default;
-  const Bytes data() const;
+  const Bytes& data() const;
   std::size_t length() const;
   std::size_t hash() const;
   bool hasValue() const;
 
+  // True if created in fingerprint mode. If so equality ignores the key bytes.
+  bool hasFingerprint() const;
+  Fingerprint fingerprint() const;
+  // A copy without the key bytes, if fingerprinted, for resident indexes
+  HashedValue fingerprintOnly() const;
+
   // define << and >> operators
   //friend std::ofstream& operator<<(std::ofstream& out, const HashedValue& from);
 
@@ -267,23 +281,94 @@ std::ofstream& operator<<(std::ofstream& out, const HashedValue& from) {
 
 using HashedKey = HashedValue; // Alias for semantic ease
 
-using KeySet = std::unique_ptr<std::unordered_set<HashedValue>>;
+/**
+ * @brief A key whose bytes are held elsewhere, so looking it up allocates nothing.
+ *
+ * Hashes just as a HashedKey of the same bytes would, so it can find stored HashedKeys.
+ * The viewed bytes must outlive the KeyView.
+ */
+class KeyView {
+public:
+  KeyView(std::string_view key);
+  KeyView(const std::byte* data,std::size_t length);
+  // Any contiguous range of std::byte, E.g. Bytes, std::array<std::byte,N> or (from C++20) std::span<const std::byte>
+  template <typename Range,typename = std::enable_if_t<std::is_same_v<
+              std::remove_cv_t<std::remove_pointer_t<decltype(std::data(std::declval<const Range&>()))>>,std::byte>>>
+  KeyView(const Range& bytes) : KeyView(std::data(bytes),std::size(bytes)) {}
+  KeyView(const HashedValue& key); // reuses key's hash
+
+  const std::byte* data() const { return m_data; }
+  std::size_t length() const { return m_length; }
+  std::size_t hash() const { return m_hash; }
+  bool hasFingerprint() const { return m_has_fingerprint; }
+  Fingerprint fingerprint() const { return m_fingerprint; }
+
+  // The same test as HashedValue::operator==
+  bool matches(const HashedValue& key) const;
+  // An owning copy, without rehashing
+  HashedValue toHashedValue() const;
 
-enum class Type {
-  UNKNOWN = 0,
-  KEY = 1,
-  SET = 2,
-  CPP = 3 // TODO determine if we can do this and use refelection, or if we need another way of refering to C++ types
+private:
+  const std::byte* m_data;
+  std::size_t m_length;
+  std::size_t m_hash;
+  Fingerprint m_fingerprint;
+  bool m_has_fingerprint;
 };
 
-std::ostream &operator<<( std::ostream &os, const Type t);
-std::istream &operator>>( std::istream &is, Type t);
+/**
+ * @brief Hashes many keys in one pass of the default hasher.
+ *
+ * Prefer this over constructing HashedKeys one at a time when loading or fetching in bulk.
+ */
+std::vector<HashedKey> hashKeys(const std::vector<std::string>& keys);
+std::vector<HashedKey> hashKeys(std::vector<Bytes>&& keys);
+
+/**
+ * @brief A key literal whose hash is computed at compile time.
+ *
+ * E.g. constexpr StaticKey prefix("bucket::");
+ * Converts to a HashedKey without rehashing, and can hash a runtime suffix
+ * on top of the already hashed literal with append().
+ */
+class StaticKey {
+public:
+  template<std::size_t N>
+  constexpr StaticKey(const char (&literal)[N])
+    : m_data(literal), m_length(N - 1), m_state(1,2,3,4), m_hash(0), m_fingerprint{0,0}
+  {
+    // TODO use correct hasher seed for current database connection (must match HashedValue)
+    m_state.append(literal,m_length);
+    m_hash = m_state.finalize();
+    m_fingerprint = m_state.finalize128();
+  }
+
+  constexpr const char* data() const { return m_data; }
+  constexpr std::size_t length() const { return m_length; }
+  constexpr std::size_t hash() const { return m_hash; }
+  constexpr Fingerprint fingerprint() const { return m_fingerprint; }
+
+  // The key formed by this literal followed by suffix. Only the suffix is hashed.
+  HashedKey append(const std::string& suffix) const;
+
+private:
+  const char* m_data;
+  std::size_t m_length;
+  StaticHash m_state; // hash state after the literal, ready for a suffix
+  std::size_t m_hash;
+  Fingerprint m_fingerprint;
+};
+
+using KeySet = std::unique_ptr<std::unordered_set<HashedValue>>;
+// Keys that may be shared, E.g. by the results of repeated queries, so are never changed
+using SharedKeySet = std::shared_ptr<const std::unordered_set<HashedValue>>;
 
 /**
  * @brief The EncodedValue class is a Value type, intended to be copied cheaply.
  */
 class EncodedValue {
 private:
+  friend class HashedValue; // to carry fingerprints across conversions
   bool m_has_value;
   Type m_type; // internal groundupdb type identifier
   HashedValue m_value; // same internal representation as a HashedKey, so re-using definition
@@ -306,19 +391,31 @@ public:
   };
 
   // convenience conversion
-  EncodedValue(const std::string& from) : m_has_value(true), m_type(Type::CPP), m_value(HashedValue{from}) {} 
+  EncodedValue(const std::string& from) : m_has_value(true), m_type(Type::STRING), m_value(HashedValue{from}) {} 
 
   /** Conversion constuctors **/
   template<typename VT, typename = std::enable_if_t<!is_explicitly_convertible<VT,HashedValue>::value && !std::is_same_v<VT,HashedValue>>>
-  EncodedValue(const VT &from) : m_has_value(true), m_type(Type::CPP), m_value(HashedValue{from}) {}
+  EncodedValue(const VT &from) : m_has_value(true), m_type(typeOf<VT>()), m_value(HashedValue{from}) {}
 
   /** Class methods **/
   Type type() const { return m_type; }
-  const Bytes data() const { return m_value.data(); }
+  const Bytes& data() const { return m_value.data(); }
   std::size_t length() const { return m_value.length(); }
   std::size_t hash() const { return m_value.hash(); }
   bool hasValue() const { return m_has_value; }
 
+  /** Typed getters. Each decodes straight from the stored bytes, and is empty if the value has a different type **/
+  std::optional<std::int32_t> asInt32() const;
+  std::optional<std::int64_t> asInt64() const; // also reads INT32 values
+  std::optional<std::uint64_t> asUInt64() const;
+  std::optional<double> asDouble() const;
+  std::optional<std::string> asString() const; // also reads values stored as CPP by older versions
+  std::optional<ContainerView> asContainer() const; // valid only while this EncodedValue is
+  std::optional<std::vector<std::uint64_t>> asIntegers() const; // see compactIntegers()
+
+  // The stored bytes and type, without copying. Valid only while this EncodedValue is.
+  ValueView view() const;
+
   // define << operator
   //friend std::ofstream& operator<<(std::ofstream& out, const EncodedValue& from);
   // TODO >> operator
@@ -339,6 +436,193 @@ std::ofstream& operator<<(std::ofstream& out, const EncodedValue& from) {
 }
 */
 
+/**
+ * @brief A typed, read only view of encoded bytes held elsewhere (E.g. in an EncodedValue or container).
+ */
+class ValueView {
+public:
+  ValueView(Type type,const std::byte* data,std::size_t length);
+
+  Type type() const { return m_type; }
+  const std::byte* data() const { return m_data; }
+  std::size_t length() const { return m_length; }
+
+  // As for EncodedValue. Each is empty if the value has a different type.
+  std::optional<std::int32_t> asInt32() const;
+  std::optional<std::int64_t> asInt64() const;
+  std::optional<std::uint64_t> asUInt64() const;
+  std::optional<double> asDouble() const;
+  std::optional<std::string> asString() const;
+  std::optional<ContainerView> asContainer() const;
+  std::optional<std::vector<std::uint64_t>> asIntegers() const;
+
+  // A standalone copy of the viewed value
+  EncodedValue copy() const;
+
+private:
+  Type m_type;
+  const std::byte* m_data;
+  std::size_t m_length;
+};
+
+/**
+ * @brief Stored values lent a batch at a time by KeyValueStore::scanValues, one column per part.
+ *
+ * Entry i is keys[i], types[i], data[i] and lengths[i]. Valid only during the scan callback.
+ */
+struct ValueBatch {
+  std::vector<const HashedValue*> keys;
+  std::vector<Type> types;
+  std::vector<const std::byte*> data;
+  std::vector<std::size_t> lengths;
+
+  std::size_t size() const { return keys.size(); }
+  ValueView view(std::size_t i) const { return ValueView(types[i],data[i],lengths[i]); }
+  // Lends value, which must outlive the batch's use
+  void add(const HashedValue& key,const EncodedValue& value) {
+    keys.push_back(&key);
+    types.push_back(value.type());
+    data.push_back(value.data().data());
+    lengths.push_back(value.length());
+  }
+  void clear() {
+    keys.clear();
+    types.clear();
+    data.clear();
+    lengths.clear();
+  }
+};
+
+// Entries per ValueBatch. Enough to amortise each callback, small enough to stay in cache.
+constexpr std::size_t kScanBatchSize = 1024;
+
+/**
+ * @brief Random access to the elements of an encoded container, without decoding the rest of it.
+ *
+ * Layout, all integers being little endian uint32:-
+ *   count               number of elements, or of key-value entries for a keyed container
+ *   flags               bit 0 set for keyed containers (E.g. std::map)
+ *   offsets[slots + 1]  start of each slot within the slot data, then its end. A keyed container
+ *                       has two slots per entry (key then value), others one per element
+ *   order[count]        keyed containers only. Entry numbers sorted by encoded key, for find()
+ *   slot data           each slot is a one byte Type tag then the element's own encoding.
+ *                       Elements that are containers nest this same layout.
+ * Elements (and entries) keep the source container's iteration order.
+ */
+class ContainerView {
+public:
+  std::size_t size() const { return m_count; }
+  bool keyed() const { return m_keyed; }
+
+  // The ith element, or the ith entry's value if keyed. Throws std::out_of_range.
+  // An element whose stored offsets are corrupt is an UNKNOWN view of no bytes.
+  ValueView operator[](std::size_t i) const;
+  // The ith entry's key. Throws std::out_of_range, or std::logic_error if not keyed.
+  ValueView key(std::size_t i) const;
+  // The value of the first entry whose key matches, by binary search. Empty if not found, not
+  // keyed, or the container's key order is corrupt.
+  std::optional<ValueView> find(const ValueView& key) const;
+  std::optional<ValueView> find(const EncodedValue& key) const;
+
+private:
+  friend class ValueView; // validates and creates views
+  ContainerView(const std::byte* header,const std::byte* slots,std::size_t length,
+                std::size_t count,bool keyed);
+
+  ValueView slot(std::size_t s) const;
+
+  const std::byte* m_header;
+  const std::byte* m_slots;
+  std::size_t m_length; // bytes from m_slots to the end of the value
+  std::size_t m_count;
+  bool m_keyed;
+};
+
+// Fills in the order table of a keyed container encoded by encodeValue() at start of out
+void indexContainerKeys(Bytes& out,std::size_t start);
+
+template <typename C>
+void encodeContainer(Bytes& out,const C& container) {
+  constexpr bool keyed = is_keyed_container<C>::value;
+  const std::size_t count = std::distance(std::begin(container),std::end(container));
+  const std::size_t slots = keyed ? 2 * count : count;
+  const std::size_t start = out.size();
+  const std::size_t offsets = start + 2 * sizeof(std::uint32_t);
+  const std::size_t dataStart = offsets + (slots + 1 + (keyed ? count : 0)) * sizeof(std::uint32_t);
+  out.resize(dataStart);
+  writeLittleEndian(out.data() + start,static_cast<std::uint32_t>(count));
+  writeLittleEndian(out.data() + start + sizeof(std::uint32_t),static_cast<std::uint32_t>(keyed ? 1 : 0));
+
+  // Elements are encoded straight into out, so no temporary is created per element
+  std::size_t slot = 0;
+  auto append = [&out,&slot,offsets,dataStart] (const auto& element) {
+    writeLittleEndian(out.data() + offsets + slot++ * sizeof(std::uint32_t),
+                      static_cast<std::uint32_t>(out.size() - dataStart));
+    std::size_t tag = out.size();
+    out.push_back(std::byte(0));
+    out[tag] = static_cast<std::byte>(encodeValue(out,element));
+  };
+  for (const auto& element : container) {
+    if constexpr (keyed) {
+      append(element.first);
+      append(element.second);
+    } else {
+      append(element);
+    }
+  }
+  if (out.size() - dataStart > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::length_error("Container too large to encode");
+  }
+  writeLittleEndian(out.data() + offsets + slots * sizeof(std::uint32_t),
+                    static_cast<std::uint32_t>(out.size() - dataStart));
+  if constexpr (keyed) {
+    indexContainerKeys(out,start);
+  }
+}
+
+template <typename VT>
+Type encodeValue(Bytes& out,const VT& from) {
+  using T = std::decay_t<VT>;
+  if constexpr (std::is_same_v<EncodedValue,T>) {
+    ValueView v = from.view();
+    out.insert(out.end(),v.data(),v.data() + v.length());
+    return v.type();
+  } else if constexpr (std::is_same_v<HashedValue,T>) {
+    const Bytes& data = from.m_data;
+    out.insert(out.end(),data.begin(),data.end());
+    return Type::KEY;
+  } else if constexpr (std::is_same_v<std::string,T> || std::is_same_v<std::string_view,T>) {
+    const std::byte* start = reinterpret_cast<const std::byte*>(from.data());
+    out.insert(out.end(),start,start + from.length());
+  } else if constexpr (std::is_same_v<char*,T> || std::is_same_v<const char*,T>) {
+    const std::byte* start = reinterpret_cast<const std::byte*>(from);
+    out.insert(out.end(),start,start + std::strlen(from));
+  } else if constexpr (std::numeric_limits<T>::is_integer) {
+    // widen to the tag's width, so the value reads back the same whatever type stored it
+    constexpr Type tag = typeOf<T>();
+    if constexpr (Type::INT32 == tag) {
+      encodeLittleEndian(out,static_cast<std::int32_t>(from));
+    } else if constexpr (Type::INT64 == tag) {
+      encodeLittleEndian(out,static_cast<std::int64_t>(from));
+    } else {
+      encodeLittleEndian(out,static_cast<std::uint64_t>(from));
+    }
+  } else if constexpr (std::is_floating_point_v<T>) {
+    encodeLittleEndian(out,static_cast<double>(from));
+  } else if constexpr (std::is_same_v<Bytes,T>) {
+    out.insert(out.end(),from.begin(),from.end());
+  } else if constexpr (std::is_same_v<std::vector<std::uint64_t>,T>) {
+    encodeIntegers(out,from);
+  } else if constexpr (is_container<T>::value || is_keyed_container<T>::value) {
+    encodeContainer(out,from);
+  } else {
+    throw std::runtime_error(typeid(from).name());
+    // TODO we don't support it, fire off a compiler warning
+    //static_assert(false, "Must be a supported type, or convertible to std::vector<std::byte>!");
+  }
+  return typeOf<T>();
+}
+
 using Set = std::unique_ptr<std::unordered_set<EncodedValue>>;
 
 } // end namespace
@@ -346,40 +630,33 @@ using Set = std::unique_ptr<std::unordered_set<EncodedValue>>;
 // std::hash support for classes in this file
 namespace std
 {
+    // Both of these already carry a HighwayHash of their content, so reuse it
+    // rather than rehashing (and copying) the data on every set operation
     template<>
     struct hash<groundupdb::EncodedValue>
     {
-        size_t operator()(const groundupdb::EncodedValue& v) const
+        size_t operator()(const groundupdb::EncodedValue& v) const noexcept
         {
-          std::size_t hv = 0;
-          for (auto& vpart : v.data()) {
-            hv = hv ^ (std::to_integer<std::size_t>(vpart) << 1);
-          }
-          return hv;
+          return v.hash();
         }
     };
     template<>
     struct hash<groundupdb::HashedValue>
     {
-        size_t operator()(const groundupdb::HashedValue& v) const
+        size_t operator()(const groundupdb::HashedValue& v) const noexcept
         {
-          std::size_t hv = 0;
-          for (auto& vpart : v.data()) {
-            hv = hv ^ (std::to_integer<std::size_t>(vpart) << 1);
-          }
-          return hv;
+          return v.hash();
         }
     };
     template<typename T>
     struct hash<groundupdb::Key<T>>
     {
-        size_t operator()(const groundupdb::Key<T>& v) const
+        size_t operator()(const groundupdb::Key<T>& v) const noexcept
         {
-          std::size_t hv = 0;
-          for (auto& vpart : v.data()) {
-            hv = hv ^ (std::to_integer<std::size_t>(vpart) << 1);
-          }
-          return hv;
+          // Key holds no hash of its own. StaticHash needs no allocation and, once narrowed as
+          // DefaultHash narrows, matches HashedValue's hash.
+          groundupdb::StaticHash h(1,2,3,4);
+          return groundupdb::DefaultHash::narrow(h.append(reinterpret_cast<const char*>(v.data().data()),v.length()).finalize());
         }
     };
 }
@@ -0,0 +1,106 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "aggregates.h"
+#include "simd.h"
+
+#include <algorithm>
+
+namespace groundupdb {
+
+namespace {
+
+double
+sumOf(const double* values,std::size_t count)
+{
+  std::size_t i = 0;
+  double sum = 0;
+#ifdef GROUNDUPDB_SSE2
+  // Two independent accumulators hide the add latency
+  __m128d a = _mm_setzero_pd();
+  __m128d b = _mm_setzero_pd();
+  for (;i + 4 <= count;i += 4) {
+    a = _mm_add_pd(a,_mm_loadu_pd(values + i));
+    b = _mm_add_pd(b,_mm_loadu_pd(values + i + 2));
+  }
+  a = _mm_add_pd(a,b);
+  sum = _mm_cvtsd_f64(a) + _mm_cvtsd_f64(_mm_unpackhi_pd(a,a));
+#endif
+  for (;i < count;i++) {
+    sum += values[i];
+  }
+  return sum;
+}
+
+// Only called with count > 0
+template <bool Min>
+double
+extremeOf(const double* values,std::size_t count)
+{
+  std::size_t i = 0;
+  double extreme = values[0];
+#ifdef GROUNDUPDB_SSE2
+  if (count >= 4) {
+    __m128d a = _mm_loadu_pd(values);
+    __m128d b = _mm_loadu_pd(values + 2);
+    for (i = 4;i + 4 <= count;i += 4) {
+      if constexpr (Min) {
+        a = _mm_min_pd(a,_mm_loadu_pd(values + i));
+        b = _mm_min_pd(b,_mm_loadu_pd(values + i + 2));
+      } else {
+        a = _mm_max_pd(a,_mm_loadu_pd(values + i));
+        b = _mm_max_pd(b,_mm_loadu_pd(values + i + 2));
+      }
+    }
+    a = Min ? _mm_min_pd(a,b) : _mm_max_pd(a,b);
+    double lanes[2];
+    _mm_storeu_pd(lanes,a);
+    extreme = Min ? std::min(lanes[0],lanes[1]) : std::max(lanes[0],lanes[1]);
+  }
+#endif
+  for (;i < count;i++) {
+    extreme = Min ? std::min(extreme,values[i]) : std::max(extreme,values[i]);
+  }
+  return extreme;
+}
+
+} // end anonymous namespace
+
+std::optional<double>
+aggregateOf(Aggregate function,const double* values,std::size_t count)
+{
+  if (Aggregate::Count == function) {
+    return static_cast<double>(count);
+  }
+  if (0 == count) {
+    return {};
+  }
+  switch (function) {
+    case Aggregate::Sum:
+      return sumOf(values,count);
+    case Aggregate::Min:
+      return extremeOf<true>(values,count);
+    case Aggregate::Max:
+      return extremeOf<false>(values,count);
+    case Aggregate::Average:
+      return sumOf(values,count) / static_cast<double>(count);
+    default:
+      return {};
+  }
+}
+
+} // end namespace
@@ -16,17 +16,75 @@ specific language governing permissions and limitations
 under the License.
 */
 #include "database.h"
+#include "filters.h"
 #include "query.h"
+#include "integerlist.h"
+#include "sortedsets.h"
 #include "extensions/extquery.h"
 #include "extensions/extdatabase.h"
+#include "extensions/threadpool.h"
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <filesystem>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 using namespace groundupdb;
 using namespace groundupdbext;
 
 namespace fs = std::filesystem;
 
+// Every bucket index key starts with this, so its hash is computed once at compile time
+static constexpr StaticKey kBucketIndexPrefix("bucket::");
+// Likewise for each entry of a value index, keyed by index name and indexed value
+static constexpr StaticKey kValueIndexPrefix("value::");
+// Each bucket and value index is stored under three keys made from its own: a packed list of
+// its sorted key hashes, and sets of the hashes added to and removed from that list since
+static constexpr StaticKey kIndexPackedPrefix("packed::");
+static constexpr StaticKey kIndexAddedPrefix("added::");
+static constexpr StaticKey kIndexRemovedPrefix("removed::");
+// The set of value index definitions
+static constexpr StaticKey kValueIndexDefinitions("indexes::value");
+// Range index definitions are saved, but their entries are rebuilt from the stored values on
+// load. Older versions also saved each index's entries as a set under the prefix.
+static constexpr StaticKey kRangeIndexPrefix("range::");
+static constexpr StaticKey kRangeIndexDefinitions("indexes::range");
+// Each text index keeps the hashes of the keys whose text has a word as a hash index, like a
+// bucket's, under "term::<index>::<word>". Word positions are only needed for phrases, so are
+// kept apart: under "positions::<index>::<key>", a map of each of the key's words to its
+// positions in the key's text. Older versions kept postings as sets under "text::", which are
+// not read, so such indexes must be created again.
+static constexpr StaticKey kTextTermPrefix("term::");
+static constexpr StaticKey kTextPositionsPrefix("positions::");
+static constexpr StaticKey kTextIndexDefinitions("indexes::text");
+// Bucket sketches are saved as "sketch::hll::<bucket>" and "sketch::cms::<bucket>" byte values
+static constexpr StaticKey kSketchPrefix("sketch::");
+static constexpr StaticKey kSketchDefinitions("indexes::sketch");
+// Distinct queries whose results are kept for reuse
+static constexpr std::size_t kMaxCachedQueries = 1024;
+// Changes an index's packed list absorbs before it is rewritten, at least, or one for every
+// eight hashes in the list if that is more
+static constexpr std::size_t kMinIndexCompaction = 1024;
+// Total hashes below which combining lists on one thread beats handing them to the pool
+static constexpr std::size_t kParallelThreshold = std::size_t{1} << 16;
+// An AND clause this many times larger than the keys matched so far is probed for each of
+// those keys, rather than loaded and intersected. Against a 320,000 key bucket the two cost
+// the same at about 24 to 28 times.
+static constexpr std::size_t kProbeRatio = 32;
+static constexpr std::size_t kHistogramBuckets = 64;
+
 // 'Hidden' Database::Impl class here
 class EmbeddedDatabase::Impl : public IDatabase {
 public:
@@ -44,14 +102,113 @@ public:
   void                            setKeyValue(const HashedValue& key,EncodedValue&& value);
   void                            setKeyValue(const HashedValue& key,EncodedValue&& value,const std::string& bucket);
   EncodedValue                    getKeyValue(const HashedValue& key);
+  EncodedValue                    getKeyValue(const KeyView& key);
+  std::vector<EncodedValue>       getKeyValues(const std::vector<HashedValue>& keys);
+  std::vector<EncodedValue>       getKeyValues(const std::vector<std::string>& keys);
   void                            setKeyValue(const HashedValue& key,const Set& value);
   void                            setKeyValue(const HashedValue& key,const Set& value,const std::string& bucket);
   Set                             getKeyValueSet(const HashedValue& key);
+  bool                            exists(const HashedValue& key) const;
+  bool                            exists(const KeyView& key) const;
+  std::vector<HashedKey>          keysWithPrefix(std::string_view prefix) const;
+  std::vector<HashedKey>          keysInRange(std::string_view from,std::string_view to) const;
+
+  // Secondary index functions
+  struct ValueIndex {
+    std::string name;
+    std::string field; // empty to index the whole value
+  };
+  void                             createValueIndex(const std::string& name);
+  void                             createValueIndex(const std::string& name,const std::string& field);
+  // Range indexes are held in memory in value order, and persisted as a set in the index store
+  struct RangeIndex {
+    explicit RangeIndex(ValueIndex definition) : definition(std::move(definition)) {}
+
+    ValueIndex definition;
+    std::set<std::pair<double,std::uint64_t>> entries; // (value, key hash)
+    // Equi-depth histogram for the planner: every step'th value, retaken as entries grow or shrink
+    mutable std::vector<double> quantiles;
+    mutable std::size_t step = 0;
+    mutable std::size_t quantilesOf = 0; // entries when taken
+  };
+  void                             createRangeIndex(const std::string& name);
+  void                             createRangeIndex(const std::string& name,const std::string& field);
+  void                             createTextIndex(const std::string& name);
+  void                             createTextIndex(const std::string& name,const std::string& field);
+  void                             indexForText(const ValueIndex& index,const HashedValue& key,const std::string& text,bool add);
+  static std::vector<std::string>  words(std::string_view text);
+  bool                             hasPhrase(const std::string& index,const HashedValue& key,const std::vector<std::string>& phrase) const;
+  std::vector<std::uint64_t>       textMembers(const std::string& index,const std::string& text,bool phrase) const;
+  void                             loadIndexes();
+  // Moves key from its entry for the old value to its entry for the new value, in each index
+  void                             indexForValues(const HashedValue& key,const EncodedValue& oldValue,const EncodedValue& newValue);
+  void                             indexForRange(RangeIndex& index,const std::pair<double,std::uint64_t>& entry,bool add);
+  static std::optional<ValueView>  indexedValue(const ValueIndex& index,const EncodedValue& value);
+  static std::optional<double>     numericValue(const std::optional<ValueView>& value);
+  static HashedKey                 valueIndexKey(const std::string& name,const ValueView& value);
+  std::vector<std::uint64_t>       rangeMembers(const RangeQuery& query) const;
+  // Sorted hashes of the keys whose values pass a filter, scanning every value, or only the
+  // candidates' values if given
+  std::vector<std::uint64_t>       filterMembers(const FilterQuery& query,const std::vector<std::uint64_t>* candidates) const;
 
   // Query functions
   std::unique_ptr<IQueryResult>    query(Query& query) const;
   std::unique_ptr<IQueryResult>    query(BucketQuery& query) const;
-  void                             indexForBucket(const HashedValue& key,const std::string& bucket);
+  std::unique_ptr<IQueryCursor>    queryCursor(Query& query) const;
+  std::unique_ptr<IQueryCursor>    queryCursor(Query& query,std::size_t offset,std::size_t limit) const;
+  QueryValues                      queryWithValues(Query& query) const;
+  std::optional<double>            aggregate(Query& query,Aggregate function) const;
+  std::optional<double>            aggregate(Query& query,Aggregate function,const std::string& field) const;
+  std::size_t                      count(const std::string& bucket) const;
+  bool                             bucketContains(const std::string& bucket,const HashedValue& key) const;
+  void                             indexForBucket(const HashedValue& key,const std::string& bucket,
+                                                  std::optional<std::uint64_t> valueHash);
+  void                             enableBucketSketches(const std::string& bucket);
+  std::optional<BucketSketches>    bucketSketches(const std::string& bucket) const;
+  void                             buildBucketSketches(const std::string& bucket);
+  void                             saveBucketSketches();
+  // Bucket and value indexes. Each is kept in memory once read, as the sorted hashes of its
+  // packed list plus the hashes added and removed since the list was written.
+  struct HashIndex {
+    std::vector<std::uint64_t> packed;
+    std::unordered_set<std::uint64_t> added; // none in packed
+    std::unordered_set<std::uint64_t> removed; // all in packed
+    bool legacy = false; // also held as a set of members under the index key
+  };
+  HashIndex&                       hashIndex(const HashedValue& idxKey) const;
+  void                             addToIndex(const HashedValue& idxKey,std::uint64_t hash);
+  void                             removeFromIndex(const HashedValue& idxKey,std::uint64_t hash);
+  void                             compactIndex(const HashedValue& idxKey,HashIndex& index);
+  bool                             indexContains(const HashedValue& idxKey,std::uint64_t hash) const;
+  static bool                      indexContains(const HashIndex& index,std::uint64_t hash);
+  std::size_t                      indexSize(const HashedValue& idxKey) const;
+  std::vector<std::uint64_t>       bucketMembers(const HashedValue& idxKey) const;
+  // Sorted hashes of the keys matching a query, or empty if the query type is not supported.
+  // With a plan, also records how the query was evaluated.
+  std::vector<std::uint64_t>       matchingHashes(const Query& query,QueryPlan* plan = nullptr) const;
+  std::vector<std::uint64_t>       evaluate(const Query& query,QueryPlan* plan) const;
+  QueryPlan                        explain(Query& query) const;
+  // Planner statistics. Estimates come from index set sizes and range index histograms.
+  std::size_t                      estimateKeys(const Query& query) const;
+  std::size_t                      estimateRange(const RangeQuery& query) const;
+  static std::string               describe(const Query& query);
+  static bool                      probeable(const Query& query);
+  // The in memory index a probeable clause's keys are checked against
+  const HashIndex&                 probedIndex(const Query& query) const;
+  // Combines the sorted lists of an AND, OR or NOT (from, excluded). Large lists are split by
+  // hash range across the query thread pool.
+  enum class Combine { Intersection, Union, Difference };
+  static std::vector<std::uint64_t> combineSorted(std::vector<SortedRange> lists,Combine how);
+  std::vector<std::uint64_t>       combine(std::vector<std::vector<std::uint64_t>>&& lists,Combine how) const;
+  ThreadPool*                      queryPool() const; // nullptr when queries run on one thread
+  void                             setQueryThreads(std::size_t threads);
+  // A key identifying the query's results, the same for equivalent queries (e.g. AND clauses in
+  // any order), and the names of the buckets and indexes those results depend on. Empty if the
+  // query type is not cached.
+  std::optional<std::string>       cacheKey(const Query& query,std::vector<std::string>& dependencies) const;
+  void                             bumpVersion(const std::string& dependency);
+  std::uint64_t                    version(const std::string& dependency) const;
+  KeySet                           keysForHashes(const std::vector<std::uint64_t>& hashes) const;
 
   // management functions
   static  const std::unique_ptr<IDatabase>    createEmpty(std::string dbname);
@@ -64,6 +221,26 @@ public:
   std::string m_fullpath;
   std::unique_ptr<KeyValueStore> m_keyValueStore;
   std::unique_ptr<KeyValueStore> m_indexStore;
+  std::vector<ValueIndex> m_valueIndexes;
+  std::vector<RangeIndex> m_rangeIndexes;
+  std::vector<ValueIndex> m_textIndexes;
+  // Kept in memory, and saved when the database is closed
+  struct BucketSketch {
+    BucketSketches sketches;
+    bool dirty = false;
+  };
+  std::map<std::string,BucketSketch> m_bucketSketches;
+  // Results of repeated queries are shared until a bucket or index they depend on changes.
+  // Each dependency's version is bumped on every change to it.
+  struct CachedResult {
+    SharedKeySet keys;
+    std::vector<std::pair<std::string,std::uint64_t>> versions; // of dependencies, when cached
+  };
+  mutable std::unordered_map<std::string,CachedResult> m_queryCache;
+  mutable std::unordered_map<std::string,HashIndex> m_hashIndexes; // by index key
+  std::unordered_map<std::string,std::uint64_t> m_versions;
+  std::size_t m_queryThreads = 0; // 0 for one per hardware thread
+  mutable std::unique_ptr<ThreadPool> m_queryPool; // started on first use
 };
 
 EmbeddedDatabase::Impl::Impl(std::string dbname, std::string fullpath)
@@ -78,6 +255,7 @@ EmbeddedDatabase::Impl::Impl(std::string dbname, std::string fullpath)
   std::unique_ptr<KeyValueStore> fileIndexStore = std::make_unique<FileKeyValueStore>(fullpath + "/.indexes");
   std::unique_ptr<KeyValueStore> memIndexStore = std::make_unique<MemoryKeyValueStore>(fileIndexStore);
   m_indexStore = std::move(memIndexStore);
+  loadIndexes();
 }
 
 EmbeddedDatabase::Impl::Impl(std::string dbname, std::string fullpath,
@@ -88,19 +266,20 @@ EmbeddedDatabase::Impl::Impl(std::string dbname, std::string fullpath,
   std::unique_ptr<KeyValueStore> fileIndexStore = std::make_unique<FileKeyValueStore>(fullpath + "/.indexes");
   std::unique_ptr<KeyValueStore> memIndexStore = std::make_unique<MemoryKeyValueStore>(fileIndexStore);
   m_indexStore = std::move(memIndexStore);
+  loadIndexes();
 }
 
 EmbeddedDatabase::Impl::Impl(std::string dbname, std::string fullpath,
      std::unique_ptr<KeyValueStore>& kvStore, std::unique_ptr<KeyValueStore>& indexStore)
   : m_name(dbname), m_fullpath(fullpath), m_keyValueStore(kvStore.release()), m_indexStore(indexStore.release())
 {
-  ;
+  loadIndexes();
 }
 
 
 EmbeddedDatabase::Impl::~Impl() {
-  ;
   // Z. [Optional] Flush the latest known state to disc here
+  saveBucketSketches();
 }
 
 // Management functions
@@ -143,6 +322,9 @@ const std::unique_ptr<IDatabase> EmbeddedDatabase::Impl::load(std::string dbname
 
 void EmbeddedDatabase::Impl::destroy() {
   m_keyValueStore->clear();
+  m_bucketSketches.clear(); // so nothing is saved afterwards
+  m_queryCache.clear();
+  m_hashIndexes.clear();
 }
 
 // Instance users functions
@@ -152,6 +334,9 @@ std::string EmbeddedDatabase::Impl::getDirectory() {
 }
 
 void EmbeddedDatabase::Impl::setKeyValue(const HashedValue& key,EncodedValue&& value) {
+  if (!m_valueIndexes.empty() || !m_rangeIndexes.empty() || !m_textIndexes.empty()) {
+    indexForValues(key,m_keyValueStore->getKeyValue(key),value);
+  }
   m_keyValueStore->setKeyValue(key,std::move(value));
 
 
@@ -166,34 +351,227 @@ EncodedValue EmbeddedDatabase::Impl::getKeyValue(const HashedValue& key) {
   return m_keyValueStore->getKeyValue(key);
 }
 
+EncodedValue EmbeddedDatabase::Impl::getKeyValue(const KeyView& key) {
+  return m_keyValueStore->getKeyValue(key);
+}
+
+std::vector<EncodedValue> EmbeddedDatabase::Impl::getKeyValues(const std::vector<HashedValue>& keys) {
+  std::vector<EncodedValue> values;
+  values.reserve(keys.size());
+  for (auto& key : keys) {
+    values.push_back(m_keyValueStore->getKeyValue(key));
+  }
+  return values;
+}
+
+std::vector<EncodedValue> EmbeddedDatabase::Impl::getKeyValues(const std::vector<std::string>& keys) {
+  // Hash all keys in one batch rather than one HashedKey conversion per key
+  return getKeyValues(hashKeys(keys));
+}
+
 void EmbeddedDatabase::Impl::setKeyValue(const HashedValue& key,EncodedValue&& value, const std::string& bucket) {
+  std::uint64_t valueHash = value.hash();
   setKeyValue(key,std::move(value));
-  indexForBucket(key,bucket);
-}
-
-void EmbeddedDatabase::Impl::indexForBucket(const HashedValue& key,const std::string& bucket) {
-  // Add to bucket index
-  EncodedValue idxKey("bucket::" + bucket);
-  // query the key index
-  //std::cout << "indexForBucket Fetching key set" << std::endl;
-  Set keys = m_indexStore->getKeyValueSet(idxKey);
-  //std::cout << "indexForBucket size currently: " << keys->size() << std::endl;
-  //for (auto kiter = keys->begin();kiter != keys->end();kiter++) {
-  //  std::cout << "  EncodedValue has value?: " << kiter->hasValue() << ", length: " << kiter->length() << ", hash: " << kiter->hash() << std::endl;
-  //}
-  //std::cout << "indexForBucket adding key" << std::endl;
-  auto found = keys->find(EncodedValue(groundupdb::Type::KEY,key.data(),key.length(),key.hash()));
-  //if (found != keys->end()) {
-  //  std::cout << "WARNING: Specified value already exists in the set" << std::endl;
-  //}
-  keys->emplace(groundupdb::Type::KEY,key.data(),key.length(),key.hash());
-  //std::cout << "indexForBucket size will now be: " << keys->size() << std::endl;
-  //for (auto kiter = keys->begin();kiter != keys->end();kiter++) {
-  //  std::cout << "  Now EncodedValue has value?: " << kiter->hasValue() << ", length: " << kiter->length() << ", hash: " << kiter->hash() << std::endl;
-  //}
-  //std::cout << "indexForBucket Setting kv" << std::endl;
-  m_indexStore->setKeyValue(idxKey,std::move(keys)); // TODO do we need this? Yes - may not be in memory store
-  // TODO replace the above with appendKeyValue(key,value)
+  indexForBucket(key,bucket,valueHash);
+}
+
+void EmbeddedDatabase::Impl::indexForBucket(const HashedValue& key,const std::string& bucket,
+                                            std::optional<std::uint64_t> valueHash) {
+  // Add to bucket index. Only the new member is written, not the whole index.
+  addToIndex(kBucketIndexPrefix.append(bucket),key.hash());
+  bumpVersion("bucket::" + bucket);
+
+  auto sketch = m_bucketSketches.find(bucket);
+  if (sketch != m_bucketSketches.end()) {
+    sketch->second.sketches.keys.add(key.hash());
+    if (valueHash) {
+      sketch->second.sketches.values.add(*valueHash);
+    }
+    if (!sketch->second.dirty) {
+      // The saved copy is now stale. It is discarded, so that if the database is not closed
+      // cleanly the sketches are rebuilt when it is next loaded.
+      m_indexStore->setKeyValue(kSketchPrefix.append("hll::" + bucket),EncodedValue(Bytes()));
+      sketch->second.dirty = true;
+    }
+  }
+}
+
+void EmbeddedDatabase::Impl::enableBucketSketches(const std::string& bucket) {
+  if (m_bucketSketches.count(bucket) > 0) {
+    return; // already enabled
+  }
+  m_indexStore->addToKeyValueSet(kSketchDefinitions,EncodedValue(bucket));
+  buildBucketSketches(bucket);
+}
+
+// Counts what is already in the bucket. Sets have no value to count.
+void EmbeddedDatabase::Impl::buildBucketSketches(const std::string& bucket) {
+  BucketSketch sketch;
+  std::vector<std::uint64_t> hashes = bucketMembers(kBucketIndexPrefix.append(bucket));
+  for (auto hash : hashes) {
+    sketch.sketches.keys.add(hash);
+  }
+  m_keyValueStore->loadEntriesInto(hashes,[&sketch](const HashedValue&,EncodedValue value) {
+    sketch.sketches.values.add(value.hash());
+  });
+  sketch.dirty = true;
+  m_bucketSketches[bucket] = std::move(sketch);
+}
+
+std::optional<BucketSketches> EmbeddedDatabase::Impl::bucketSketches(const std::string& bucket) const {
+  auto sketch = m_bucketSketches.find(bucket);
+  if (sketch == m_bucketSketches.end()) {
+    return {};
+  }
+  return sketch->second.sketches;
+}
+
+void EmbeddedDatabase::Impl::saveBucketSketches() {
+  for (auto& [bucket,sketch] : m_bucketSketches) {
+    if (!sketch.dirty) {
+      continue;
+    }
+    m_indexStore->setKeyValue(kSketchPrefix.append("hll::" + bucket),EncodedValue(sketch.sketches.keys.toBytes()));
+    m_indexStore->setKeyValue(kSketchPrefix.append("cms::" + bucket),EncodedValue(sketch.sketches.values.toBytes()));
+    sketch.dirty = false;
+  }
+}
+
+// A bucket index holds the hashes of its member keys. The member keys themselves are only
+// looked up from the key-value store when a query needs them. Value index entries are the same.
+static std::string indexName(const HashedValue& idxKey) {
+  return std::string(reinterpret_cast<const char*>(idxKey.data().data()),idxKey.length());
+}
+
+EmbeddedDatabase::Impl::HashIndex& EmbeddedDatabase::Impl::hashIndex(const HashedValue& idxKey) const {
+  std::string name(indexName(idxKey));
+  auto found = m_hashIndexes.find(name);
+  if (found != m_hashIndexes.end()) {
+    return found->second;
+  }
+  HashIndex index;
+  index.packed = m_indexStore->getKeyValue(kIndexPackedPrefix.append(name)).asIntegers().value_or(std::vector<std::uint64_t>());
+  auto packs = [&index](std::uint64_t hash) {
+    return std::binary_search(index.packed.begin(),index.packed.end(),hash);
+  };
+  // Indexes written by older versions are a set of hashes, or of whole keys, under the index key
+  Set legacy = m_indexStore->getKeyValueSet(idxKey);
+  index.legacy = !legacy->empty();
+  for (auto& member : *legacy) {
+    std::optional<std::uint64_t> hash = member.asUInt64();
+    index.added.insert(hash ? *hash : member.hash());
+  }
+  Set added = m_indexStore->getKeyValueSet(kIndexAddedPrefix.append(name));
+  for (auto& member : *added) {
+    index.added.insert(member.asUInt64().value_or(0));
+  }
+  Set removed = m_indexStore->getKeyValueSet(kIndexRemovedPrefix.append(name));
+  for (auto& member : *removed) {
+    index.removed.insert(member.asUInt64().value_or(0));
+  }
+  // A compaction cut short may have left changes already in the packed list
+  for (auto iter = index.added.begin();iter != index.added.end();) {
+    iter = packs(*iter) ? index.added.erase(iter) : std::next(iter);
+  }
+  for (auto iter = index.removed.begin();iter != index.removed.end();) {
+    iter = packs(*iter) ? std::next(iter) : index.removed.erase(iter);
+  }
+  return m_hashIndexes.emplace(std::move(name),std::move(index)).first->second;
+}
+
+// Only the change is written, not the whole index, until enough changes build up to rewrite it
+void EmbeddedDatabase::Impl::addToIndex(const HashedValue& idxKey,std::uint64_t hash) {
+  HashIndex& index = hashIndex(idxKey);
+  std::string name(indexName(idxKey));
+  if (index.removed.erase(hash) > 0) {
+    m_indexStore->removeFromKeyValueSet(kIndexRemovedPrefix.append(name),EncodedValue(hash));
+  } else if (!std::binary_search(index.packed.begin(),index.packed.end(),hash) && index.added.insert(hash).second) {
+    m_indexStore->addToKeyValueSet(kIndexAddedPrefix.append(name),EncodedValue(hash));
+  } else {
+    return; // already indexed
+  }
+  compactIndex(idxKey,index);
+}
+
+void EmbeddedDatabase::Impl::removeFromIndex(const HashedValue& idxKey,std::uint64_t hash) {
+  HashIndex& index = hashIndex(idxKey);
+  std::string name(indexName(idxKey));
+  if (index.added.erase(hash) > 0) {
+    m_indexStore->removeFromKeyValueSet(kIndexAddedPrefix.append(name),EncodedValue(hash));
+  } else if (std::binary_search(index.packed.begin(),index.packed.end(),hash) && index.removed.insert(hash).second) {
+    m_indexStore->addToKeyValueSet(kIndexRemovedPrefix.append(name),EncodedValue(hash));
+  } else {
+    return; // not indexed
+  }
+  compactIndex(idxKey,index);
+}
+
+// The new packed list is written before the changes are cleared, so a crash in between
+// leaves changes that hashIndex() finds are already applied
+void EmbeddedDatabase::Impl::compactIndex(const HashedValue& idxKey,HashIndex& index) {
+  if (index.added.size() + index.removed.size() < std::max(kMinIndexCompaction,index.packed.size() / 8)) {
+    return;
+  }
+  std::string name(indexName(idxKey));
+  index.packed = bucketMembers(idxKey);
+  index.added.clear();
+  index.removed.clear();
+  m_indexStore->setKeyValue(kIndexPackedPrefix.append(name),compactIntegers(index.packed));
+  Set empty = std::make_unique<std::unordered_set<EncodedValue>>();
+  m_indexStore->setKeyValue(kIndexAddedPrefix.append(name),empty);
+  m_indexStore->setKeyValue(kIndexRemovedPrefix.append(name),empty);
+  if (index.legacy) {
+    m_indexStore->setKeyValue(idxKey,empty);
+    index.legacy = false;
+  }
+}
+
+bool EmbeddedDatabase::Impl::indexContains(const HashedValue& idxKey,std::uint64_t hash) const {
+  return indexContains(hashIndex(idxKey),hash);
+}
+
+// The change sets are usually empty, so are only hashed in to when they are not
+bool EmbeddedDatabase::Impl::indexContains(const HashIndex& index,std::uint64_t hash) {
+  if (!index.added.empty() && index.added.count(hash) > 0) {
+    return true;
+  }
+  if (!index.removed.empty() && index.removed.count(hash) > 0) {
+    return false;
+  }
+  return std::binary_search(index.packed.begin(),index.packed.end(),hash);
+}
+
+std::size_t EmbeddedDatabase::Impl::indexSize(const HashedValue& idxKey) const {
+  const HashIndex& index = hashIndex(idxKey);
+  return index.packed.size() + index.added.size() - index.removed.size();
+}
+
+// Only the hashes changed since the packed list was written need sorting
+std::vector<std::uint64_t> EmbeddedDatabase::Impl::bucketMembers(const HashedValue& idxKey) const {
+  const HashIndex& index = hashIndex(idxKey);
+  std::vector<std::uint64_t> added(index.added.begin(),index.added.end());
+  std::sort(added.begin(),added.end());
+  std::vector<std::uint64_t> hashes;
+  hashes.reserve(index.packed.size() + added.size() - index.removed.size());
+  if (index.removed.empty()) {
+    std::merge(index.packed.begin(),index.packed.end(),added.begin(),added.end(),std::back_inserter(hashes));
+    return hashes;
+  }
+  auto kept = index.packed.begin();
+  for (auto hash : added) {
+    for (;kept != index.packed.end() && *kept < hash;++kept) {
+      if (0 == index.removed.count(*kept)) {
+        hashes.push_back(*kept);
+      }
+    }
+    hashes.push_back(hash);
+  }
+  for (;kept != index.packed.end();++kept) {
+    if (0 == index.removed.count(*kept)) {
+      hashes.push_back(*kept);
+    }
+  }
+  return hashes;
 }
 
 void EmbeddedDatabase::Impl::setKeyValue(const HashedValue& key,const Set& value) {
@@ -202,34 +580,1031 @@ void EmbeddedDatabase::Impl::setKeyValue(const HashedValue& key,const Set& value
 
 void EmbeddedDatabase::Impl::setKeyValue(const HashedValue& key,const Set& value,const std::string& bucket) {
   setKeyValue(key,value);
-  indexForBucket(key,bucket);
+  indexForBucket(key,bucket,std::nullopt);
 }
 
 Set EmbeddedDatabase::Impl::getKeyValueSet(const HashedValue& key) {
   return m_keyValueStore->getKeyValueSet(key);
 }
 
+bool EmbeddedDatabase::Impl::exists(const HashedValue& key) const {
+  return m_keyValueStore->hasKey(KeyView(key));
+}
+
+bool EmbeddedDatabase::Impl::exists(const KeyView& key) const {
+  return m_keyValueStore->hasKey(key);
+}
+
+static Bytes toBytes(std::string_view from) {
+  const std::byte* start = reinterpret_cast<const std::byte*>(from.data());
+  return Bytes(start,start + from.size());
+}
+
+std::vector<HashedKey> EmbeddedDatabase::Impl::keysWithPrefix(std::string_view prefix) const {
+  // Keys with the prefix are those from the prefix up to (not including) the prefix with its
+  // last byte incremented. Trailing 0xFF bytes cannot be incremented, so are dropped first.
+  Bytes from = toBytes(prefix);
+  Bytes to = from;
+  while (!to.empty() && std::byte{0xFF} == to.back()) {
+    to.pop_back();
+  }
+  if (!to.empty()) {
+    to.back() = static_cast<std::byte>(static_cast<unsigned char>(to.back()) + 1);
+  }
+  return m_keyValueStore->keysInRange(from,to);
+}
+
+std::vector<HashedKey> EmbeddedDatabase::Impl::keysInRange(std::string_view from,std::string_view to) const {
+  Bytes start = toBytes(from);
+  Bytes end = toBytes(to);
+  if (!(start < end)) {
+    return {}; // an empty end would otherwise mean unbounded
+  }
+  return m_keyValueStore->keysInRange(start,end);
+}
+
+// Secondary index functions
+
+// Each entry of a value index is a set of key hashes, just like a bucket index,
+// stored under the index name and the indexed value's type and bytes. So values
+// only match if they have the same type (e.g. an INT32 5 does not match an INT64 5).
+HashedKey EmbeddedDatabase::Impl::valueIndexKey(const std::string& name,const ValueView& value) {
+  std::string suffix(name);
+  suffix.append("::");
+  suffix.push_back(static_cast<char>(value.type()));
+  suffix.append(reinterpret_cast<const char*>(value.data()),value.length());
+  return kValueIndexPrefix.append(suffix);
+}
+
+std::optional<ValueView> EmbeddedDatabase::Impl::indexedValue(const ValueIndex& index,const EncodedValue& value) {
+  if (!value.hasValue()) {
+    return {};
+  }
+  if (index.field.empty()) {
+    return value.view();
+  }
+  std::optional<ContainerView> container = value.asContainer();
+  if (!container) {
+    return {};
+  }
+  return container->find(EncodedValue(index.field));
+}
+
+void EmbeddedDatabase::Impl::indexForValues(const HashedValue& key,const EncodedValue& oldValue,const EncodedValue& newValue) {
+  for (auto& index : m_valueIndexes) {
+    std::optional<ValueView> from = indexedValue(index,oldValue);
+    std::optional<ValueView> to = indexedValue(index,newValue);
+    std::optional<HashedKey> fromKey;
+    std::optional<HashedKey> toKey;
+    if (from) {
+      fromKey = valueIndexKey(index.name,*from);
+    }
+    if (to) {
+      toKey = valueIndexKey(index.name,*to);
+    }
+    if (fromKey == toKey) {
+      continue; // indexed value unchanged
+    }
+    if (fromKey) {
+      removeFromIndex(*fromKey,key.hash());
+    }
+    if (toKey) {
+      addToIndex(*toKey,key.hash());
+    }
+    bumpVersion("value::" + index.name);
+  }
+  for (auto& index : m_rangeIndexes) {
+    std::optional<double> from = numericValue(indexedValue(index.definition,oldValue));
+    std::optional<double> to = numericValue(indexedValue(index.definition,newValue));
+    if (from == to) {
+      continue;
+    }
+    if (from) {
+      indexForRange(index,{*from,key.hash()},false);
+    }
+    if (to) {
+      indexForRange(index,{*to,key.hash()},true);
+    }
+    bumpVersion("range::" + index.definition.name);
+  }
+  for (auto& index : m_textIndexes) {
+    std::optional<ValueView> from = indexedValue(index,oldValue);
+    std::optional<ValueView> to = indexedValue(index,newValue);
+    std::optional<std::string> fromText = from ? from->asString() : std::nullopt;
+    std::optional<std::string> toText = to ? to->asString() : std::nullopt;
+    if (fromText == toText) {
+      continue;
+    }
+    if (fromText) {
+      indexForText(index,key,*fromText,false);
+    }
+    if (toText) {
+      indexForText(index,key,*toText,true);
+    }
+    bumpVersion("text::" + index.name);
+  }
+}
+
+std::optional<double> EmbeddedDatabase::Impl::numericValue(const std::optional<ValueView>& value) {
+  if (!value) {
+    return {};
+  }
+  std::optional<double> number = value->asDouble();
+  if (!number) {
+    if (auto i = value->asInt64()) {
+      number = static_cast<double>(*i);
+    } else if (auto u = value->asUInt64()) {
+      number = static_cast<double>(*u);
+    }
+  }
+  if (number && std::isnan(*number)) {
+    return {}; // has no place in the order
+  }
+  return number;
+}
+
+// Entries are only held in memory, so nothing is written
+void EmbeddedDatabase::Impl::indexForRange(RangeIndex& index,const std::pair<double,std::uint64_t>& entry,bool add) {
+  if (add) {
+    index.entries.insert(entry);
+  } else {
+    index.entries.erase(entry);
+  }
+}
+
+void EmbeddedDatabase::Impl::createValueIndex(const std::string& name) {
+  createValueIndex(name,"");
+}
+
+void EmbeddedDatabase::Impl::createValueIndex(const std::string& name,const std::string& field) {
+  for (auto& index : m_valueIndexes) {
+    if (index.name == name) {
+      return; // already exists
+    }
+  }
+  ValueIndex index{name,field};
+  m_indexStore->addToKeyValueSet(kValueIndexDefinitions,EncodedValue(std::vector<std::string>{name,field}));
+
+  // Index what is already stored
+  m_keyValueStore->loadKeysInto([this,&index](const HashedValue& key,EncodedValue value) {
+    std::optional<ValueView> indexed = indexedValue(index,value);
+    if (indexed) {
+      addToIndex(valueIndexKey(index.name,*indexed),key.hash());
+    }
+  });
+  m_valueIndexes.push_back(std::move(index));
+  bumpVersion("value::" + name);
+}
+
+void EmbeddedDatabase::Impl::createRangeIndex(const std::string& name) {
+  createRangeIndex(name,"");
+}
+
+void EmbeddedDatabase::Impl::createRangeIndex(const std::string& name,const std::string& field) {
+  for (auto& index : m_rangeIndexes) {
+    if (index.definition.name == name) {
+      return; // already exists
+    }
+  }
+  RangeIndex index(ValueIndex{name,field});
+  m_indexStore->addToKeyValueSet(kRangeIndexDefinitions,EncodedValue(std::vector<std::string>{name,field}));
+
+  // Index what is already stored
+  m_keyValueStore->loadKeysInto([this,&index](const HashedValue& key,EncodedValue value) {
+    std::optional<double> number = numericValue(indexedValue(index.definition,value));
+    if (number) {
+      indexForRange(index,{*number,key.hash()},true);
+    }
+  });
+  m_rangeIndexes.push_back(std::move(index));
+  bumpVersion("range::" + name);
+}
+
+void EmbeddedDatabase::Impl::createTextIndex(const std::string& name) {
+  createTextIndex(name,"");
+}
+
+void EmbeddedDatabase::Impl::createTextIndex(const std::string& name,const std::string& field) {
+  for (auto& index : m_textIndexes) {
+    if (index.name == name) {
+      return; // already exists
+    }
+  }
+  ValueIndex index{name,field};
+  m_indexStore->addToKeyValueSet(kTextIndexDefinitions,EncodedValue(std::vector<std::string>{name,field}));
+
+  // Index what is already stored
+  m_keyValueStore->loadKeysInto([this,&index](const HashedValue& key,EncodedValue value) {
+    std::optional<ValueView> indexed = indexedValue(index,value);
+    std::optional<std::string> text = indexed ? indexed->asString() : std::nullopt;
+    if (text) {
+      indexForText(index,key,*text,true);
+    }
+  });
+  m_textIndexes.push_back(std::move(index));
+  bumpVersion("text::" + name);
+}
+
+// Letters and digits (and any non-ASCII UTF-8 byte) form words. ASCII letters are lower cased.
+std::vector<std::string> EmbeddedDatabase::Impl::words(std::string_view text) {
+  std::vector<std::string> words;
+  std::string word;
+  for (char c : text) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (u >= 0x80 || std::isalnum(u)) {
+      word.push_back(static_cast<char>(std::tolower(u)));
+    } else if (!word.empty()) {
+      words.push_back(std::move(word));
+      word.clear();
+    }
+  }
+  if (!word.empty()) {
+    words.push_back(std::move(word));
+  }
+  return words;
+}
+
+void EmbeddedDatabase::Impl::indexForText(const ValueIndex& index,const HashedValue& key,const std::string& text,bool add) {
+  std::map<std::string,std::vector<std::uint64_t>> positions;
+  std::vector<std::string> all = words(text);
+  for (std::size_t i = 0;i < all.size();i++) {
+    positions[all[i]].push_back(i);
+  }
+  for (auto& entry : positions) {
+    HashedKey termKey = kTextTermPrefix.append(index.name + "::" + entry.first);
+    if (add) {
+      addToIndex(termKey,key.hash());
+    } else {
+      removeFromIndex(termKey,key.hash());
+    }
+  }
+  // A change removes the old text before adding the new, so the new positions are kept
+  HashedKey positionsKey = kTextPositionsPrefix.append(index.name + "::" + indexName(key));
+  m_indexStore->setKeyValue(positionsKey,add ? EncodedValue(positions) : EncodedValue());
+}
+
+// A phrase matches where word i is at position p + i, for some position p of the first word
+bool EmbeddedDatabase::Impl::hasPhrase(const std::string& index,const HashedValue& key,const std::vector<std::string>& phrase) const {
+  EncodedValue stored = m_indexStore->getKeyValue(kTextPositionsPrefix.append(index + "::" + indexName(key)));
+  std::optional<ContainerView> byWord = stored.asContainer();
+  if (!byWord) {
+    return false;
+  }
+  std::vector<std::vector<std::uint64_t>> at;
+  for (auto& word : phrase) {
+    std::optional<ValueView> found = byWord->find(EncodedValue(word));
+    std::optional<std::vector<std::uint64_t>> positions = found ? found->asIntegers() : std::nullopt;
+    if (!positions) {
+      return false;
+    }
+    at.push_back(std::move(*positions));
+  }
+  for (auto start : at[0]) {
+    bool found = true;
+    for (std::size_t i = 1;i < at.size() && found;i++) {
+      found = std::binary_search(at[i].begin(),at[i].end(),start + i);
+    }
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::uint64_t> EmbeddedDatabase::Impl::textMembers(const std::string& index,const std::string& text,bool phrase) const {
+  std::vector<std::string> all = words(text);
+  if (all.empty()) {
+    return {};
+  }
+  std::vector<std::uint64_t> hashes;
+  for (std::size_t i = 0;i < all.size() && (0 == i || !hashes.empty());i++) {
+    std::vector<std::uint64_t> withWord = bucketMembers(kTextTermPrefix.append(index + "::" + all[i]));
+    hashes = (0 == i) ? std::move(withWord) : intersectSorted(hashes,withWord);
+  }
+  if (!phrase || 1 == all.size()) {
+    return hashes;
+  }
+
+  // Positions are read only for the keys that have every word
+  std::vector<std::uint64_t> matches;
+  for (auto hash : hashes) {
+    for (auto& key : m_keyValueStore->keysForHash(hash)) {
+      if (hasPhrase(index,key,all)) {
+        matches.push_back(hash);
+        break;
+      }
+    }
+  }
+  return matches;
+}
+
+void EmbeddedDatabase::Impl::loadIndexes() {
+  auto loadDefinitions = [this](const HashedValue& setKey,std::function<void(ValueIndex&&)> add) {
+    Set definitions = m_indexStore->getKeyValueSet(setKey);
+    for (auto& definition : *definitions) {
+      std::optional<ContainerView> fields = definition.asContainer();
+      if (!fields || 2 != fields->size()) {
+        continue;
+      }
+      std::optional<std::string> name = (*fields)[0].asString();
+      std::optional<std::string> field = (*fields)[1].asString();
+      if (name && field) {
+        add(ValueIndex{*name,*field});
+      }
+    }
+  };
+  loadDefinitions(kValueIndexDefinitions,[this](ValueIndex&& index) {
+    m_valueIndexes.push_back(std::move(index));
+  });
+  loadDefinitions(kTextIndexDefinitions,[this](ValueIndex&& index) {
+    m_textIndexes.push_back(std::move(index));
+  });
+  loadDefinitions(kRangeIndexDefinitions,[this](ValueIndex&& definition) {
+    RangeIndex index(std::move(definition));
+    HashedKey saved = kRangeIndexPrefix.append(index.definition.name);
+    if (m_indexStore->keyValueSetSize(saved) > 0) {
+      m_indexStore->setKeyValue(saved,std::make_unique<std::unordered_set<EncodedValue>>()); // older version's copy
+    }
+    m_rangeIndexes.push_back(std::move(index));
+  });
+  if (!m_rangeIndexes.empty()) {
+    // Every range index is rebuilt in one pass over the stored values
+    m_keyValueStore->loadKeysInto([this](const HashedValue& key,EncodedValue value) {
+      for (auto& index : m_rangeIndexes) {
+        std::optional<double> number = numericValue(indexedValue(index.definition,value));
+        if (number) {
+          index.entries.emplace(*number,key.hash());
+        }
+      }
+    });
+  }
+
+  Set sketched = m_indexStore->getKeyValueSet(kSketchDefinitions);
+  for (auto& definition : *sketched) {
+    std::optional<std::string> bucket = definition.asString();
+    if (!bucket) {
+      continue;
+    }
+    auto bytesOf = [this](const HashedValue& key) {
+      EncodedValue value = m_indexStore->getKeyValue(key);
+      ValueView view = value.view();
+      return Bytes(view.data(),view.data() + view.length());
+    };
+    std::optional<HyperLogLog> keys = HyperLogLog::fromBytes(bytesOf(kSketchPrefix.append("hll::" + *bucket)));
+    std::optional<CountMinSketch> values = CountMinSketch::fromBytes(bytesOf(kSketchPrefix.append("cms::" + *bucket)));
+    if (keys && values) {
+      m_bucketSketches[*bucket] = BucketSketch{BucketSketches{std::move(*keys),std::move(*values)},false};
+    } else {
+      buildBucketSketches(*bucket); // e.g. not closed cleanly
+    }
+  }
+}
+
+std::vector<std::uint64_t> EmbeddedDatabase::Impl::rangeMembers(const RangeQuery& query) const {
+  std::vector<std::uint64_t> hashes;
+  for (auto& index : m_rangeIndexes) {
+    if (index.definition.name != query.index()) {
+      continue;
+    }
+    // Entries sort by value then hash, so these bound every hash with a value in [min,max]
+    auto first = index.entries.lower_bound({query.min(),0});
+    auto last = index.entries.upper_bound({query.max(),std::numeric_limits<std::uint64_t>::max()});
+    if (query.descending()) {
+      for (auto iter = std::make_reverse_iterator(last);
+           iter != std::make_reverse_iterator(first) && hashes.size() < query.limit();++iter) {
+        hashes.push_back(iter->second);
+      }
+    } else {
+      for (auto iter = first;iter != last && hashes.size() < query.limit();++iter) {
+        hashes.push_back(iter->second);
+      }
+    }
+  }
+  std::sort(hashes.begin(),hashes.end());
+  hashes.erase(std::unique(hashes.begin(),hashes.end()),hashes.end());
+  return hashes;
+}
+
+std::vector<std::uint64_t> EmbeddedDatabase::Impl::filterMembers(const FilterQuery& query,
+                                                                 const std::vector<std::uint64_t>* candidates) const {
+  ValueFilter filter(query);
+  std::vector<std::uint64_t> hashes;
+  if (nullptr == candidates) {
+    m_keyValueStore->scanValues([&filter,&hashes](const ValueBatch& batch) {
+      filter.select(batch,hashes);
+    });
+  } else {
+    // Candidate values are copied out one at a time, so are filtered a batch of copies at a time
+    std::vector<std::pair<HashedValue,EncodedValue>> entries;
+    entries.reserve(std::min(candidates->size(),kScanBatchSize));
+    ValueBatch batch;
+    auto flush = [&]() {
+      for (auto& [key,value] : entries) {
+        batch.add(key,value);
+      }
+      filter.select(batch,hashes);
+      batch.clear();
+      entries.clear();
+    };
+    m_keyValueStore->loadEntriesInto(*candidates,[&](const HashedValue& key,EncodedValue value) {
+      entries.emplace_back(key,std::move(value));
+      if (kScanBatchSize == entries.size()) {
+        flush();
+      }
+    });
+    if (!entries.empty()) {
+      flush();
+    }
+  }
+  std::sort(hashes.begin(),hashes.end());
+  hashes.erase(std::unique(hashes.begin(),hashes.end()),hashes.end());
+  return hashes;
+}
+
 // Query functions
 
 std::unique_ptr<IQueryResult>
 EmbeddedDatabase::Impl::query(Query& q) const {
-  // Query is abstract, so default is to return empty (i.e. don't allow full DB query on base class, or empty query, or any query not yet implemented here)
-  std::unique_ptr<IQueryResult> r = std::make_unique<DefaultQueryResult>();
-  return r;
+  // Any query type not yet implemented here (including a plain Query or EmptyQuery) returns empty,
+  // i.e. don't allow a full DB query. Only a FilterQuery reads every value.
+  std::vector<std::string> dependencies;
+  std::optional<std::string> key = cacheKey(q,dependencies);
+  if (!key) {
+    std::unique_ptr<IQueryResult> r = std::make_unique<DefaultQueryResult>(keysForHashes(matchingHashes(q)));
+    return r;
+  }
+  auto isCurrent = [this](const CachedResult& cached) {
+    for (auto& [dependency,cachedVersion] : cached.versions) {
+      if (version(dependency) != cachedVersion) {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto cached = m_queryCache.find(*key);
+  if (cached != m_queryCache.end() && isCurrent(cached->second)) {
+    return std::make_unique<DefaultQueryResult>(cached->second.keys);
+  }
+
+  CachedResult result{keysForHashes(matchingHashes(q)),{}};
+  for (auto& dependency : dependencies) {
+    result.versions.emplace_back(dependency,version(dependency));
+  }
+  if (m_queryCache.size() >= kMaxCachedQueries) {
+    // Make room by dropping stale results first, then everything
+    for (auto iter = m_queryCache.begin();iter != m_queryCache.end();) {
+      iter = isCurrent(iter->second) ? std::next(iter) : m_queryCache.erase(iter);
+    }
+    if (m_queryCache.size() >= kMaxCachedQueries) {
+      m_queryCache.clear();
+    }
+  }
+  SharedKeySet keys = result.keys;
+  m_queryCache[*key] = std::move(result);
+  return std::make_unique<DefaultQueryResult>(std::move(keys));
 }
 
 
 std::unique_ptr<IQueryResult>
 EmbeddedDatabase::Impl::query(BucketQuery& query) const {
   // Bucket query
-  // construct a name for our key index
-  std::string idxKey("bucket::" + query.bucket());
-  // query the key index
+  return this->query(static_cast<Query&>(query));
+}
+
+std::unique_ptr<IQueryCursor>
+EmbeddedDatabase::Impl::queryCursor(Query& query) const {
+  return queryCursor(query,0,std::numeric_limits<std::size_t>::max());
+}
+
+std::unique_ptr<IQueryCursor>
+EmbeddedDatabase::Impl::queryCursor(Query& query,std::size_t offset,std::size_t limit) const {
+  // Only the matching hashes are held up front. Keys are looked up as each batch is pulled.
+  KeyValueStore* store = m_keyValueStore.get();
+  return std::make_unique<DefaultQueryCursor>(matchingHashes(query),
+    [store](std::size_t hash) { return store->keysForHash(hash); },
+    offset,limit);
+}
+
+QueryValues
+EmbeddedDatabase::Impl::queryWithValues(Query& query) const {
+  // One call in to the store for all keys, rather than a getKeyValue per key
+  std::vector<std::uint64_t> hashes = matchingHashes(query);
+  QueryValues values;
+  values.reserve(hashes.size());
+  m_keyValueStore->loadEntriesInto(hashes,[&values](const HashedValue& key,EncodedValue value) {
+    values.emplace_back(key,std::move(value));
+  });
+  return values;
+}
+
+std::optional<double>
+EmbeddedDatabase::Impl::aggregate(Query& query,Aggregate function) const {
+  return aggregate(query,function,"");
+}
+
+std::optional<double>
+EmbeddedDatabase::Impl::aggregate(Query& query,Aggregate function,const std::string& field) const {
+  // Decode each number straight in to one flat array, then reduce that in a single pass
+  ValueIndex source{"",field};
+  std::vector<std::uint64_t> hashes = matchingHashes(query);
+  std::vector<double> numbers;
+  numbers.reserve(hashes.size());
+  m_keyValueStore->loadEntriesInto(hashes,[&numbers,&source](const HashedValue&,EncodedValue value) {
+    if (std::optional<double> number = numericValue(indexedValue(source,value))) {
+      numbers.push_back(*number);
+    }
+  });
+  ThreadPool* pool = numbers.size() < kParallelThreshold ? nullptr : queryPool();
+  if (nullptr == pool || Aggregate::Count == function) {
+    return aggregateOf(function,numbers.data(),numbers.size());
+  }
+
+  // Reduce equal slices on each thread, then reduce the partial results
+  std::size_t parts = pool->size();
+  std::size_t slice = (numbers.size() + parts - 1) / parts;
+  Aggregate partial = (Aggregate::Average == function) ? Aggregate::Sum : function;
+  std::vector<std::optional<double>> partials(parts);
+  pool->parallelFor(parts,[&](std::size_t part) {
+    std::size_t first = std::min(numbers.size(),part * slice);
+    std::size_t last = std::min(numbers.size(),first + slice);
+    partials[part] = aggregateOf(partial,numbers.data() + first,last - first);
+  });
+  std::vector<double> reduced;
+  for (auto& value : partials) {
+    if (value) {
+      reduced.push_back(*value);
+    }
+  }
+  std::optional<double> result = aggregateOf(partial,reduced.data(),reduced.size());
+  if (Aggregate::Average == function) {
+    return *result / static_cast<double>(numbers.size());
+  }
+  return result;
+}
+
+std::size_t
+EmbeddedDatabase::Impl::count(const std::string& bucket) const {
+  return indexSize(kBucketIndexPrefix.append(bucket));
+}
+
+bool
+EmbeddedDatabase::Impl::bucketContains(const std::string& bucket,const HashedValue& key) const {
+  return indexContains(kBucketIndexPrefix.append(bucket),key.hash());
+}
+
+// Compound queries are evaluated entirely on sorted lists of key hashes. Keys
+// are only looked up once, for the final result.
+std::vector<std::uint64_t>
+EmbeddedDatabase::Impl::matchingHashes(const Query& q,QueryPlan* plan) const {
+  if (nullptr == plan) {
+    return evaluate(q,nullptr);
+  }
+  plan->operation = describe(q);
+  plan->strategy = (nullptr == dynamic_cast<const FilterQuery*>(&q)) ? "index" : "scan";
+  plan->estimatedKeys = estimateKeys(q);
+  std::vector<std::uint64_t> hashes = evaluate(q,plan);
+  plan->actualKeys = hashes.size();
+  return hashes;
+}
+
+std::vector<std::uint64_t>
+EmbeddedDatabase::Impl::evaluate(const Query& q,QueryPlan* plan) const {
+  if (auto bucket = dynamic_cast<const BucketQuery*>(&q)) {
+    // construct a name for our key index
+    return bucketMembers(kBucketIndexPrefix.append(bucket->bucket()));
+  }
+  if (auto value = dynamic_cast<const ValueQuery*>(&q)) {
+    return bucketMembers(valueIndexKey(value->index(),value->value().view()));
+  }
+  if (auto text = dynamic_cast<const TextQuery*>(&q)) {
+    return textMembers(text->index(),text->text(),false);
+  }
+  if (auto phrase = dynamic_cast<const PhraseQuery*>(&q)) {
+    return textMembers(phrase->index(),phrase->phrase(),true);
+  }
+  if (auto range = dynamic_cast<const RangeQuery*>(&q)) {
+    return rangeMembers(*range);
+  }
+  if (auto filter = dynamic_cast<const FilterQuery*>(&q)) {
+    return filterMembers(*filter,nullptr);
+  }
+  // A new clause plan, in evaluation order, when recording a plan
+  auto clausePlan = [plan](const std::string& strategy) -> QueryPlan* {
+    if (nullptr == plan) {
+      return nullptr;
+    }
+    plan->strategy = strategy;
+    return &plan->clauses.emplace_back();
+  };
+  if (auto all = dynamic_cast<const AndQuery*>(&q)) {
+    // Most selective first. The first clause is loaded. Each later one is either loaded and
+    // intersected with the keys matched so far, or, when far larger than those, probed for
+    // each of them instead. Filters have no statistics so come last, and only check the keys
+    // found by the rest. Once no keys are left the remaining clauses are skipped.
+    std::vector<std::pair<std::size_t,const Query*>> ordered;
+    for (auto& clause : all->clauses()) {
+      ordered.emplace_back(estimateKeys(*clause),clause.get());
+    }
+    if (ordered.empty()) {
+      return {};
+    }
+    std::stable_sort(ordered.begin(),ordered.end(),[](auto& a,auto& b) { return a.first < b.first; });
+    std::vector<std::uint64_t> result;
+    bool started = false;
+    std::string strategy("intersect");
+    std::vector<std::pair<std::size_t,const Query*>> filtered;
+    std::vector<std::pair<std::size_t,const Query*>> skipped;
+    for (auto& [estimate,clause] : ordered) {
+      if (started && result.empty()) {
+        skipped.emplace_back(estimate,clause);
+      } else if (started && nullptr != dynamic_cast<const FilterQuery*>(clause)) {
+        filtered.emplace_back(estimate,clause);
+      } else if (started && probeable(*clause) && estimate / kProbeRatio >= result.size()) {
+        const HashIndex& index = probedIndex(*clause);
+        result.erase(std::remove_if(result.begin(),result.end(),
+                                    [&index](std::uint64_t hash) { return !indexContains(index,hash); }),
+                     result.end());
+        strategy = "intersect, probe";
+        if (QueryPlan* probePlan = clausePlan(strategy)) {
+          *probePlan = QueryPlan{describe(*clause),"probe",estimate,result.size(),{}};
+        }
+      } else if (!started) {
+        result = matchingHashes(*clause,clausePlan(strategy));
+        started = true;
+      } else {
+        std::vector<std::vector<std::uint64_t>> lists;
+        lists.push_back(std::move(result));
+        lists.push_back(matchingHashes(*clause,clausePlan(strategy)));
+        result = combine(std::move(lists),Combine::Intersection);
+      }
+    }
+    if (result.empty()) {
+      skipped.insert(skipped.begin(),filtered.begin(),filtered.end());
+      filtered.clear();
+    }
+    for (auto& [estimate,clause] : filtered) {
+      result = filterMembers(static_cast<const FilterQuery&>(*clause),&result);
+      if (QueryPlan* filterPlan = clausePlan("intersect, filter")) {
+        *filterPlan = QueryPlan{describe(*clause),"filter",estimate,result.size(),{}};
+      }
+    }
+    for (auto& [estimate,clause] : skipped) {
+      if (QueryPlan* skippedPlan = clausePlan(plan ? plan->strategy : "")) {
+        *skippedPlan = QueryPlan{describe(*clause),"skipped",estimate,0,{}};
+      }
+    }
+    return result;
+  }
+  if (auto any = dynamic_cast<const OrQuery*>(&q)) {
+    std::vector<std::vector<std::uint64_t>> lists;
+    for (auto& clause : any->clauses()) {
+      lists.push_back(matchingHashes(*clause,clausePlan("union")));
+    }
+    return combine(std::move(lists),Combine::Union);
+  }
+  if (auto negated = dynamic_cast<const NotQuery*>(&q)) {
+    std::vector<std::vector<std::uint64_t>> lists;
+    lists.push_back(matchingHashes(negated->from(),clausePlan("difference")));
+    if (lists.front().empty()) {
+      if (QueryPlan* skippedPlan = clausePlan("difference")) {
+        *skippedPlan = QueryPlan{describe(negated->excluded()),"skipped",estimateKeys(negated->excluded()),0,{}};
+      }
+      return {};
+    }
+    lists.push_back(matchingHashes(negated->excluded(),clausePlan("difference")));
+    return combine(std::move(lists),Combine::Difference);
+  }
+  if (plan) {
+    plan->strategy = "unsupported";
+  }
+  return {};
+}
+
+QueryPlan
+EmbeddedDatabase::Impl::explain(Query& query) const {
+  QueryPlan plan;
+  matchingHashes(query,&plan);
+  return plan;
+}
+
+std::size_t
+EmbeddedDatabase::Impl::estimateKeys(const Query& q) const {
+  if (auto bucket = dynamic_cast<const BucketQuery*>(&q)) {
+    return indexSize(kBucketIndexPrefix.append(bucket->bucket()));
+  }
+  if (auto value = dynamic_cast<const ValueQuery*>(&q)) {
+    return indexSize(valueIndexKey(value->index(),value->value().view()));
+  }
+  auto text = dynamic_cast<const TextQuery*>(&q);
+  auto phrase = dynamic_cast<const PhraseQuery*>(&q);
+  if (text || phrase) {
+    // No more keys than have the rarest word
+    std::string index = text ? text->index() : phrase->index();
+    std::vector<std::string> all = words(text ? text->text() : phrase->phrase());
+    std::size_t estimate = all.empty() ? 0 : std::numeric_limits<std::size_t>::max();
+    for (auto& word : all) {
+      estimate = std::min(estimate,indexSize(kTextTermPrefix.append(index + "::" + word)));
+    }
+    return estimate;
+  }
+  if (auto range = dynamic_cast<const RangeQuery*>(&q)) {
+    return estimateRange(*range);
+  }
+  if (dynamic_cast<const FilterQuery*>(&q)) {
+    return std::numeric_limits<std::size_t>::max(); // no statistics, so could be any key
+  }
+  if (auto all = dynamic_cast<const AndQuery*>(&q)) {
+    std::size_t estimate = all->clauses().empty() ? 0 : std::numeric_limits<std::size_t>::max();
+    for (auto& clause : all->clauses()) {
+      estimate = std::min(estimate,estimateKeys(*clause));
+    }
+    return estimate;
+  }
+  if (auto any = dynamic_cast<const OrQuery*>(&q)) {
+    std::size_t estimate = 0;
+    for (auto& clause : any->clauses()) {
+      std::size_t clauseEstimate = estimateKeys(*clause);
+      estimate += std::min(clauseEstimate,std::numeric_limits<std::size_t>::max() - estimate);
+    }
+    return estimate;
+  }
+  if (auto negated = dynamic_cast<const NotQuery*>(&q)) {
+    return estimateKeys(negated->from());
+  }
+  return 0;
+}
+
+// Each quantile starts a run of step entries, so a range spanning n quantiles holds at most
+// n + 1 runs
+std::size_t
+EmbeddedDatabase::Impl::estimateRange(const RangeQuery& query) const {
+  for (auto& index : m_rangeIndexes) {
+    if (index.definition.name != query.index()) {
+      continue;
+    }
+    std::size_t size = index.entries.size();
+    if (0 == size || query.max() < query.min() || 0 == query.limit() ||
+        query.max() < index.entries.begin()->first || query.min() > index.entries.rbegin()->first) {
+      return 0;
+    }
+    if (index.quantiles.empty() || size > index.quantilesOf + index.quantilesOf / 10 ||
+        size < index.quantilesOf - index.quantilesOf / 10) {
+      index.step = std::max<std::size_t>(1,size / kHistogramBuckets);
+      index.quantiles.clear();
+      std::size_t position = 0;
+      for (auto& entry : index.entries) {
+        if (0 == position++ % index.step) {
+          index.quantiles.push_back(entry.first);
+        }
+      }
+      index.quantilesOf = size;
+    }
+    auto first = std::lower_bound(index.quantiles.begin(),index.quantiles.end(),query.min());
+    auto last = std::upper_bound(index.quantiles.begin(),index.quantiles.end(),query.max());
+    std::size_t estimate = std::min(size,static_cast<std::size_t>(last - first + 1) * index.step);
+    return std::min(estimate,query.limit());
+  }
+  return 0;
+}
+
+std::string
+EmbeddedDatabase::Impl::describe(const Query& q) {
+  std::ostringstream out;
+  if (auto bucket = dynamic_cast<const BucketQuery*>(&q)) {
+    out << "bucket " << bucket->bucket();
+  } else if (auto value = dynamic_cast<const ValueQuery*>(&q)) {
+    out << "value " << value->index();
+    if (std::optional<std::string> text = value->value().view().asString()) {
+      out << " = " << *text;
+    } else if (std::optional<double> number = numericValue(value->value().view())) {
+      out << " = " << *number;
+    }
+  } else if (auto text = dynamic_cast<const TextQuery*>(&q)) {
+    out << "text " << text->index() << " \"" << text->text() << "\"";
+  } else if (auto phrase = dynamic_cast<const PhraseQuery*>(&q)) {
+    out << "phrase " << phrase->index() << " \"" << phrase->phrase() << "\"";
+  } else if (auto range = dynamic_cast<const RangeQuery*>(&q)) {
+    out << "range " << range->index() << " [" << range->min() << "," << range->max() << "]";
+    if (range->limit() != std::numeric_limits<std::size_t>::max()) {
+      out << (range->descending() ? " top " : " bottom ") << range->limit();
+    }
+  } else if (auto filter = dynamic_cast<const FilterQuery*>(&q)) {
+    static const char* matches[] = {"=","between","prefix","contains"};
+    out << "filter " << (filter->field().empty() ? "value" : filter->field()) << " " <<
+           matches[static_cast<int>(filter->match())] << " ";
+    if (Filter::Between == filter->match()) {
+      out << "[" << filter->min() << "," << filter->max() << "]";
+    } else if (std::optional<std::string> text = filter->operand().asString()) {
+      out << "\"" << *text << "\"";
+    } else if (std::optional<double> number = numericValue(filter->operand().view())) {
+      out << *number;
+    }
+  } else if (dynamic_cast<const AndQuery*>(&q)) {
+    out << "AND";
+  } else if (dynamic_cast<const OrQuery*>(&q)) {
+    out << "OR";
+  } else if (dynamic_cast<const NotQuery*>(&q)) {
+    out << "NOT";
+  } else {
+    out << "query";
+  }
+  return out.str();
+}
+
+// Only clauses whose index is held in memory (see hashIndex), so a probe never reads a store,
+// whatever kind of index store is used. Other clauses are loaded and intersected instead.
+bool
+EmbeddedDatabase::Impl::probeable(const Query& q) {
+  return nullptr != dynamic_cast<const BucketQuery*>(&q) || nullptr != dynamic_cast<const ValueQuery*>(&q);
+}
+
+// Bucket and value indexes are held in memory once read, so a probe reads no store. The index
+// is found once per clause, not once per probed key.
+const EmbeddedDatabase::Impl::HashIndex&
+EmbeddedDatabase::Impl::probedIndex(const Query& q) const {
+  if (auto value = dynamic_cast<const ValueQuery*>(&q)) {
+    return hashIndex(valueIndexKey(value->index(),value->value().view()));
+  }
+  return hashIndex(kBucketIndexPrefix.append(static_cast<const BucketQuery&>(q).bucket()));
+}
+
+std::vector<std::uint64_t>
+EmbeddedDatabase::Impl::combineSorted(std::vector<SortedRange> lists,Combine how) {
+  if (lists.empty()) {
+    return {};
+  }
+  if (1 == lists.size()) {
+    return std::vector<std::uint64_t>(lists[0].begin(),lists[0].end());
+  }
+  if (Combine::Difference == how) {
+    return differenceSorted(lists[0],lists[1]);
+  }
+  if (Combine::Union == how) {
+    std::vector<std::uint64_t> result = unionSorted(lists[0],lists[1]);
+    for (std::size_t i = 2;i < lists.size();i++) {
+      result = unionSorted(result,lists[i]);
+    }
+    return result;
+  }
+  // Smallest first keeps every intermediate result as small as possible
+  std::sort(lists.begin(),lists.end(),[](auto& a,auto& b) { return a.size() < b.size(); });
+  std::vector<std::uint64_t> result = intersectSorted(lists[0],lists[1]);
+  for (std::size_t i = 2;i < lists.size() && !result.empty();i++) {
+    result = intersectSorted(result,lists[i]);
+  }
+  return result;
+}
+
+// Hashes are evenly spread, so equal ranges of the hash space hold similar numbers of keys.
+// Each range of every list is combined on its own thread, and the sorted results concatenated.
+std::vector<std::uint64_t>
+EmbeddedDatabase::Impl::combine(std::vector<std::vector<std::uint64_t>>&& lists,Combine how) const {
+  std::size_t total = 0;
+  for (auto& list : lists) {
+    total += list.size();
+  }
+  if (1 == lists.size()) {
+    return std::move(lists.front());
+  }
+  ThreadPool* pool = total < kParallelThreshold ? nullptr : queryPool();
+  if (nullptr == pool) {
+    return combineSorted(std::vector<SortedRange>(lists.begin(),lists.end()),how);
+  }
+
+  std::size_t parts = pool->size();
+  const std::uint64_t width = std::numeric_limits<std::uint64_t>::max() / parts;
+  std::vector<std::vector<std::uint64_t>> results(parts);
+  pool->parallelFor(parts,[&](std::size_t part) {
+    // Each part views its range of every list in place
+    std::vector<SortedRange> ranges;
+    ranges.reserve(lists.size());
+    for (const auto& list : lists) {
+      const std::uint64_t* first = std::lower_bound(list.data(),list.data() + list.size(),width * part);
+      const std::uint64_t* last = (part + 1 == parts) ? list.data() + list.size()
+                                                      : std::lower_bound(first,list.data() + list.size(),width * (part + 1));
+      ranges.emplace_back(first,last);
+    }
+    results[part] = combineSorted(std::move(ranges),how);
+  });
+
+  std::size_t size = 0;
+  for (auto& result : results) {
+    size += result.size();
+  }
+  std::vector<std::uint64_t> combined;
+  combined.reserve(size);
+  for (auto& result : results) {
+    combined.insert(combined.end(),result.begin(),result.end());
+  }
+  return combined;
+}
+
+ThreadPool* EmbeddedDatabase::Impl::queryPool() const {
+  std::size_t threads = 0 == m_queryThreads ? std::max(1u,std::thread::hardware_concurrency()) : m_queryThreads;
+  if (threads <= 1) {
+    return nullptr;
+  }
+  if (!m_queryPool) {
+    m_queryPool = std::make_unique<ThreadPool>(threads);
+  }
+  return m_queryPool.get();
+}
+
+void EmbeddedDatabase::Impl::setQueryThreads(std::size_t threads) {
+  m_queryThreads = threads;
+  m_queryPool.reset(); // started again at the new size when next needed
+}
+
+// Strings are length prefixed so that no two different queries share a key
+std::optional<std::string>
+EmbeddedDatabase::Impl::cacheKey(const Query& q,std::vector<std::string>& dependencies) const {
+  auto part = [](std::string_view text) {
+    return std::to_string(text.size()) + ":" + std::string(text);
+  };
+  auto wordsOf = [&part](const std::string& text) {
+    std::string joined;
+    for (auto& word : words(text)) {
+      joined += part(word);
+    }
+    return joined;
+  };
+  if (auto bucket = dynamic_cast<const BucketQuery*>(&q)) {
+    dependencies.push_back("bucket::" + bucket->bucket());
+    return "B" + part(bucket->bucket());
+  }
+  if (auto value = dynamic_cast<const ValueQuery*>(&q)) {
+    ValueView view = value->value().view();
+    dependencies.push_back("value::" + value->index());
+    return "V" + part(value->index()) + std::to_string(static_cast<int>(view.type())) +
+           part(std::string_view(reinterpret_cast<const char*>(view.data()),view.length()));
+  }
+  if (auto text = dynamic_cast<const TextQuery*>(&q)) {
+    dependencies.push_back("text::" + text->index());
+    return "T" + part(text->index()) + wordsOf(text->text());
+  }
+  if (auto phrase = dynamic_cast<const PhraseQuery*>(&q)) {
+    dependencies.push_back("text::" + phrase->index());
+    return "P" + part(phrase->index()) + wordsOf(phrase->phrase());
+  }
+  if (auto range = dynamic_cast<const RangeQuery*>(&q)) {
+    Bytes bounds;
+    encodeLittleEndian(bounds,range->min());
+    encodeLittleEndian(bounds,range->max());
+    encodeLittleEndian(bounds,static_cast<std::uint64_t>(range->limit()));
+    bounds.push_back(std::byte{range->descending() ? std::uint8_t{1} : std::uint8_t{0}});
+    dependencies.push_back("range::" + range->index());
+    return "R" + part(range->index()) + std::string(reinterpret_cast<const char*>(bounds.data()),bounds.size());
+  }
+  auto all = dynamic_cast<const AndQuery*>(&q);
+  auto any = dynamic_cast<const OrQuery*>(&q);
+  if (all || any) {
+    // Clause order and repeated clauses make no difference to the result
+    std::set<std::string> clauses;
+    for (auto& clause : (all ? all->clauses() : any->clauses())) {
+      std::optional<std::string> key = cacheKey(*clause,dependencies);
+      if (!key) {
+        return {};
+      }
+      clauses.insert(part(*key));
+    }
+    std::string key(all ? "A" : "O");
+    for (auto& clause : clauses) {
+      key += clause;
+    }
+    return key;
+  }
+  if (auto negated = dynamic_cast<const NotQuery*>(&q)) {
+    std::optional<std::string> from = cacheKey(negated->from(),dependencies);
+    std::optional<std::string> excluded = cacheKey(negated->excluded(),dependencies);
+    if (!from || !excluded) {
+      return {};
+    }
+    return "N" + part(*from) + part(*excluded);
+  }
+  return {};
+}
+
+void EmbeddedDatabase::Impl::bumpVersion(const std::string& dependency) {
+  m_versions[dependency]++;
+}
 
-  //std::cout << "EDB::Impl:query fetching kv set for bucket with key: " << idxKey << std::endl;
-  std::unique_ptr<IQueryResult> r = std::make_unique<DefaultQueryResult>(m_indexStore->getKeyValueSet(HashedKey(idxKey)));
-  //std::cout << "EDB::Impl:query result size: " << r.get()->recordKeys()->size() << std::endl;
-  return std::move(r);
+std::uint64_t EmbeddedDatabase::Impl::version(const std::string& dependency) const {
+  auto found = m_versions.find(dependency);
+  return found == m_versions.end() ? 0 : found->second;
+}
+
+KeySet
+EmbeddedDatabase::Impl::keysForHashes(const std::vector<std::uint64_t>& hashes) const {
+  // If two keys share a hash (only likely with DefaultHash::setWidth) both are returned, as
+  // indexes hold no more than the hash to tell them apart. See IDatabase::query.
+  KeySet keys = std::make_unique<std::unordered_set<HashedKey>>();
+  keys->reserve(hashes.size());
+  for (auto hash : hashes) {
+    for (auto& key : m_keyValueStore->keysForHash(hash)) {
+      keys->insert(std::move(key));
+    }
+  }
+  return keys;
 }
 
 
@@ -324,6 +1699,18 @@ EncodedValue EmbeddedDatabase::getKeyValue(const HashedValue& key) {
   return mImpl->getKeyValue(key);
 }
 
+EncodedValue EmbeddedDatabase::getKeyValue(const KeyView& key) {
+  return mImpl->getKeyValue(key);
+}
+
+std::vector<EncodedValue> EmbeddedDatabase::getKeyValues(const std::vector<HashedValue>& keys) {
+  return mImpl->getKeyValues(keys);
+}
+
+std::vector<EncodedValue> EmbeddedDatabase::getKeyValues(const std::vector<std::string>& keys) {
+  return mImpl->getKeyValues(keys);
+}
+
 void EmbeddedDatabase::setKeyValue(const HashedValue& key,const Set& value) {
   mImpl->setKeyValue(key,value);
 }
@@ -336,6 +1723,46 @@ Set EmbeddedDatabase::getKeyValueSet(const HashedValue& key) {
   return mImpl->getKeyValueSet(key);
 }
 
+void EmbeddedDatabase::createValueIndex(const std::string& name) {
+  mImpl->createValueIndex(name);
+}
+
+void EmbeddedDatabase::createValueIndex(const std::string& name,const std::string& field) {
+  mImpl->createValueIndex(name,field);
+}
+
+void EmbeddedDatabase::createRangeIndex(const std::string& name) {
+  mImpl->createRangeIndex(name);
+}
+
+void EmbeddedDatabase::createRangeIndex(const std::string& name,const std::string& field) {
+  mImpl->createRangeIndex(name,field);
+}
+
+void EmbeddedDatabase::createTextIndex(const std::string& name) {
+  mImpl->createTextIndex(name);
+}
+
+void EmbeddedDatabase::createTextIndex(const std::string& name,const std::string& field) {
+  mImpl->createTextIndex(name,field);
+}
+
+bool EmbeddedDatabase::exists(const HashedValue& key) const {
+  return mImpl->exists(key);
+}
+
+bool EmbeddedDatabase::exists(const KeyView& key) const {
+  return mImpl->exists(key);
+}
+
+std::vector<HashedKey> EmbeddedDatabase::keysWithPrefix(std::string_view prefix) const {
+  return mImpl->keysWithPrefix(prefix);
+}
+
+std::vector<HashedKey> EmbeddedDatabase::keysInRange(std::string_view from,std::string_view to) const {
+  return mImpl->keysInRange(from,to);
+}
+
 // MARK: Query functions
 
 std::unique_ptr<IQueryResult>
@@ -347,4 +1774,59 @@ EmbeddedDatabase::query(BucketQuery& query) const {
   return mImpl->query(query);
 }
 
+std::unique_ptr<IQueryCursor>
+EmbeddedDatabase::queryCursor(Query& query) const {
+  return mImpl->queryCursor(query);
+}
+
+std::unique_ptr<IQueryCursor>
+EmbeddedDatabase::queryCursor(Query& query,std::size_t offset,std::size_t limit) const {
+  return mImpl->queryCursor(query,offset,limit);
+}
+
+QueryValues
+EmbeddedDatabase::queryWithValues(Query& query) const {
+  return mImpl->queryWithValues(query);
+}
+
+QueryPlan
+EmbeddedDatabase::explain(Query& query) const {
+  return mImpl->explain(query);
+}
+
+std::optional<double>
+EmbeddedDatabase::aggregate(Query& query,Aggregate function) const {
+  return mImpl->aggregate(query,function);
+}
+
+std::optional<double>
+EmbeddedDatabase::aggregate(Query& query,Aggregate function,const std::string& field) const {
+  return mImpl->aggregate(query,function,field);
+}
+
+void
+EmbeddedDatabase::enableBucketSketches(const std::string& bucket) {
+  mImpl->enableBucketSketches(bucket);
+}
+
+std::optional<BucketSketches>
+EmbeddedDatabase::bucketSketches(const std::string& bucket) const {
+  return mImpl->bucketSketches(bucket);
+}
+
+void
+EmbeddedDatabase::setQueryThreads(std::size_t threads) {
+  mImpl->setQueryThreads(threads);
+}
+
+std::size_t
+EmbeddedDatabase::count(const std::string& bucket) const {
+  return mImpl->count(bucket);
+}
+
+bool
+EmbeddedDatabase::bucketContains(const std::string& bucket,const HashedValue& key) const {
+  return mImpl->bucketContains(bucket,key);
+}
+
 
@@ -17,25 +17,78 @@ under the License.
 */
 #include "extensions/extdatabase.h"
 #include "extensions/highwayhash.h"
+#include "integerlist.h"
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <filesystem>
+#include <iterator>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace groundupdbext {
 
 namespace fs = std::filesystem;
 
+// On disk layout
+// Every key hash has a <hash>.key file listing each key stored under that hash
+// (its collision chain). Each entry is written as:-
+//   kind (the value type number, or "set")
+//   key length
+//   raw key bytes
+// The first key's data lives in <hash>.kv, and the Nth (N > 0) in <hash>.N.kv
+// Every data file starts with its key's chain entry, so a key in its hash's
+// first slot (almost every key) is read and written without reading the chain.
+// Lengths always precede raw bytes so keys and values may contain newlines.
+// Set data files are binary: a varint count, then for each value a varint of
+// (type << 1 | hasValue), a varint length and the raw bytes. Each value's hash
+// is computed again as it is read, rather than stored.
+// Single member changes are appended to <data file>.log as a varint (1 add,
+// 0 remove) then the value as above. The log is replayed over the set when it
+// is read, and folded in to the data file by the change that makes it outgrow it.
+
 class FileKeyValueStore::Impl {
 public:
   Impl(std::string fullpath);
   std::string m_fullpath;
   HighwayHash m_hasher;
 
-private:
+  // One key in a hash's collision chain
+  struct ChainEntry {
+    std::string kind;
+    Bytes key;
+  };
+
+  static void writeEntry(std::ostream& os,const std::string& kind,const Bytes& key);
+  static std::optional<ChainEntry> readEntry(std::istream& t);
+  std::vector<ChainEntry> readChain(const std::string& keyHash) const;
+  void writeChain(const std::string& keyHash,const std::vector<ChainEntry>& chain) const;
+  // Returns the data file path for key, or an empty string if it is not stored as that kind.
+  // When found, t is left open on the data after the file's key.
+  std::string storedDataPath(const HashedValue& key,bool isSet,std::ifstream& t) const;
+  // Returns the data file path for key, adding key to its chain if new
+  std::string dataPath(const HashedValue& key,const std::string& kind) const;
 
+  static void writeValue(std::ostream& os,const EncodedValue& value);
+  static EncodedValue readValue(std::istream& t);
+  static void encodeSetValue(Bytes& out,const EncodedValue& value);
+  static std::optional<EncodedValue> decodeSetValue(const std::byte*& in,const std::byte* end);
+  // The encoded bytes of the next set member, skipped over without decoding. Empty if truncated.
+  static std::optional<std::string_view> nextSetValue(const std::byte*& in,const std::byte* end);
+  // Whether each member changed in a set log is in the set after the log, by encoded bytes
+  // (which are views in to log)
+  static std::unordered_map<std::string_view,bool> replayLog(const std::string& log);
+  static std::string readFile(const std::string& path);
+  static std::string readFile(std::istream& t);
+  // Appends one member change to key's set log, creating an empty set first if needed.
+  // Returns true if the log is now larger than the data file.
+  bool logSetChange(const HashedValue& key,bool add,const EncodedValue& member) const;
+  std::string slotPath(const std::string& keyHash,std::size_t slot) const;
 };
 
 FileKeyValueStore::Impl::Impl(std::string fullpath)
@@ -44,6 +97,258 @@ FileKeyValueStore::Impl::Impl(std::string fullpath)
   ;
 }
 
+std::string
+FileKeyValueStore::Impl::slotPath(const std::string& keyHash,std::size_t slot) const
+{
+  if (0 == slot) {
+    return m_fullpath + "/" + keyHash + ".kv";
+  }
+  return m_fullpath + "/" + keyHash + "." + std::to_string(slot) + ".kv";
+}
+
+void
+FileKeyValueStore::Impl::writeEntry(std::ostream& os,const std::string& kind,const Bytes& key)
+{
+  os << kind << std::endl;
+  os << key.size() << std::endl;
+  os.write(reinterpret_cast<const char*>(key.data()),key.size());
+  os << std::endl;
+}
+
+std::optional<FileKeyValueStore::Impl::ChainEntry>
+FileKeyValueStore::Impl::readEntry(std::istream& t)
+{
+  std::string kind;
+  std::string cd;
+  if (!std::getline(t,kind) || !std::getline(t,cd)) {
+    return {};
+  }
+  std::size_t length = std::stoul(cd);
+  Bytes key(length);
+  t.read(reinterpret_cast<char*>(key.data()),length);
+  std::getline(t,cd); // eol
+  if (!t) {
+    return {}; // truncated
+  }
+  return ChainEntry{kind,std::move(key)};
+}
+
+std::vector<FileKeyValueStore::Impl::ChainEntry>
+FileKeyValueStore::Impl::readChain(const std::string& keyHash) const
+{
+  std::vector<ChainEntry> chain;
+  std::ifstream t(m_fullpath + "/" + keyHash + ".key",std::ios::in | std::ios::binary);
+  while (auto entry = readEntry(t)) {
+    chain.push_back(std::move(*entry));
+  }
+  return chain;
+}
+
+void
+FileKeyValueStore::Impl::writeChain(const std::string& keyHash,const std::vector<ChainEntry>& chain) const
+{
+  std::ofstream os(m_fullpath + "/" + keyHash + ".key",
+                   std::ios::out | std::ios::trunc | std::ios::binary);
+  for (auto& entry : chain) {
+    writeEntry(os,entry.kind,entry.key);
+  }
+}
+
+std::string
+FileKeyValueStore::Impl::storedDataPath(const HashedValue& key,bool isSet,std::ifstream& t) const
+{
+  std::string keyHash(std::to_string(key.hash()));
+  std::string fp(slotPath(keyHash,0));
+  t.open(fp,std::ios::in | std::ios::binary);
+  std::optional<ChainEntry> stored = readEntry(t);
+  if (!stored) {
+    return ""; // no key has this hash
+  }
+  if (stored->key != key.data()) {
+    // Another key with this hash holds the first slot, so the chain says where key is
+    t.close();
+    std::vector<ChainEntry> chain = readChain(keyHash);
+    std::size_t slot = 1;
+    for (;slot < chain.size() && chain[slot].key != key.data();slot++);
+    if (slot >= chain.size()) {
+      return "";
+    }
+    fp = slotPath(keyHash,slot);
+    t.open(fp,std::ios::in | std::ios::binary);
+    stored = readEntry(t);
+    if (!stored) {
+      return "";
+    }
+  }
+  if (isSet != ("set" == stored->kind)) {
+    return "";
+  }
+  return fp;
+}
+
+std::string
+FileKeyValueStore::Impl::dataPath(const HashedValue& key,const std::string& kind) const
+{
+  std::string keyHash(std::to_string(key.hash()));
+  std::ifstream t(slotPath(keyHash,0),std::ios::in | std::ios::binary);
+  std::optional<ChainEntry> first = readEntry(t);
+  if (!first) {
+    // The first key with this hash, so its chain is just itself
+    writeChain(keyHash,{ChainEntry{kind,key.data()}});
+    return slotPath(keyHash,0);
+  }
+  if (first->kind == kind && first->key == key.data()) {
+    return slotPath(keyHash,0); // no need to read or rewrite the chain
+  }
+  std::vector<ChainEntry> chain = readChain(keyHash);
+  std::size_t slot = 0;
+  for (;slot < chain.size() && chain[slot].key != key.data();slot++);
+  if (slot == chain.size()) {
+    chain.push_back(ChainEntry{kind,key.data()});
+  } else if (chain[slot].kind == kind) {
+    return slotPath(keyHash,slot); // no need to rewrite the chain
+  } else {
+    chain[slot].kind = kind;
+  }
+  writeChain(keyHash,chain);
+  return slotPath(keyHash,slot);
+}
+
+void
+FileKeyValueStore::Impl::writeValue(std::ostream& os,const EncodedValue& value)
+{
+  os << value.hasValue() << std::endl;
+  os << value.type() << std::endl;
+  os << value.length() << std::endl;
+  os.write(reinterpret_cast<const char*>(value.data().data()),value.length());
+  os << std::endl;
+  os << value.hash() << std::endl;
+}
+
+EncodedValue
+FileKeyValueStore::Impl::readValue(std::istream& t)
+{
+  std::string cd;
+  if (!std::getline(t,cd) || "1" != cd) {
+    return EncodedValue();
+  }
+  // type
+  std::getline(t,cd);
+  groundupdb::Type type = (groundupdb::Type)std::stoi(cd);
+  // length
+  std::getline(t,cd);
+  std::size_t length = std::stoul(cd);
+  // data - read exactly length bytes as the data may contain newlines
+  Bytes bytes(length);
+  t.read(reinterpret_cast<char*>(bytes.data()),length);
+  std::getline(t,cd); // eol
+  // hash
+  std::getline(t,cd);
+  std::size_t hash = std::stoul(cd);
+  return EncodedValue(type,bytes,length,hash);
+}
+
+void
+FileKeyValueStore::Impl::encodeSetValue(Bytes& out,const EncodedValue& value)
+{
+  ValueView view = value.view();
+  encodeVarint(out,(static_cast<std::uint64_t>(value.type()) << 1) | (value.hasValue() ? 1 : 0));
+  encodeVarint(out,view.length());
+  out.insert(out.end(),view.data(),view.data() + view.length());
+}
+
+std::optional<EncodedValue>
+FileKeyValueStore::Impl::decodeSetValue(const std::byte*& in,const std::byte* end)
+{
+  auto tag = decodeVarint(in,end);
+  auto length = decodeVarint(in,end);
+  if (!tag || !length || static_cast<std::uint64_t>(end - in) < *length) {
+    return {};
+  }
+  if (0 == (*tag & 1)) {
+    in += *length;
+    return EncodedValue();
+  }
+  Bytes bytes(in,in + *length);
+  in += *length;
+  std::size_t hash = KeyView(bytes.data(),bytes.size()).hash(); // as HashedValue computes it
+  return EncodedValue((groundupdb::Type)(*tag >> 1),bytes,*length,hash);
+}
+
+std::optional<std::string_view>
+FileKeyValueStore::Impl::nextSetValue(const std::byte*& in,const std::byte* end)
+{
+  const std::byte* start = in;
+  auto tag = decodeVarint(in,end);
+  auto length = decodeVarint(in,end);
+  if (!tag || !length || static_cast<std::uint64_t>(end - in) < *length) {
+    return {};
+  }
+  in += *length;
+  return std::string_view(reinterpret_cast<const char*>(start),in - start);
+}
+
+std::unordered_map<std::string_view,bool>
+FileKeyValueStore::Impl::replayLog(const std::string& log)
+{
+  std::unordered_map<std::string_view,bool> changes;
+  const std::byte* in = reinterpret_cast<const std::byte*>(log.data());
+  const std::byte* end = in + log.size();
+  while (in < end) {
+    auto add = decodeVarint(in,end);
+    auto value = add ? nextSetValue(in,end) : std::nullopt;
+    if (!value) {
+      break; // truncated, e.g. by a crash part way through an append
+    }
+    changes[*value] = (1 == *add);
+  }
+  return changes;
+}
+
+std::string
+FileKeyValueStore::Impl::readFile(const std::string& path)
+{
+  std::ifstream t(path,std::ios::in | std::ios::binary);
+  return readFile(t);
+}
+
+std::string
+FileKeyValueStore::Impl::readFile(std::istream& t)
+{
+  return std::string((std::istreambuf_iterator<char>(t)),std::istreambuf_iterator<char>());
+}
+
+bool
+FileKeyValueStore::Impl::logSetChange(const HashedValue& key,bool add,const EncodedValue& member) const
+{
+  std::ifstream t;
+  std::string fp(storedDataPath(key,true,t));
+  t.close();
+  if (fp.empty()) {
+    // Not yet a set (or was a plain value), so start from an empty one
+    fp = dataPath(key,"set");
+    Bytes empty;
+    encodeVarint(empty,0);
+    std::ofstream os(fp,std::ios::out | std::ios::trunc | std::ios::binary);
+    writeEntry(os,"set",key.data());
+    os.write(reinterpret_cast<const char*>(empty.data()),empty.size());
+    os.close();
+    std::error_code ec;
+    fs::remove(fp + ".log",ec);
+  }
+  Bytes record;
+  encodeVarint(record,add ? 1 : 0);
+  encodeSetValue(record,member);
+  std::ofstream os(fp + ".log",std::ios::out | std::ios::app | std::ios::binary);
+  os.write(reinterpret_cast<const char*>(record.data()),record.size());
+  os.close();
+  std::error_code logError;
+  std::error_code dataError;
+  std::uintmax_t logSize = fs::file_size(fp + ".log",logError);
+  std::uintmax_t dataSize = fs::file_size(fp,dataError);
+  return !logError && !dataError && logSize > dataSize;
+}
+
 
 
 
@@ -66,222 +371,316 @@ FileKeyValueStore::~FileKeyValueStore()
 void
 FileKeyValueStore::setKeyValue(const HashedValue& key,EncodedValue&& value)
 {
+  // Read, modify, write the key's collision chain, so other keys with this hash are kept
+  std::ostringstream kind;
+  kind << value.type();
   std::ofstream os;
-  std::string keyHash(std::to_string(key.hash()));
-  os.open(mImpl->m_fullpath + "/" + keyHash + ".kv",
-          std::ios::out | std::ios::trunc);
-  os << value.hasValue() << std::endl;
-  os << value.type() << std::endl;
-  os << value.length() << std::endl;
-  for (auto& b : value.data()) {
-    os << (const char)b;
-  }
-  os << std::endl;
-  os << value.hash() << std::endl;
-  os.close();
-  // TODO allow multiple keys for this hash (read, modify, write)
-  os.open(mImpl->m_fullpath + "/" + keyHash + ".key",
-          std::ios::out | std::ios::trunc);
-  os << value.type() << std::endl;
-  os << keyHash.c_str();
+  os.open(mImpl->dataPath(key,kind.str()),
+          std::ios::out | std::ios::trunc | std::ios::binary);
+  FileKeyValueStore::Impl::writeEntry(os,kind.str(),key.data());
+  FileKeyValueStore::Impl::writeValue(os,value);
   os.close();
 }
 
 EncodedValue
 FileKeyValueStore::getKeyValue(const HashedValue& key)
 {
-  std::string keyHash(std::to_string(key.hash()));
-  std::ifstream t(mImpl->m_fullpath + "/" + keyHash + ".kv"); // DANGEROUS
-  std::string eol; // eol can be multiple characters
-
-  bool hasValue;
-  groundupdb::Type type;
-  int tint;
-  std::string cd;
-  int length;
-  int hash = 0;
-  Bytes bytes;
-  t >> hasValue;
-  std::getline(t,eol);
-  if (hasValue) {
-    // type
-    t >> tint;
-    type = (groundupdb::Type)tint;
-    // length
-    t >> length;
-    // data
-    std::getline(t,cd);
-    bytes.reserve(cd.length());
-    for (auto& c : cd) {
-      bytes.push_back((std::byte)c);
-    }
-    // hash
-    t >> hash;
-    std::getline(t,eol);
-    //std::cout << "  Reading and creating value with length: " << length << ", hash: " << hash << std::endl;
-  } else {
-    length = 0;
-    type = groundupdb::Type::UNKNOWN;
-    hash = 0;
+  std::ifstream t;
+  if (mImpl->storedDataPath(key,false,t).empty()) {
+    return EncodedValue(); // not stored
   }
-  return EncodedValue(type,bytes,length,hash);
+  return FileKeyValueStore::Impl::readValue(t);
 }
 
+EncodedValue
+FileKeyValueStore::getKeyValue(const KeyView& key)
+{
+  // Reading the key's data file compares whole keys, so an owning key is needed anyway
+  return getKeyValue(key.toHashedValue());
+}
 
 void
 FileKeyValueStore::setKeyValue(const HashedValue& key,const Set& value) {
-  // store in _string_set.kl file elements_num<length,value...>...
-  std::ofstream os;
-  std::string keyHash(std::to_string(key.hash()));
-  std::string fp(mImpl->m_fullpath + "/" + keyHash + ".kv");
-  os.open(fp,
-          std::ios::out | std::ios::trunc);
-  os << value->size() << std::endl;
+  // Encoded in memory first so the whole set is written in one call
+  Bytes data;
+  encodeVarint(data,value->size());
   for (auto val = value->begin();val != value->end(); val++) {
-    //std::cout << "  Writing set value with length: " << val->length() << ", hash: " << val->hash() << std::endl;
-    os << val->hasValue() << std::endl;
-    os << val->type() << std::endl;
-    os << val->length() << std::endl;
-    for (auto& b : val->data()) {
-      os << (const char)b;
-    }
-    os << std::endl;
-    os << val->hash() << std::endl;
+    FileKeyValueStore::Impl::encodeSetValue(data,*val);
   }
+  std::string fp(mImpl->dataPath(key,"set"));
+  std::ofstream os;
+  os.open(fp,std::ios::out | std::ios::trunc | std::ios::binary);
+  FileKeyValueStore::Impl::writeEntry(os,"set",key.data());
+  os.write(reinterpret_cast<const char*>(data.data()),data.size());
   os.close();
-  // TODO allow multiple keys for this hash (read, modify, write)
-  os.open(mImpl->m_fullpath + "/" + keyHash + ".key",
-          std::ios::out | std::ios::trunc);
-  os << "set" << std::endl;
-  for (auto& b : key.data()) {
-    os << (const char)b;
-  }
-  os << std::endl;
-  os.close();
+  // The whole set is now in the data file, so any earlier changes are obsolete
+  std::error_code ec;
+  fs::remove(fp + ".log",ec);
 }
 
 Set
 FileKeyValueStore::getKeyValueSet(const HashedValue& key) {
-  // get from _string_set.kl file
-  std::string keyHash(std::to_string(key.hash()));
-  std::string fp(mImpl->m_fullpath + "/" + keyHash + ".kv");
-  if (!fs::exists(fp)) {
-    //std::cout << "FileKeyValueStore::getKeyValueSet returning empty set" << std::endl;
-    return std::make_unique<std::unordered_set<EncodedValue>>(); // TODO verify we don't need to specify type here
+  Set values = std::make_unique<std::unordered_set<EncodedValue>>();
+  std::ifstream t;
+  std::string fp(mImpl->storedDataPath(key,true,t));
+  if (fp.empty()) {
+    return values;
   }
-  std::ifstream t(fp);
-  std::unordered_set<EncodedValue> values;
+  std::string data(FileKeyValueStore::Impl::readFile(t));
+  const std::byte* in = reinterpret_cast<const std::byte*>(data.data());
+  const std::byte* end = in + data.size();
 
   // read size first
-  int entries;
-  std::string eol; // eol can be multiple characters
-  t >> entries;
-  std::getline(t,eol);
+  auto entries = decodeVarint(in,end);
+  if (!entries) {
+    return values;
+  }
+  values->reserve(std::min<std::uint64_t>(*entries,data.size()));
 
   // Each value information
-  bool hasValue;
-  groundupdb::Type type;
-  int tint;
-  std::string cd;
-  Bytes bytes;
-  int length = 0;
-  std::size_t hash = 0;
-  std::size_t lengthSize = sizeof(length);
-  std::size_t hashSize = sizeof(hash);
-  for (int i = 0;i < entries;i++) {
-    // read hasValue
-    t >> hasValue;
-    std::getline(t,eol);
-    if (hasValue) {
-      //std::cout << "  Entry has value" << std::endl;
-      // type
-      cd.clear();
-      std::getline(t,cd);
-      //std::cout << "    Type string: " << cd << std::endl;
-      //t >> tint; // DOESN'T WORK!
-      tint = std::stoi(cd);
-      type = (groundupdb::Type)tint;
-      // length
-      cd.clear();
-      std::getline(t,cd);
-      //std::cout << "    Length string: " << cd << std::endl;
-      //t >> length; // DOESN'T WORK!
-      length = std::stoi(cd,&lengthSize);
-      // data
-      cd.clear();
-      std::getline(t,cd);
-      bytes.clear();
-      bytes.reserve(cd.length());
-      //std::cout << "    Expecting " << length << " bytes, read line of " << cd.length() << " bytes" << std::endl;
-      //std::cout << "    Reading bytes: ";
-      for (auto& c : cd) {
-        //std::cout << ".";
-        bytes.push_back((std::byte)c);
-      }
-      //std::cout << std::endl;
-      // hash
-      cd.clear();
-      std::getline(t,cd);
-      //std::cout << "    Read hash value (string) of: " << cd << std::endl;
-      //t >> hash; // DOESN'T WORK!
-      hash = std::stoul(cd,&hashSize);
-      //std::cout << "    Reading and creating SET value with length: " << length << ", hash: " << hash << std::endl;
-      cd.clear();
+  for (std::uint64_t i = 0;i < *entries;i++) {
+    auto value = FileKeyValueStore::Impl::decodeSetValue(in,end);
+    if (!value) {
+      break; // truncated
+    }
+    values->insert(std::move(*value));
+  }
+
+  // Replay member changes made since the data file was written
+  std::string log(FileKeyValueStore::Impl::readFile(fp + ".log"));
+  in = reinterpret_cast<const std::byte*>(log.data());
+  end = in + log.size();
+  while (in < end) {
+    auto add = decodeVarint(in,end);
+    auto value = add ? FileKeyValueStore::Impl::decodeSetValue(in,end) : std::nullopt;
+    if (!value) {
+      break; // truncated, e.g. by a crash part way through an append
+    }
+    if (1 == *add) {
+      values->insert(std::move(*value));
     } else {
-      //std::cout << "  Entry DOES NOT have value" << std::endl;
-      length = 0;
-      type = groundupdb::Type::UNKNOWN;
-      hash = 0;
+      values->erase(*value);
+    }
+  }
+  return values;
+}
+
+void
+FileKeyValueStore::addToKeyValueSet(const HashedValue& key,EncodedValue&& member)
+{
+  if (mImpl->logSetChange(key,true,member)) {
+    setKeyValue(key,getKeyValueSet(key)); // compact, so reads stay proportional to the set size
+  }
+}
+
+void
+FileKeyValueStore::removeFromKeyValueSet(const HashedValue& key,const EncodedValue& member)
+{
+  if (mImpl->logSetChange(key,false,member)) {
+    setKeyValue(key,getKeyValueSet(key));
+  }
+}
+
+bool
+FileKeyValueStore::hasKey(const KeyView& key)
+{
+  auto matches = [&key](const FileKeyValueStore::Impl::ChainEntry& entry) {
+    return entry.key.size() == key.length() &&
+           std::equal(entry.key.begin(),entry.key.end(),key.data());
+  };
+  std::string keyHash(std::to_string(key.hash()));
+  std::ifstream t(mImpl->slotPath(keyHash,0),std::ios::in | std::ios::binary);
+  std::optional<FileKeyValueStore::Impl::ChainEntry> first = FileKeyValueStore::Impl::readEntry(t);
+  if (!first) {
+    return false; // no key has this hash
+  }
+  if (matches(*first)) {
+    return true;
+  }
+  std::vector<FileKeyValueStore::Impl::ChainEntry> chain = mImpl->readChain(keyHash);
+  return std::any_of(chain.begin(),chain.end(),matches);
+}
+
+std::size_t
+FileKeyValueStore::keyValueSetSize(const HashedValue& key)
+{
+  std::ifstream t;
+  std::string fp(mImpl->storedDataPath(key,true,t));
+  if (fp.empty()) {
+    return 0;
+  }
+  if (fs::exists(fp + ".log")) {
+    // Only the members the log changes are decoded. Each is then looked for in the data file.
+    std::string log(FileKeyValueStore::Impl::readFile(fp + ".log"));
+    std::unordered_map<std::string_view,bool> changes = FileKeyValueStore::Impl::replayLog(log);
+    std::string data(FileKeyValueStore::Impl::readFile(t));
+    const std::byte* in = reinterpret_cast<const std::byte*>(data.data());
+    const std::byte* end = in + data.size();
+    std::size_t size = 0;
+    auto entries = decodeVarint(in,end);
+    for (std::uint64_t i = 0;entries && i < *entries;i++) {
+      auto value = FileKeyValueStore::Impl::nextSetValue(in,end);
+      if (!value) {
+        break; // truncated
+      }
+      auto change = changes.find(*value);
+      if (change == changes.end()) {
+        size++;
+      } else if (change->second) {
+        size++;
+        changes.erase(change); // already counted
+      }
+      // else removed by the log
+    }
+    for (auto& change : changes) {
+      if (change.second) {
+        size++; // added by the log
+      }
+    }
+    return size;
+  }
+  // Otherwise the size is the leading count, so read just that
+  char head[10];
+  t.read(head,sizeof(head));
+  const std::byte* in = reinterpret_cast<const std::byte*>(head);
+  return decodeVarint(in,in + t.gcount()).value_or(0);
+}
+
+bool
+FileKeyValueStore::keyValueSetContains(const HashedValue& key,const EncodedValue& member)
+{
+  // Compares encoded bytes, so no member is decoded
+  std::ifstream t;
+  std::string fp(mImpl->storedDataPath(key,true,t));
+  if (fp.empty()) {
+    return false;
+  }
+  Bytes wanted;
+  FileKeyValueStore::Impl::encodeSetValue(wanted,member);
+  std::string_view target(reinterpret_cast<const char*>(wanted.data()),wanted.size());
+  // The last change to member in the log decides, if there is one
+  std::string log(FileKeyValueStore::Impl::readFile(fp + ".log"));
+  std::unordered_map<std::string_view,bool> changes = FileKeyValueStore::Impl::replayLog(log);
+  auto change = changes.find(target);
+  if (change != changes.end()) {
+    return change->second;
+  }
+  std::string data(FileKeyValueStore::Impl::readFile(t));
+  const std::byte* in = reinterpret_cast<const std::byte*>(data.data());
+  const std::byte* end = in + data.size();
+  auto entries = decodeVarint(in,end);
+  for (std::uint64_t i = 0;entries && i < *entries;i++) {
+    auto value = FileKeyValueStore::Impl::nextSetValue(in,end);
+    if (!value) {
+      break; // truncated
+    }
+    if (*value == target) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<HashedValue>
+FileKeyValueStore::keysForHash(std::size_t hash)
+{
+  std::vector<HashedValue> keys;
+  for (auto& entry : mImpl->readChain(std::to_string(hash))) {
+    keys.emplace_back(std::move(entry.key));
+  }
+  return keys;
+}
+
+std::vector<HashedValue>
+FileKeyValueStore::keysInRange(const Bytes& from,const Bytes& to)
+{
+  // Files are named by key hash, so every chain has to be read
+  std::vector<Bytes> keys;
+  for (auto& p : fs::directory_iterator(fs::path(mImpl->m_fullpath))) {
+    if (p.is_regular_file() && ".key" == p.path().extension()) {
+      for (auto& entry : mImpl->readChain(p.path().stem().string())) {
+        if (!(entry.key < from) && (to.empty() || entry.key < to)) {
+          keys.push_back(std::move(entry.key));
+        }
+      }
+    }
+  }
+  std::sort(keys.begin(),keys.end());
+  return hashKeys(std::move(keys));
+}
+
+void
+FileKeyValueStore::loadEntriesInto(const std::vector<std::uint64_t>& hashes,
+                                   std::function<void(const HashedValue& key,EncodedValue value)> callback)
+{
+  // Each hash's chain is read once, and gives the data file of every key in it directly,
+  // rather than being read again for each key by getKeyValue
+  for (auto hash : hashes) {
+    std::string keyHash(std::to_string(hash));
+    std::vector<FileKeyValueStore::Impl::ChainEntry> chain = mImpl->readChain(keyHash);
+    for (std::size_t slot = 0;slot < chain.size();slot++) {
+      if ("set" == chain[slot].kind) {
+        continue;
+      }
+      std::ifstream t(mImpl->slotPath(keyHash,slot),std::ios::in | std::ios::binary);
+      FileKeyValueStore::Impl::readEntry(t); // the key, already known from the chain
+      callback(HashedValue(std::move(chain[slot].key)),FileKeyValueStore::Impl::readValue(t));
     }
-    values.emplace(type,bytes,length,hash);
   }
-  //std::cout << "FileKeyValueStore::getKeyValueSet returning read results of size: " << values.size() << ", but entries in file of: " << entries << std::endl;
-  return std::make_unique<std::unordered_set<EncodedValue>>(values);
 }
 
 void
 FileKeyValueStore::loadKeysInto(
     std::function<void(const HashedValue& key,EncodedValue value)> callback)
 {
-  std::string type;
-  std::string data;
-  std::string eol; // eol can be multiple characters
-  std::size_t hash;
-  // load any files with .kv in their name
+  // load the collision chain in every .key file
+  // Key bytes are gathered first so they can be hashed in a single batch
+  std::vector<Bytes> keys;
   fs::path fp(mImpl->m_fullpath);
   for (auto& p : fs::directory_iterator(fp)) {
     if (p.exists() && p.is_regular_file()) {
-      // check if extension is .kv
+      // check if extension is .key
       if(".key" == p.path().extension()) {
-        // If so, open file
-
-        std::string hashWithExtension = p.path().filename().string();
-        // ASSUMPTION always ends with .kv
-        std::string strhash = hashWithExtension.substr(0,hashWithExtension.length() - 4); // BUG0000001
-        // TODO check that file name is long enough
-        // TODO check that file exists before opening
-
-        std::ifstream t(p.path());
-        t >> type;
-        t >> data;
-        // Construct hashed key
-        std::stringstream sstream(strhash);
-        sstream >> hash;
-        char* cdata = new char[data.length()];
-        const char* cstr = data.c_str();
-        for (unsigned long i = 0;i < data.length();i++) {
-          cdata[i] = cstr[i];
-        }
-        HashedKey key(std::string(cdata,data.length()));
-        if ("set" == type) {
-          // TODO support set as an encoded value
-          //callback(key,getKeyValueSet(key));
-        } else {
-          callback(key,getKeyValue(key));
+        std::string keyHash = p.path().stem().string();
+        for (auto& entry : mImpl->readChain(keyHash)) {
+          if ("set" == entry.kind) {
+            // TODO support set as an encoded value
+            continue;
+          }
+          keys.push_back(std::move(entry.key));
         }
       }
     }
   }
+  for (auto& key : hashKeys(std::move(keys))) {
+    callback(key,getKeyValue(key));
+  }
+}
+
+void
+FileKeyValueStore::scanValues(std::function<void(const ValueBatch& batch)> callback)
+{
+  // Values are read from disk, so each batch lends copies held only until it has been used
+  std::vector<std::pair<HashedValue,EncodedValue>> entries;
+  entries.reserve(kScanBatchSize);
+  ValueBatch batch;
+  auto flush = [&entries,&batch,&callback]() {
+    for (auto& [key,value] : entries) {
+      batch.add(key,value);
+    }
+    callback(batch);
+    batch.clear();
+    entries.clear();
+  };
+  loadKeysInto([&entries,&flush](const HashedValue& key,EncodedValue value) {
+    entries.emplace_back(key,std::move(value));
+    if (kScanBatchSize == entries.size()) {
+      flush();
+    }
+  });
+  if (!entries.empty()) {
+    flush();
+  }
 }
 
 
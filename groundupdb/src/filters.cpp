@@ -0,0 +1,196 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "filters.h"
+#include "simd.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <string_view>
+
+namespace groundupdb {
+
+namespace {
+
+constexpr double kNotANumber = std::numeric_limits<double>::quiet_NaN();
+
+// Older versions stored strings as CPP
+bool
+isText(Type type)
+{
+  return Type::STRING == type || Type::BYTES == type || Type::CPP == type;
+}
+
+// NaN, which fails every comparison, for anything that is not a number
+double
+numberOf(Type type,const std::byte* data,std::size_t length)
+{
+  switch (type) {
+    case Type::INT32:
+      return sizeof(std::int32_t) == length ? static_cast<double>(decodeLittleEndian<std::int32_t>(data)) : kNotANumber;
+    case Type::INT64:
+      return sizeof(std::int64_t) == length ? static_cast<double>(decodeLittleEndian<std::int64_t>(data)) : kNotANumber;
+    case Type::UINT64:
+      return sizeof(std::uint64_t) == length ? static_cast<double>(decodeLittleEndian<std::uint64_t>(data)) : kNotANumber;
+    case Type::DOUBLE:
+      return sizeof(double) == length ? decodeLittleEndian<double>(data) : kNotANumber;
+    default:
+      return kNotANumber;
+  }
+}
+
+void
+betweenOf(const double* numbers,std::size_t count,double min,double max,std::uint8_t* passes)
+{
+  std::size_t i = 0;
+#ifdef GROUNDUPDB_SSE2
+  __m128d low = _mm_set1_pd(min);
+  __m128d high = _mm_set1_pd(max);
+  for (;i + 4 <= count;i += 4) {
+    __m128d a = _mm_loadu_pd(numbers + i);
+    __m128d b = _mm_loadu_pd(numbers + i + 2);
+    int mask = _mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(a,low),_mm_cmple_pd(a,high))) |
+               (_mm_movemask_pd(_mm_and_pd(_mm_cmpge_pd(b,low),_mm_cmple_pd(b,high))) << 2);
+    passes[i] = mask & 1;
+    passes[i + 1] = (mask >> 1) & 1;
+    passes[i + 2] = (mask >> 2) & 1;
+    passes[i + 3] = (mask >> 3) & 1;
+  }
+#endif
+  for (;i < count;i++) {
+    passes[i] = numbers[i] >= min && numbers[i] <= max;
+  }
+}
+
+bool
+containsBytes(const std::byte* value,std::size_t length,const std::byte* operand,std::size_t size)
+{
+  if (0 == size) {
+    return true;
+  }
+  if (length < size) {
+    return false;
+  }
+  const char* text = reinterpret_cast<const char*>(value);
+  const char* wanted = reinterpret_cast<const char*>(operand);
+  std::size_t i = 0;
+#ifdef GROUNDUPDB_SSE2
+  // Each bit of mask is a start position whose first and last bytes both match
+  __m128i first = _mm_set1_epi8(wanted[0]);
+  __m128i last = _mm_set1_epi8(wanted[size - 1]);
+  for (;i + size + 15 <= length;i += 16) {
+    __m128i starts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+    __m128i ends = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + size - 1));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts,first),
+                                                                          _mm_cmpeq_epi8(ends,last))));
+    for (std::size_t at = i;0 != mask;mask >>= 1,at++) {
+      if ((mask & 1) && 0 == std::memcmp(text + at,wanted,size)) {
+        return true;
+      }
+    }
+  }
+#endif
+  return std::string_view(text + i,length - i).find(std::string_view(wanted,size)) != std::string_view::npos;
+}
+
+} // end anonymous namespace
+
+ValueFilter::ValueFilter(const FilterQuery& query)
+  : m_match(query.match()), m_type(query.operand().type()), m_operand(query.operand().data()),
+    m_min(query.min()), m_max(query.max()), m_field()
+{
+  if (!query.field().empty()) {
+    m_field = EncodedValue(query.field());
+  }
+}
+
+void
+ValueFilter::select(const ValueBatch& batch,std::vector<std::uint64_t>& hashes) const
+{
+  std::size_t count = batch.size();
+  const Type* types = batch.types.data();
+  const std::byte* const* data = batch.data.data();
+  const std::size_t* lengths = batch.lengths.data();
+
+  // A field is first viewed in to columns of its own, so each test below reads one column
+  std::vector<Type> fieldTypes;
+  std::vector<const std::byte*> fieldData;
+  std::vector<std::size_t> fieldLengths;
+  if (m_field) {
+    fieldTypes.assign(count,Type::UNKNOWN);
+    fieldData.assign(count,nullptr);
+    fieldLengths.assign(count,0);
+    for (std::size_t i = 0;i < count;i++) {
+      if (Type::CONTAINER != types[i]) {
+        continue;
+      }
+      std::optional<ContainerView> container = batch.view(i).asContainer();
+      std::optional<ValueView> field = container ? container->find(*m_field) : std::nullopt;
+      if (field) {
+        fieldTypes[i] = field->type();
+        fieldData[i] = field->data();
+        fieldLengths[i] = field->length();
+      }
+    }
+    types = fieldTypes.data();
+    data = fieldData.data();
+    lengths = fieldLengths.data();
+  }
+
+  std::vector<std::uint8_t> passes(count);
+  const std::byte* operand = m_operand.data();
+  std::size_t size = m_operand.size();
+  switch (m_match) {
+    case Filter::Equal:
+      for (std::size_t i = 0;i < count;i++) {
+        passes[i] = types[i] == m_type && lengths[i] == size;
+      }
+      for (std::size_t i = 0;i < count;i++) {
+        passes[i] = passes[i] && (0 == size || 0 == std::memcmp(data[i],operand,size));
+      }
+      break;
+    case Filter::Between: {
+      std::vector<double> numbers(count);
+      for (std::size_t i = 0;i < count;i++) {
+        numbers[i] = numberOf(types[i],data[i],lengths[i]);
+      }
+      betweenOf(numbers.data(),count,m_min,m_max,passes.data());
+      break;
+    }
+    case Filter::Prefix:
+      for (std::size_t i = 0;i < count;i++) {
+        passes[i] = isText(types[i]) && lengths[i] >= size;
+      }
+      for (std::size_t i = 0;i < count;i++) {
+        passes[i] = passes[i] && (0 == size || 0 == std::memcmp(data[i],operand,size));
+      }
+      break;
+    case Filter::Contains:
+      for (std::size_t i = 0;i < count;i++) {
+        passes[i] = isText(types[i]) && containsBytes(data[i],lengths[i],operand,size);
+      }
+      break;
+  }
+  for (std::size_t i = 0;i < count;i++) {
+    if (passes[i]) {
+      hashes.push_back(batch.keys[i]->hash());
+    }
+  }
+}
+
+} // end namespace
@@ -21,6 +21,11 @@ under the License.
 
 namespace groundupdb {
 
+// Hash width test mode state. See DefaultHash::setWidth
+static unsigned int s_hashWidth = 64;
+static std::size_t s_hashMask = ~std::size_t(0);
+static bool s_fingerprintMode = false;
+
 class DefaultHash::Impl {
 public:
   Impl() : m_hasher() {}
@@ -48,12 +53,12 @@ DefaultHash::~DefaultHash()
 
 std::size_t
 DefaultHash::operator() (const std::string& s) const noexcept {
-  return mImpl->m_hasher(s);
+  return narrow(mImpl->m_hasher(s));
 }
 
 std::size_t
 DefaultHash::operator() (const char* data,std::size_t length) const noexcept {
-  return mImpl->m_hasher(data,length);
+  return narrow(mImpl->m_hasher(data,length));
 }
 
 std::size_t
@@ -68,7 +73,79 @@ DefaultHash::operator() (const EncodedValue& s) const noexcept {
 
 std::size_t
 DefaultHash::operator() (const std::vector<std::byte>& bytes) const noexcept {
-  return mImpl->m_hasher(bytes);
+  return narrow(mImpl->m_hasher(bytes));
+}
+
+Fingerprint
+DefaultHash::fingerprint(const std::vector<std::byte>& bytes) const noexcept {
+  return mImpl->m_hasher.fingerprint(reinterpret_cast<const char*>(bytes.data()),bytes.size());
+}
+
+Fingerprint
+DefaultHash::fingerprint(const char* data,std::size_t length) const noexcept {
+  return mImpl->m_hasher.fingerprint(data,length);
+}
+
+void
+DefaultHash::batch(const char* const* data,const std::size_t* lengths,std::size_t count,Fingerprint* results) const noexcept {
+  mImpl->m_hasher.batch(data,lengths,count,results);
+}
+
+void
+DefaultHash::batch(const char* const* data,const std::size_t* lengths,std::size_t count,std::size_t* results) const noexcept {
+  mImpl->m_hasher.batch(data,lengths,count,results);
+  if (64 != s_hashWidth) {
+    for (std::size_t i = 0;i < count;i++) {
+      results[i] = narrow(results[i]);
+    }
+  }
+}
+
+std::vector<std::size_t>
+DefaultHash::batch(const std::vector<std::vector<std::byte>>& inputs) const {
+  std::vector<const char*> data;
+  std::vector<std::size_t> lengths;
+  data.reserve(inputs.size());
+  lengths.reserve(inputs.size());
+  for (auto& input : inputs) {
+    data.push_back(reinterpret_cast<const char*>(input.data()));
+    lengths.push_back(input.size());
+  }
+  std::vector<std::size_t> results(inputs.size());
+  batch(data.data(),lengths.data(),inputs.size(),results.data());
+  return results;
+}
+
+const DefaultHash&
+DefaultHash::standard() {
+  static const DefaultHash hasher{1, 2, 3, 4};
+  return hasher;
+}
+
+void
+DefaultHash::setWidth(unsigned int bits) noexcept {
+  s_hashWidth = (0 == bits || bits > 64) ? 64 : bits;
+  s_hashMask = (64 == s_hashWidth) ? ~std::size_t(0) : ((std::size_t(1) << s_hashWidth) - 1);
+}
+
+unsigned int
+DefaultHash::width() noexcept {
+  return s_hashWidth;
+}
+
+std::size_t
+DefaultHash::narrow(std::size_t hash) noexcept {
+  return hash & s_hashMask;
+}
+
+void
+DefaultHash::setFingerprintMode(bool enabled) noexcept {
+  s_fingerprintMode = enabled;
+}
+
+bool
+DefaultHash::fingerprintMode() noexcept {
+  return s_fingerprintMode;
 }
 
 } // end namespace
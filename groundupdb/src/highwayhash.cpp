@@ -17,45 +17,74 @@ under the License.
 */
 #include "extensions/highwayhash.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace groundupdbext {
 
 using namespace highwayhash;
 
+// Number of independent hash states batch() advances together. Keeping several
+// states in flight lets the (AVX2 where available) update rounds of different
+// keys overlap in the pipeline, rather than waiting on one key's dependency chain.
+static constexpr std::size_t kBatchLanes = 4;
+
+static inline void
+finalizeInto(HHStateT<HH_TARGET>& state,std::size_t& result) noexcept {
+  HHResult64 hash;
+  state.Finalize(&hash);
+  result = hash;
+}
+
+static inline void
+finalizeInto(HHStateT<HH_TARGET>& state,groundupdb::Fingerprint& result) noexcept {
+  HHResult128 hash;
+  state.Finalize(&hash);
+  result = groundupdb::Fingerprint{hash[0],hash[1]};
+}
+
+// Completes a hash whose state has already consumed the first offset bytes
+template <typename Out>
+static inline void
+finishHash(HHStateT<HH_TARGET>& state,const char* data,std::size_t length,std::size_t offset,Out& result) noexcept {
+  for (;offset + sizeof(HHPacket) <= length;offset += sizeof(HHPacket)) {
+    state.Update(*reinterpret_cast<const HHPacket*>(data + offset));
+  }
+  if (offset != length) {
+    state.UpdateRemainder(data + offset,length - offset);
+  }
+  finalizeInto(state,result);
+}
+
 HighwayHash::HighwayHash()
-  : m_key{1,2,3,4},
-    m_hh(new HighwayHashCatT<HH_TARGET>(m_key)),
-    m_result(new HHResult64())
+  : m_key{1,2,3,4}
 {
   ;
 }
 
 HighwayHash::HighwayHash(std::uint64_t s1,std::uint64_t s2,std::uint64_t s3,std::uint64_t s4)
-  : m_key{s1,s2,s3,s4},
-    m_hh(new HighwayHashCatT<HH_TARGET>(m_key)),
-    m_result(new HHResult64())
+  : m_key{s1,s2,s3,s4}
 {
   ;
 }
 
 HighwayHash::~HighwayHash() {
-  //delete m_hh;
-  //delete m_result; // for windows - why does this help???
+  ;
 }
 
 std::size_t
 HighwayHash::operator() (std::string const& s) const noexcept {
-  m_hh->Reset(m_key);
-  m_hh->Append(s.c_str(), s.length());
-  m_hh->Finalize(m_result);
-  return *m_result;
+  return (*this)(s.data(),s.length());
 }
 
+// The hash state lives on the stack, so hashing never allocates and one
+// HighwayHash can be shared between threads
 std::size_t
 HighwayHash::operator() (const char* data,std::size_t length) const noexcept {
-  m_hh->Reset(m_key);
-  m_hh->Append(data, length);
-  m_hh->Finalize(m_result);
-  return *m_result;
+  HHStateT<HH_TARGET> state(m_key);
+  std::size_t result;
+  finishHash(state,data,length,0,result);
+  return result;
 }
 
 std::size_t
@@ -72,12 +101,62 @@ HighwayHash::operator() (const groundupdb::EncodedValue& data) const noexcept {
 
 std::size_t
 HighwayHash::operator() (const groundupdb::Bytes& data) const noexcept {
-  m_hh->Reset(m_key);
-  for (auto iter = data.begin();iter != data.end();++iter) {
-    m_hh->Append((const char*)&*iter,sizeof(*iter));
+  return (*this)(reinterpret_cast<const char*>(data.data()),data.size());
+}
+
+groundupdb::Fingerprint
+HighwayHash::fingerprint(const char* data,std::size_t length) const noexcept {
+  HHStateT<HH_TARGET> state(m_key);
+  groundupdb::Fingerprint result;
+  finishHash(state,data,length,0,result);
+  return result;
+}
+
+void
+HighwayHash::batch(const char* const* data,const std::size_t* lengths,std::size_t count,std::size_t* results) const noexcept {
+  batchImpl(data,lengths,count,results);
+}
+
+void
+HighwayHash::batch(const char* const* data,const std::size_t* lengths,std::size_t count,groundupdb::Fingerprint* results) const noexcept {
+  batchImpl(data,lengths,count,results);
+}
+
+template <typename Out>
+void
+HighwayHash::batchImpl(const char* const* data,const std::size_t* lengths,std::size_t count,Out* results) const noexcept {
+  // Order inputs by length so each group of lanes shares as many whole packets as possible
+  std::vector<std::size_t> order(count);
+  for (std::size_t i = 0;i < count;i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(),order.end(),[lengths] (std::size_t a,std::size_t b) {
+    return lengths[a] < lengths[b];
+  });
+
+  std::size_t next = 0;
+  for (;next + kBatchLanes <= count;next += kBatchLanes) {
+    const std::size_t* lane = &order[next];
+    HHStateT<HH_TARGET> states[kBatchLanes] = {
+      HHStateT<HH_TARGET>(m_key),HHStateT<HH_TARGET>(m_key),
+      HHStateT<HH_TARGET>(m_key),HHStateT<HH_TARGET>(m_key)
+    };
+    // sorted, so the first lane is the shortest in the group
+    const std::size_t shared = lengths[lane[0]] & ~(sizeof(HHPacket) - 1);
+    for (std::size_t offset = 0;offset < shared;offset += sizeof(HHPacket)) {
+      for (std::size_t l = 0;l < kBatchLanes;l++) {
+        states[l].Update(*reinterpret_cast<const HHPacket*>(data[lane[l]] + offset));
+      }
+    }
+    for (std::size_t l = 0;l < kBatchLanes;l++) {
+      finishHash(states[l],data[lane[l]],lengths[lane[l]],shared,results[lane[l]]);
+    }
+  }
+  // Scalar fallback for whatever doesn't fill a whole group
+  for (;next < count;next++) {
+    HHStateT<HH_TARGET> state(m_key);
+    finishHash(state,data[order[next]],lengths[order[next]],0,results[order[next]]);
   }
-  m_hh->Finalize(m_result);
-  return *m_result;
 }
 
 }
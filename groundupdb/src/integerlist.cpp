@@ -0,0 +1,224 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "integerlist.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace groundupdb {
+
+void
+encodeVarint(Bytes& out,std::uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(static_cast<std::byte>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<std::byte>(value));
+}
+
+std::optional<std::uint64_t>
+decodeVarint(const std::byte*& in,const std::byte* end)
+{
+  std::uint64_t value = 0;
+  for (unsigned shift = 0;shift < 64 && in != end;shift += 7) {
+    std::uint64_t b = static_cast<std::uint64_t>(*in++);
+    value |= (b & 0x7F) << shift;
+    if (0 == (b & 0x80)) {
+      return value;
+    }
+  }
+  return {};
+}
+
+static unsigned
+bitWidth(std::uint64_t value)
+{
+  unsigned bits = 0;
+  for (;0 != value;value >>= 1) {
+    bits++;
+  }
+  return bits;
+}
+
+static std::size_t
+wordsFor(std::size_t count,unsigned bits)
+{
+  return (count * bits + 63) / 64;
+}
+
+// Words a block of count values takes: each lane holds every other value
+static std::size_t
+blockWords(std::size_t count,unsigned bits)
+{
+  return 2 * wordsFor((count + 1) / 2,bits);
+}
+
+// Packs count values, bits each, onto out. Even values go to lane 0 and odd to lane 1, and
+// the lanes' words alternate, so both lanes are unpacked together with the same shifts.
+static void
+packBlock(Bytes& out,const std::uint64_t* values,std::size_t count,unsigned bits)
+{
+  std::uint64_t words[IntegerList::kBlockSize + 2] = {0};
+  for (std::size_t i = 0;i < count;i++) {
+    std::size_t bit = (i / 2) * bits;
+    std::size_t word = 2 * (bit / 64) + i % 2;
+    words[word] |= values[i] << (bit % 64);
+    // (x >> 1) >> (63 - shift) is x >> (64 - shift), without an undefined shift by 64 when shift is 0
+    words[word + 2] |= (values[i] >> 1) >> (63 - bit % 64);
+  }
+  for (std::size_t w = 0;w < blockWords(count,bits);w++) {
+    encodeLittleEndian(out,words[w]);
+  }
+}
+
+// Unpacks an even count of values of bits each. The caller guarantees words has a spare word
+// for each lane at the end.
+static void
+unpackBlock(const std::uint64_t* words,std::size_t count,unsigned bits,std::uint64_t* values)
+{
+  const std::uint64_t mask = 64 == bits ? ~std::uint64_t(0) : (std::uint64_t(1) << bits) - 1;
+#ifdef GROUNDUPDB_SSE2
+  // One value from each lane per step. SSE2 shifts by 64 give zero, so no special case is needed.
+  const __m128i lanesMask = _mm_set1_epi64x(static_cast<long long>(mask));
+  for (std::size_t j = 0;j < count / 2;j++) {
+    std::size_t bit = j * bits;
+    const __m128i* at = reinterpret_cast<const __m128i*>(words + 2 * (bit / 64));
+    __m128i low = _mm_srl_epi64(_mm_loadu_si128(at),_mm_cvtsi32_si128(static_cast<int>(bit % 64)));
+    __m128i high = _mm_sll_epi64(_mm_loadu_si128(at + 1),_mm_cvtsi32_si128(static_cast<int>(64 - bit % 64)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(values + 2 * j),_mm_and_si128(_mm_or_si128(low,high),lanesMask));
+  }
+#else
+  // Each value spans at most two words of its lane, so is read with two shifts and no branches
+  for (std::size_t i = 0;i < count;i++) {
+    std::size_t bit = (i / 2) * bits;
+    std::size_t shift = bit % 64;
+    std::size_t word = 2 * (bit / 64) + i % 2;
+    values[i] = ((words[word] >> shift) | ((words[word + 2] << 1) << (63 - shift))) & mask;
+  }
+#endif
+}
+
+// Replaces deltas with their running total, starting from running. Returns the new total.
+static std::uint64_t
+prefixSum(std::uint64_t* values,std::size_t count,std::uint64_t running)
+{
+  std::size_t i = 0;
+#ifdef GROUNDUPDB_SSE2
+  // Two values at once: add the low lane in to the high one, then the total so far to both
+  __m128i carry = _mm_set1_epi64x(static_cast<long long>(running));
+  for (;i + 2 <= count;i += 2) {
+    __m128i* at = reinterpret_cast<__m128i*>(values + i);
+    __m128i pair = _mm_loadu_si128(at);
+    pair = _mm_add_epi64(_mm_add_epi64(pair,_mm_slli_si128(pair,8)),carry);
+    _mm_storeu_si128(at,pair);
+    carry = _mm_shuffle_epi32(pair,_MM_SHUFFLE(3,2,3,2));
+  }
+  if (0 != i) {
+    running = values[i - 1];
+  }
+#endif
+  for (;i < count;i++) {
+    running += values[i];
+    values[i] = running;
+  }
+  return running;
+}
+
+void
+IntegerList::encode(Bytes& out,const std::vector<std::uint64_t>& values)
+{
+  const bool sorted = std::is_sorted(values.begin(),values.end());
+  encodeVarint(out,sorted ? 1 : 0);
+  encodeVarint(out,values.size());
+
+  std::uint64_t block[kBlockSize];
+  std::uint64_t previous = 0;
+  for (std::size_t start = 0;start < values.size();start += kBlockSize) {
+    std::size_t count = std::min(kBlockSize,values.size() - start);
+    std::uint64_t all = 0; // OR of every value, to find the widest
+    for (std::size_t i = 0;i < count;i++) {
+      block[i] = sorted ? values[start + i] - previous : values[start + i];
+      previous = values[start + i];
+      all |= block[i];
+    }
+    unsigned bits = bitWidth(all);
+    out.push_back(static_cast<std::byte>(bits));
+    packBlock(out,block,count,bits);
+  }
+}
+
+std::optional<std::vector<std::uint64_t>>
+IntegerList::decode(const std::byte* data,std::size_t length)
+{
+  const std::byte* in = data;
+  const std::byte* end = data + length;
+  auto flags = decodeVarint(in,end);
+  auto count = decodeVarint(in,end);
+  // every block takes at least its width byte, so a huge count is corrupt rather than a huge allocation
+  if (!flags || !count || *count > static_cast<std::size_t>(end - in) * kBlockSize) {
+    return {};
+  }
+  std::vector<std::uint64_t> values(*count);
+  std::uint64_t words[kBlockSize + 2] = {0};
+  std::uint64_t last[kBlockSize]; // a short final block, unpacked whole then copied
+  std::uint64_t running = 0;
+  for (std::size_t start = 0;start < values.size();start += kBlockSize) {
+    std::size_t n = std::min(kBlockSize,values.size() - start);
+    if (in == end) {
+      return {};
+    }
+    unsigned bits = static_cast<unsigned>(*in++);
+    std::size_t used = blockWords(n,bits);
+    if (bits > 64 || static_cast<std::size_t>(end - in) < used * sizeof(std::uint64_t)) {
+      return {};
+    }
+    for (std::size_t w = 0;w < used;w++) {
+      words[w] = decodeLittleEndian<std::uint64_t>(in + w * sizeof(std::uint64_t));
+    }
+    words[used] = 0; // the spare words unpackBlock may read
+    words[used + 1] = 0;
+    in += used * sizeof(std::uint64_t);
+    if (0 == n % 2) {
+      unpackBlock(words,n,bits,values.data() + start);
+    } else {
+      unpackBlock(words,n + 1,bits,last);
+      std::memcpy(values.data() + start,last,n * sizeof(std::uint64_t));
+    }
+    if (0 != (*flags & 1)) {
+      // summed while the block is still in cache
+      running = prefixSum(values.data() + start,n,running);
+    }
+  }
+  return values;
+}
+
+void
+encodeIntegers(Bytes& out,const std::vector<std::uint64_t>& values)
+{
+  IntegerList::encode(out,values);
+}
+
+EncodedValue
+compactIntegers(const std::vector<std::uint64_t>& values)
+{
+  return EncodedValue(values);
+}
+
+} // end namespace
@@ -18,34 +18,152 @@ under the License.
 #include "extensions/extdatabase.h"
 #include "extensions/highwayhash.h"
 
+#include <algorithm>
+#include <set>
 #include <unordered_map>
 #include <optional>
+#include <type_traits>
 
 namespace groundupdbext {
 
+// The key hash is already computed, so use it as is
+struct PrecomputedHash {
+  std::size_t operator()(std::size_t hash) const noexcept { return hash; }
+};
+
+// Orders keys by their raw bytes, so keys sharing a prefix are adjacent
+struct ByteOrder {
+  using is_transparent = void;
+  bool operator()(const HashedValue& a,const HashedValue& b) const { return a.data() < b.data(); }
+  bool operator()(const HashedValue& a,const Bytes& b) const { return a.data() < b; }
+  bool operator()(const Bytes& a,const HashedValue& b) const { return a < b.data(); }
+};
+
 class MemoryKeyValueStore::Impl {
 public:
-  Impl();
-  Impl(std::unique_ptr<KeyValueStore>& toCache);
+  Impl(bool orderedKeys);
+  Impl(std::unique_ptr<KeyValueStore>& toCache,bool orderedKeys);
+
+  // Entries are indexed by key hash, then matched by key, so that a KeyView
+  // can be looked up without first building a HashedValue, and all keys with
+  // a given hash can be listed
+  template <typename V>
+  struct Entry {
+    HashedValue key;
+    V value;
+  };
+  template <typename V>
+  using HashIndexed = std::unordered_multimap<std::size_t,Entry<V>,PrecomputedHash>;
+  using ValueMap = HashIndexed<EncodedValue>;
+  using SetMap = HashIndexed<Set>;
+
+  template <typename Map,typename KeyType>
+  static typename Map::iterator find(Map& map,const KeyType& key);
+  void insert(const HashedValue& key,const EncodedValue& value);
+  // Returns the in memory set for key, first loading it from the cached store if needed.
+  // If create is false, a set that is not stored anywhere gives m_listStore.end().
+  SetMap::iterator loadSet(const HashedValue& key,bool create = true);
+
+  // Emplaces a new entry, also adding its key to the ordered keys if kept
+  template <typename Map,typename V>
+  typename Map::iterator emplace(Map& map,const HashedValue& key,V&& value);
+  // key with its bytes, read from the cached store if only its fingerprint is held here
+  HashedValue wholeKey(const HashedValue& key);
 
-  std::unordered_map<HashedValue,EncodedValue,HighwayHash> m_keyValueStore;
-  std::unordered_map<HashedValue,Set,HighwayHash> m_listStore;
+  ValueMap m_keyValueStore;
+  SetMap m_listStore;
   std::optional<std::unique_ptr<KeyValueStore>> m_cachedStore;
+  // Whole keys (the maps above may hold only fingerprints)
+  std::optional<std::set<HashedValue,ByteOrder>> m_orderedKeys;
 
 private:
 
 };
 
-MemoryKeyValueStore::Impl::Impl()
-  : m_keyValueStore(), m_listStore(), m_cachedStore()
+MemoryKeyValueStore::Impl::Impl(bool orderedKeys)
+  : m_keyValueStore(), m_listStore(), m_cachedStore(), m_orderedKeys()
 {
-  ;
+  if (orderedKeys) {
+    m_orderedKeys.emplace();
+  }
 }
 
-MemoryKeyValueStore::Impl::Impl(std::unique_ptr<KeyValueStore>& toCache)
-  : m_keyValueStore(), m_listStore(), m_cachedStore(toCache.release())
+MemoryKeyValueStore::Impl::Impl(std::unique_ptr<KeyValueStore>& toCache,bool orderedKeys)
+  : m_keyValueStore(), m_listStore(), m_cachedStore(toCache.release()), m_orderedKeys()
 {
-  ;
+  if (orderedKeys) {
+    m_orderedKeys.emplace();
+  }
+}
+
+template <typename Map,typename V>
+typename Map::iterator
+MemoryKeyValueStore::Impl::emplace(Map& map,const HashedValue& key,V&& value)
+{
+  if (m_orderedKeys) {
+    m_orderedKeys->insert(key);
+  }
+  // In fingerprint mode only the fingerprint is held in the map, not the key bytes, when the
+  // cached store holds those bytes. Without a cached store this map is the only copy of the key.
+  using Value = typename Map::mapped_type;
+  return map.emplace(key.hash(),Value{m_cachedStore ? key.fingerprintOnly() : key,std::forward<V>(value)});
+}
+
+HashedValue
+MemoryKeyValueStore::Impl::wholeKey(const HashedValue& key)
+{
+  if (!m_cachedStore || key.data().size() == key.length()) {
+    return key;
+  }
+  for (auto& stored : m_cachedStore->get()->keysForHash(key.hash())) {
+    if (stored == key) {
+      return stored;
+    }
+  }
+  return key;
+}
+
+template <typename Map,typename KeyType>
+typename Map::iterator
+MemoryKeyValueStore::Impl::find(Map& map,const KeyType& key)
+{
+  auto range = map.equal_range(key.hash());
+  for (auto iter = range.first;iter != range.second;++iter) {
+    if constexpr (std::is_same_v<KeyType,KeyView>) {
+      if (key.matches(iter->second.key)) {
+        return iter;
+      }
+    } else if (iter->second.key == key) {
+      return iter;
+    }
+  }
+  return map.end();
+}
+
+void
+MemoryKeyValueStore::Impl::insert(const HashedValue& key,const EncodedValue& value)
+{
+  auto existing = find(m_keyValueStore,key);
+  if (existing != m_keyValueStore.end()) {
+    existing->second.value = value;
+    return;
+  }
+  emplace(m_keyValueStore,key,value);
+}
+
+MemoryKeyValueStore::Impl::SetMap::iterator
+MemoryKeyValueStore::Impl::loadSet(const HashedValue& key,bool create)
+{
+  auto existing = find(m_listStore,key);
+  if (existing != m_listStore.end()) {
+    return existing;
+  }
+  Set loaded = m_cachedStore ? m_cachedStore->get()->getKeyValueSet(key)
+                             : std::make_unique<std::unordered_set<EncodedValue>>();
+  if (!create && loaded->empty()) {
+    return m_listStore.end();
+  }
+  return emplace(m_listStore,key,std::move(loaded));
 }
 
 
@@ -54,17 +172,35 @@ MemoryKeyValueStore::Impl::Impl(std::unique_ptr<KeyValueStore>& toCache)
 
 
 MemoryKeyValueStore::MemoryKeyValueStore()
-  : mImpl(std::make_unique<MemoryKeyValueStore::Impl>())
+  : MemoryKeyValueStore(false)
+{
+  ;
+}
+
+MemoryKeyValueStore::MemoryKeyValueStore(bool orderedKeys)
+  : mImpl(std::make_unique<MemoryKeyValueStore::Impl>(orderedKeys))
 {
   ;
 }
 
 MemoryKeyValueStore::MemoryKeyValueStore(std::unique_ptr<KeyValueStore>& toCache)
-  : mImpl(std::make_unique<MemoryKeyValueStore::Impl>(toCache))
+  : MemoryKeyValueStore(toCache,false)
+{
+  ;
+}
+
+MemoryKeyValueStore::MemoryKeyValueStore(std::unique_ptr<KeyValueStore>& toCache,bool orderedKeys)
+  : mImpl(std::make_unique<MemoryKeyValueStore::Impl>(toCache,orderedKeys))
 {
   mImpl->m_cachedStore->get()->loadKeysInto([this](const HashedValue& key,EncodedValue value) {
-    mImpl->m_keyValueStore.insert({key,value});
+    mImpl->insert(key,value);
   });
+  if (mImpl->m_orderedKeys) {
+    // Sets are not loaded until used, but their keys must still be listed
+    for (auto& key : mImpl->m_cachedStore->get()->keysInRange(Bytes(),Bytes())) {
+      mImpl->m_orderedKeys->insert(std::move(key));
+    }
+  }
 }
 
 
@@ -78,9 +214,7 @@ void
 MemoryKeyValueStore::setKeyValue(const HashedValue& key,EncodedValue&& value)
 {
   // Also write to our in-memory unordered map
-  // Note: insert on unordered_map does NOT perform an insert if the key already exists
-  mImpl->m_keyValueStore.erase(key);
-  mImpl->m_keyValueStore.insert({key,value});
+  mImpl->insert(key,value);
   if (mImpl->m_cachedStore) {
     mImpl->m_cachedStore->get()->setKeyValue(key,EncodedValue(value)); // force copy construction of a temporary
   }
@@ -90,19 +224,32 @@ EncodedValue
 MemoryKeyValueStore::getKeyValue(const HashedValue& key)
 {
   // Only ever read from our in memory map!
-  const auto& v = mImpl->m_keyValueStore.find(key);
+  const auto& v = mImpl->find(mImpl->m_keyValueStore,key);
   if (v == mImpl->m_keyValueStore.end()) {
     return EncodedValue(); // Now provides an empty value with hasValue() == false
     // TODO make the above more efficient - no construct-then-copy
   }
-  return v->second;
+  return v->second.value;
+}
+
+EncodedValue
+MemoryKeyValueStore::getKeyValue(const KeyView& key)
+{
+  // As above, but a miss allocates nothing
+  const auto& v = mImpl->find(mImpl->m_keyValueStore,key);
+  if (v == mImpl->m_keyValueStore.end()) {
+    return EncodedValue();
+  }
+  return v->second.value;
 }
 
 
 void
 MemoryKeyValueStore::setKeyValue(const HashedValue& key,const Set& value) {
-  // Note: insert on unordered_map does NOT perform an insert if the key already exists
-  mImpl->m_listStore.erase(key);
+  auto existing = mImpl->find(mImpl->m_listStore,key);
+  if (existing != mImpl->m_listStore.end()) {
+    mImpl->m_listStore.erase(existing);
+  }
   Set newvalue = std::make_unique<std::unordered_set<EncodedValue>>(); // WARNING: MUST use make_unique here!
 
   //std::cout << "MEMKVS: Inserting set values in to copy of set" << std::endl;
@@ -111,7 +258,7 @@ MemoryKeyValueStore::setKeyValue(const HashedValue& key,const Set& value) {
   //std::cout << "MEMKVS: Set size now: " << newvalue->size() << std::endl;
   //mImpl->m_listStore.insert({key,newvalue}); // STD LIB bug. See https://stackoverflow.com/questions/14808663/stdunordered-mapemplace-issue-with-private-deleted-copy-constructor
   //std::cout << "MEMKVS: emplacing new set" << std::endl;
-  mImpl->m_listStore.emplace(key,std::forward<Set>(newvalue));
+  mImpl->emplace(mImpl->m_listStore,key,std::move(newvalue));
   //mImpl->m_listStore.emplace(key,value);
   //std::cout << "MEMKVS: Checking cache" << std::endl;
   if (mImpl->m_cachedStore) {
@@ -122,7 +269,7 @@ MemoryKeyValueStore::setKeyValue(const HashedValue& key,const Set& value) {
 
 Set
 MemoryKeyValueStore::getKeyValueSet(const HashedValue& key) {
-  const auto& v = mImpl->m_listStore.find(key);
+  const auto& v = mImpl->find(mImpl->m_listStore,key);
   //std::cout << "MEMKVS: getKeyValueSet" << std::endl;
   if (v == mImpl->m_listStore.end()) {
     //std::cout << "  MEMKVS: not found in memory" << std::endl;
@@ -136,22 +283,163 @@ MemoryKeyValueStore::getKeyValueSet(const HashedValue& key) {
   }
   //std::cout << "  MEMKVS: returning Set with size: " << v->second->size() << std::endl;
   // Note we dereference the below because v->second is an unorderedmap hashedvalue wrapper, and not the Set value itself
-  return std::make_unique<std::unordered_set<EncodedValue>>(*(v->second)); // copy ctor
+  return std::make_unique<std::unordered_set<EncodedValue>>(*(v->second.value)); // copy ctor
+}
+
+void
+MemoryKeyValueStore::addToKeyValueSet(const HashedValue& key,EncodedValue&& member)
+{
+  // Only the new member is passed on, so the cached store can append rather than rewrite
+  auto set = mImpl->loadSet(key);
+  if (!set->second.value->insert(member).second) {
+    return; // already a member
+  }
+  if (mImpl->m_cachedStore) {
+    mImpl->m_cachedStore->get()->addToKeyValueSet(key,std::move(member));
+  }
+}
+
+void
+MemoryKeyValueStore::removeFromKeyValueSet(const HashedValue& key,const EncodedValue& member)
+{
+  auto set = mImpl->loadSet(key);
+  if (0 == set->second.value->erase(member)) {
+    return; // not a member
+  }
+  if (mImpl->m_cachedStore) {
+    mImpl->m_cachedStore->get()->removeFromKeyValueSet(key,member);
+  }
+}
+
+bool
+MemoryKeyValueStore::hasKey(const KeyView& key)
+{
+  if (mImpl->find(mImpl->m_keyValueStore,key) != mImpl->m_keyValueStore.end() ||
+      mImpl->find(mImpl->m_listStore,key) != mImpl->m_listStore.end()) {
+    return true;
+  }
+  // Every value is held in memory, but sets are only loaded when first used
+  return mImpl->m_cachedStore && mImpl->m_cachedStore->get()->hasKey(key);
+}
+
+std::size_t
+MemoryKeyValueStore::keyValueSetSize(const HashedValue& key)
+{
+  auto set = mImpl->loadSet(key,false);
+  return set == mImpl->m_listStore.end() ? 0 : set->second.value->size();
+}
+
+bool
+MemoryKeyValueStore::keyValueSetContains(const HashedValue& key,const EncodedValue& member)
+{
+  auto set = mImpl->loadSet(key,false);
+  return set != mImpl->m_listStore.end() && 0 != set->second.value->count(member);
+}
+
+std::vector<HashedValue>
+MemoryKeyValueStore::keysForHash(std::size_t hash)
+{
+  std::vector<HashedValue> keys;
+  bool whole = true;
+  auto values = mImpl->m_keyValueStore.equal_range(hash);
+  for (auto iter = values.first;iter != values.second;++iter) {
+    keys.push_back(iter->second.key);
+    whole = whole && iter->second.key.data().size() == iter->second.key.length();
+  }
+  auto sets = mImpl->m_listStore.equal_range(hash);
+  for (auto iter = sets.first;iter != sets.second;++iter) {
+    keys.push_back(iter->second.key);
+    whole = whole && iter->second.key.data().size() == iter->second.key.length();
+  }
+  // Only go to the underlying store when needed: for sets not loaded in to memory, or for
+  // the bytes of keys held here only by fingerprint
+  if ((keys.empty() || !whole) && mImpl->m_cachedStore) {
+    return mImpl->m_cachedStore->get()->keysForHash(hash);
+  }
+  return keys;
+}
+
+std::vector<HashedValue>
+MemoryKeyValueStore::keysInRange(const Bytes& from,const Bytes& to)
+{
+  std::vector<HashedValue> keys;
+  if (mImpl->m_orderedKeys) {
+    auto end = to.empty() ? mImpl->m_orderedKeys->end() : mImpl->m_orderedKeys->lower_bound(to);
+    for (auto iter = mImpl->m_orderedKeys->lower_bound(from);iter != end;++iter) {
+      keys.push_back(*iter);
+    }
+    return keys;
+  }
+  // The cached store holds every key, including sets not yet loaded here
+  if (mImpl->m_cachedStore) {
+    return mImpl->m_cachedStore->get()->keysInRange(from,to);
+  }
+  // Without a cached store every key is held whole, even in fingerprint mode, so has bytes to compare
+  auto inRange = [&from,&to](const HashedValue& key) {
+    return !(key.data() < from) && (to.empty() || key.data() < to);
+  };
+  for (auto& element : mImpl->m_keyValueStore) {
+    if (inRange(element.second.key)) {
+      keys.push_back(element.second.key);
+    }
+  }
+  for (auto& element : mImpl->m_listStore) {
+    if (inRange(element.second.key)) {
+      keys.push_back(element.second.key);
+    }
+  }
+  std::sort(keys.begin(),keys.end(),ByteOrder());
+  return keys;
+}
+
+void
+MemoryKeyValueStore::loadEntriesInto(const std::vector<std::uint64_t>& hashes,
+                                     std::function<void(const HashedValue& key,EncodedValue value)> callback)
+{
+  // Every value is already in memory, so the cached store is only needed for the bytes of
+  // keys held here by fingerprint
+  for (auto hash : hashes) {
+    auto values = mImpl->m_keyValueStore.equal_range(hash);
+    for (auto iter = values.first;iter != values.second;++iter) {
+      callback(mImpl->wholeKey(iter->second.key),iter->second.value);
+    }
+  }
 }
 
 void
 MemoryKeyValueStore::loadKeysInto(std::function<void(const HashedValue& key,EncodedValue value)> callback)
 {
-  for (auto element : mImpl->m_keyValueStore) {
-    callback(element.first,element.second);
+  for (auto& element : mImpl->m_keyValueStore) {
+    callback(element.second.key,element.second.value);
   }
   // TODO load indexes too???
 }
 
+void
+MemoryKeyValueStore::scanValues(std::function<void(const ValueBatch& batch)> callback)
+{
+  // Lends the stored values themselves, so nothing is copied
+  ValueBatch batch;
+  for (auto& element : mImpl->m_keyValueStore) {
+    batch.add(element.second.key,element.second.value);
+    if (kScanBatchSize == batch.size()) {
+      callback(batch);
+      batch.clear();
+    }
+  }
+  if (0 != batch.size()) {
+    callback(batch);
+  }
+}
+
 void
 MemoryKeyValueStore::clear()
 {
   mImpl->m_keyValueStore.clear();
+  mImpl->m_listStore.clear();
+  if (mImpl->m_orderedKeys) {
+    mImpl->m_orderedKeys->clear();
+  }
   if (mImpl->m_cachedStore) {
     mImpl->m_cachedStore->get()->clear();
   }
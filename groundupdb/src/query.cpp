@@ -19,11 +19,37 @@ under the License.
 #include "types.h"
 #include "extensions/extquery.h"
 
+#include <algorithm>
+#include <limits>
 #include <string>
 
 using namespace groundupdb;
 using namespace groundupdbext;
 
+namespace {
+
+void
+appendPlan(std::string& out,const QueryPlan& plan,std::size_t depth)
+{
+  std::string estimate = (std::numeric_limits<std::size_t>::max() == plan.estimatedKeys) ? "unknown" :
+                         std::to_string(plan.estimatedKeys);
+  out += std::string(depth * 2,' ') + plan.operation + " (" + plan.strategy + ") estimated " +
+         estimate + ", actual " + std::to_string(plan.actualKeys) + "\n";
+  for (auto& clause : plan.clauses) {
+    appendPlan(out,clause,depth + 1);
+  }
+}
+
+}
+
+std::string
+QueryPlan::toString() const
+{
+  std::string out;
+  appendPlan(out,*this,0);
+  return out;
+}
+
 class BucketQuery::Impl {
 public:
   Impl(std::string& bucket);
@@ -54,8 +80,363 @@ BucketQuery::bucket() const {
 }
 
 
+class ValueQuery::Impl {
+public:
+  Impl(const std::string& index,EncodedValue&& value);
+  ~Impl() = default;
+  std::string m_index;
+  EncodedValue m_value;
+};
+
+ValueQuery::Impl::Impl(const std::string& index,EncodedValue&& value)
+  : m_index(index), m_value(std::move(value))
+{
+  ;
+}
+
+ValueQuery::ValueQuery(const std::string& index,EncodedValue value)
+  : mImpl(std::make_unique<Impl>(index,std::move(value)))
+{
+  ;
+}
+
+ValueQuery::~ValueQuery()
+{
+  ;
+}
+
+std::string
+ValueQuery::index() const {
+  return mImpl->m_index;
+}
+
+const EncodedValue&
+ValueQuery::value() const {
+  return mImpl->m_value;
+}
+
+class RangeQuery::Impl {
+public:
+  Impl(const std::string& index,double min,double max,std::size_t limit,bool descending);
+  ~Impl() = default;
+  std::string m_index;
+  double m_min;
+  double m_max;
+  std::size_t m_limit;
+  bool m_descending;
+};
+
+RangeQuery::Impl::Impl(const std::string& index,double min,double max,std::size_t limit,bool descending)
+  : m_index(index), m_min(min), m_max(max), m_limit(limit), m_descending(descending)
+{
+  ;
+}
+
+RangeQuery::RangeQuery(const std::string& index,double min,double max)
+  : mImpl(std::make_unique<Impl>(index,min,max,std::numeric_limits<std::size_t>::max(),false))
+{
+  ;
+}
+
+RangeQuery::RangeQuery(const std::string& index,double min,double max,std::size_t limit,bool descending)
+  : mImpl(std::make_unique<Impl>(index,min,max,limit,descending))
+{
+  ;
+}
+
+RangeQuery::~RangeQuery()
+{
+  ;
+}
+
+std::string
+RangeQuery::index() const {
+  return mImpl->m_index;
+}
+
+double
+RangeQuery::min() const {
+  return mImpl->m_min;
+}
+
+double
+RangeQuery::max() const {
+  return mImpl->m_max;
+}
+
+std::size_t
+RangeQuery::limit() const {
+  return mImpl->m_limit;
+}
+
+bool
+RangeQuery::descending() const {
+  return mImpl->m_descending;
+}
+
+class TextQuery::Impl {
+public:
+  Impl(const std::string& index,const std::string& text);
+  ~Impl() = default;
+  std::string m_index;
+  std::string m_text;
+};
+
+TextQuery::Impl::Impl(const std::string& index,const std::string& text)
+  : m_index(index), m_text(text)
+{
+  ;
+}
+
+TextQuery::TextQuery(const std::string& index,const std::string& text)
+  : mImpl(std::make_unique<Impl>(index,text))
+{
+  ;
+}
+
+TextQuery::~TextQuery()
+{
+  ;
+}
+
+std::string
+TextQuery::index() const {
+  return mImpl->m_index;
+}
+
+std::string
+TextQuery::text() const {
+  return mImpl->m_text;
+}
+
+class PhraseQuery::Impl {
+public:
+  Impl(const std::string& index,const std::string& phrase);
+  ~Impl() = default;
+  std::string m_index;
+  std::string m_phrase;
+};
+
+PhraseQuery::Impl::Impl(const std::string& index,const std::string& phrase)
+  : m_index(index), m_phrase(phrase)
+{
+  ;
+}
+
+PhraseQuery::PhraseQuery(const std::string& index,const std::string& phrase)
+  : mImpl(std::make_unique<Impl>(index,phrase))
+{
+  ;
+}
+
+PhraseQuery::~PhraseQuery()
+{
+  ;
+}
+
+std::string
+PhraseQuery::index() const {
+  return mImpl->m_index;
+}
+
+std::string
+PhraseQuery::phrase() const {
+  return mImpl->m_phrase;
+}
+
+class FilterQuery::Impl {
+public:
+  Impl(Filter match,EncodedValue operand,double min,double max,const std::string& field);
+  ~Impl() = default;
+  Filter m_match;
+  EncodedValue m_operand;
+  double m_min;
+  double m_max;
+  std::string m_field;
+};
+
+FilterQuery::Impl::Impl(Filter match,EncodedValue operand,double min,double max,const std::string& field)
+  : m_match(match), m_operand(operand), m_min(min), m_max(max), m_field(field)
+{
+  ;
+}
+
+// A Between operand is its own min and max
+static double
+boundOf(const EncodedValue& operand)
+{
+  if (auto number = operand.asDouble()) {
+    return *number;
+  }
+  if (auto number = operand.asInt64()) {
+    return static_cast<double>(*number);
+  }
+  if (auto number = operand.asUInt64()) {
+    return static_cast<double>(*number);
+  }
+  return std::numeric_limits<double>::quiet_NaN(); // matches nothing
+}
+
+FilterQuery::FilterQuery(Filter match,EncodedValue operand,const std::string& field)
+  : mImpl(std::make_unique<Impl>(match,operand,boundOf(operand),boundOf(operand),field))
+{
+  ;
+}
+
+FilterQuery::FilterQuery(double min,double max,const std::string& field)
+  : mImpl(std::make_unique<Impl>(Filter::Between,EncodedValue(),min,max,field))
+{
+  ;
+}
+
+FilterQuery::~FilterQuery()
+{
+  ;
+}
+
+Filter
+FilterQuery::match() const {
+  return mImpl->m_match;
+}
+
+const EncodedValue&
+FilterQuery::operand() const {
+  return mImpl->m_operand;
+}
+
+double
+FilterQuery::min() const {
+  return mImpl->m_min;
+}
+
+double
+FilterQuery::max() const {
+  return mImpl->m_max;
+}
+
+std::string
+FilterQuery::field() const {
+  return mImpl->m_field;
+}
+
+// Each bucket name becomes a BucketQuery clause
+static std::vector<std::unique_ptr<Query>>
+bucketClauses(const std::vector<std::string>& buckets) {
+  std::vector<std::unique_ptr<Query>> clauses;
+  for (auto bucket : buckets) {
+    clauses.push_back(std::make_unique<BucketQuery>(bucket));
+  }
+  return clauses;
+}
+
+class AndQuery::Impl {
+public:
+  Impl(std::vector<std::unique_ptr<Query>>&& clauses);
+  ~Impl() = default;
+  std::vector<std::unique_ptr<Query>> m_clauses;
+};
+
+AndQuery::Impl::Impl(std::vector<std::unique_ptr<Query>>&& clauses)
+  : m_clauses(std::move(clauses))
+{
+  ;
+}
+
+AndQuery::AndQuery(std::vector<std::unique_ptr<Query>>&& clauses)
+  : mImpl(std::make_unique<Impl>(std::move(clauses)))
+{
+  ;
+}
+
+AndQuery::AndQuery(const std::vector<std::string>& buckets)
+  : mImpl(std::make_unique<Impl>(bucketClauses(buckets)))
+{
+  ;
+}
+
+AndQuery::~AndQuery()
+{
+  ;
+}
+
+const std::vector<std::unique_ptr<Query>>&
+AndQuery::clauses() const {
+  return mImpl->m_clauses;
+}
+
+class OrQuery::Impl {
+public:
+  Impl(std::vector<std::unique_ptr<Query>>&& clauses);
+  ~Impl() = default;
+  std::vector<std::unique_ptr<Query>> m_clauses;
+};
+
+OrQuery::Impl::Impl(std::vector<std::unique_ptr<Query>>&& clauses)
+  : m_clauses(std::move(clauses))
+{
+  ;
+}
+
+OrQuery::OrQuery(std::vector<std::unique_ptr<Query>>&& clauses)
+  : mImpl(std::make_unique<Impl>(std::move(clauses)))
+{
+  ;
+}
+
+OrQuery::OrQuery(const std::vector<std::string>& buckets)
+  : mImpl(std::make_unique<Impl>(bucketClauses(buckets)))
+{
+  ;
+}
+
+OrQuery::~OrQuery()
+{
+  ;
+}
+
+const std::vector<std::unique_ptr<Query>>&
+OrQuery::clauses() const {
+  return mImpl->m_clauses;
+}
+
+class NotQuery::Impl {
+public:
+  Impl(std::unique_ptr<Query> from,std::unique_ptr<Query> excluded);
+  ~Impl() = default;
+  std::unique_ptr<Query> m_from;
+  std::unique_ptr<Query> m_excluded;
+};
+
+NotQuery::Impl::Impl(std::unique_ptr<Query> from,std::unique_ptr<Query> excluded)
+  : m_from(std::move(from)), m_excluded(std::move(excluded))
+{
+  ;
+}
+
+NotQuery::NotQuery(std::unique_ptr<Query> from,std::unique_ptr<Query> excluded)
+  : mImpl(std::make_unique<Impl>(std::move(from),std::move(excluded)))
+{
+  ;
+}
+
+NotQuery::~NotQuery()
+{
+  ;
+}
+
+const Query&
+NotQuery::from() const {
+  return *mImpl->m_from;
+}
+
+const Query&
+NotQuery::excluded() const {
+  return *mImpl->m_excluded;
+}
+
+
 DefaultQueryResult::DefaultQueryResult()
-  : m_recordKeys(std::make_unique<std::unordered_set<HashedKey>>())
+  : m_recordKeys(std::make_shared<const std::unordered_set<HashedKey>>())
 {
   ;
 }
@@ -67,15 +448,51 @@ DefaultQueryResult::DefaultQueryResult(KeySet&& recordKeys)
 }
 
 DefaultQueryResult::DefaultQueryResult(Set&& recordKeys)
-  : m_recordKeys(std::make_unique<std::unordered_set<HashedKey>>())
+  : m_recordKeys()
 {
-  m_recordKeys->reserve(recordKeys->size());
+  KeySet keys = std::make_unique<std::unordered_set<HashedKey>>();
+  keys->reserve(recordKeys->size());
   for (auto it = recordKeys->begin(); it != recordKeys->end(); it++) {
-    m_recordKeys->insert(HashedKey(*it));
+    keys->insert(HashedKey(*it));
   }
+  m_recordKeys = std::move(keys);
 }
 
-const KeySet&
+DefaultQueryResult::DefaultQueryResult(SharedKeySet recordKeys)
+  : m_recordKeys(std::move(recordKeys))
+{
+  ;
+}
+
+const SharedKeySet&
 DefaultQueryResult::recordKeys() {
   return m_recordKeys;
 }
+
+
+DefaultQueryCursor::DefaultQueryCursor(std::vector<std::uint64_t>&& hashes,KeysForHash keysForHash,
+                                       std::size_t offset,std::size_t limit)
+  : m_hashes(std::move(hashes)), m_keysForHash(keysForHash),
+    m_position(std::min(offset,m_hashes.size())), m_remaining(limit), m_pending()
+{
+  ;
+}
+
+bool
+DefaultQueryCursor::next(std::vector<HashedKey>& batch,std::size_t max) {
+  batch.clear();
+  max = std::min(max,m_remaining);
+  while (batch.size() < max) {
+    if (m_pending.empty()) {
+      if (m_position == m_hashes.size()) {
+        break;
+      }
+      m_pending = m_keysForHash(m_hashes[m_position++]);
+      continue;
+    }
+    batch.push_back(std::move(m_pending.back()));
+    m_pending.pop_back();
+  }
+  m_remaining -= batch.size();
+  return !batch.empty();
+}
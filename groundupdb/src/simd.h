@@ -0,0 +1,28 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#ifndef SIMD_H
+#define SIMD_H
+
+// Internal to the library. Defines GROUNDUPDB_SSE2, and includes the SSE2 intrinsics, where
+// the target has them. Code using them keeps a portable loop for other targets.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define GROUNDUPDB_SSE2
+#endif
+
+#endif // SIMD_H
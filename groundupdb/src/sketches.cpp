@@ -0,0 +1,183 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "sketches.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace groundupdb {
+
+namespace {
+
+// Counters stick at their maximum rather than wrapping
+constexpr std::uint32_t kMaxCount = std::numeric_limits<std::uint32_t>::max();
+
+// Spreads the bits of a hash, so that neither sketch depends on the quality of
+// the low or high bits of the key hashing algorithm in use (splitmix64 finaliser)
+std::uint64_t
+mix(std::uint64_t hash)
+{
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+// Number of leading zero bits, 64 for zero
+unsigned
+leadingZeros(std::uint64_t value)
+{
+  unsigned zeros = 0;
+  for (std::uint64_t bit = std::uint64_t{1} << 63;bit != 0 && 0 == (value & bit);bit >>= 1) {
+    zeros++;
+  }
+  return zeros;
+}
+
+} // end anonymous namespace
+
+HyperLogLog::HyperLogLog()
+  : m_registers{}
+{
+  ;
+}
+
+void
+HyperLogLog::add(std::uint64_t hash)
+{
+  hash = mix(hash);
+  std::size_t index = static_cast<std::size_t>(hash >> (64 - kPrecision));
+  // Position of the first set bit in the remaining bits
+  std::uint8_t rank = static_cast<std::uint8_t>(std::min(leadingZeros(hash << kPrecision),64u - kPrecision) + 1);
+  m_registers[index] = std::max(m_registers[index],rank);
+}
+
+void
+HyperLogLog::merge(const HyperLogLog& other)
+{
+  for (std::size_t i = 0;i < kRegisters;i++) {
+    m_registers[i] = std::max(m_registers[i],other.m_registers[i]);
+  }
+}
+
+double
+HyperLogLog::estimate() const
+{
+  const double m = static_cast<double>(kRegisters);
+  double sum = 0;
+  std::size_t zeros = 0;
+  for (auto r : m_registers) {
+    sum += std::ldexp(1.0,-static_cast<int>(r));
+    zeros += (0 == r) ? 1 : 0;
+  }
+  double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+  // Linear counting is more accurate while many registers are still empty
+  if (estimate <= 2.5 * m && zeros > 0) {
+    estimate = m * std::log(m / static_cast<double>(zeros));
+  }
+  return estimate;
+}
+
+Bytes
+HyperLogLog::toBytes() const
+{
+  Bytes bytes(kRegisters);
+  std::transform(m_registers.begin(),m_registers.end(),bytes.begin(),
+                 [](std::uint8_t r) { return std::byte{r}; });
+  return bytes;
+}
+
+std::optional<HyperLogLog>
+HyperLogLog::fromBytes(const Bytes& bytes)
+{
+  if (bytes.size() != kRegisters) {
+    return {};
+  }
+  HyperLogLog hll;
+  std::transform(bytes.begin(),bytes.end(),hll.m_registers.begin(),
+                 [](std::byte b) { return std::to_integer<std::uint8_t>(b); });
+  return hll;
+}
+
+CountMinSketch::CountMinSketch()
+  : m_counters(kDepth * kWidth,0)
+{
+  ;
+}
+
+// Each row's counter is chosen by double hashing from the two halves of one mixed hash
+void
+CountMinSketch::add(std::uint64_t hash,std::uint32_t count)
+{
+  hash = mix(hash);
+  std::uint64_t step = (hash >> 32) | 1;
+  for (std::size_t row = 0;row < kDepth;row++) {
+    std::uint32_t& counter = m_counters[row * kWidth + ((hash + row * step) & (kWidth - 1))];
+    counter = (counter > kMaxCount - count) ? kMaxCount : counter + count;
+  }
+}
+
+void
+CountMinSketch::merge(const CountMinSketch& other)
+{
+  for (std::size_t i = 0;i < m_counters.size();i++) {
+    std::uint32_t count = other.m_counters[i];
+    m_counters[i] = (m_counters[i] > kMaxCount - count) ? kMaxCount : m_counters[i] + count;
+  }
+}
+
+std::uint64_t
+CountMinSketch::estimate(std::uint64_t hash) const
+{
+  hash = mix(hash);
+  std::uint64_t step = (hash >> 32) | 1;
+  std::uint32_t estimate = kMaxCount;
+  for (std::size_t row = 0;row < kDepth;row++) {
+    estimate = std::min(estimate,m_counters[row * kWidth + ((hash + row * step) & (kWidth - 1))]);
+  }
+  return estimate;
+}
+
+Bytes
+CountMinSketch::toBytes() const
+{
+  Bytes bytes;
+  bytes.reserve(m_counters.size() * sizeof(std::uint32_t));
+  for (auto counter : m_counters) {
+    encodeLittleEndian(bytes,counter);
+  }
+  return bytes;
+}
+
+std::optional<CountMinSketch>
+CountMinSketch::fromBytes(const Bytes& bytes)
+{
+  if (bytes.size() != kDepth * kWidth * sizeof(std::uint32_t)) {
+    return {};
+  }
+  CountMinSketch cms;
+  for (std::size_t i = 0;i < cms.m_counters.size();i++) {
+    cms.m_counters[i] = decodeLittleEndian<std::uint32_t>(bytes.data() + i * sizeof(std::uint32_t));
+  }
+  return cms;
+}
+
+} // end namespace
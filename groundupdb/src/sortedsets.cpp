@@ -0,0 +1,147 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "sortedsets.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace groundupdb {
+
+namespace {
+
+// Beyond this length ratio it is cheaper to search the longer list than to walk it
+constexpr std::size_t kGallopRatio = 32;
+
+// Index of the first value >= value at or after from, or v.size()
+std::size_t
+gallop(SortedRange v,std::size_t from,std::uint64_t value)
+{
+  std::size_t step = 1;
+  std::size_t hi = from;
+  while (hi < v.size() && v[hi] < value) {
+    from = hi + 1;
+    hi += step;
+    step <<= 1;
+  }
+  hi = std::min(hi,v.size());
+  return std::lower_bound(v.begin() + from,v.begin() + hi,value) - v.begin();
+}
+
+// Whether any of the four values starting at block equals value
+inline bool
+anyOfFourEqual(const std::uint64_t* block,std::uint64_t value)
+{
+#ifdef GROUNDUPDB_SSE2
+  // SSE2 has no 64 bit compare, so compare 32 bit halves and require both to match
+  const __m128i needle = _mm_set1_epi64x(static_cast<long long>(value));
+  __m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)),needle);
+  __m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 2)),needle);
+  lo = _mm_and_si128(lo,_mm_shuffle_epi32(lo,_MM_SHUFFLE(2,3,0,1)));
+  hi = _mm_and_si128(hi,_mm_shuffle_epi32(hi,_MM_SHUFFLE(2,3,0,1)));
+  return 0 != _mm_movemask_epi8(_mm_or_si128(lo,hi));
+#else
+  return (block[0] == value) | (block[1] == value) | (block[2] == value) | (block[3] == value);
+#endif
+}
+
+} // end anonymous namespace
+
+std::vector<std::uint64_t>
+intersectSorted(SortedRange a,SortedRange b)
+{
+  SortedRange shorter = a.size() <= b.size() ? a : b;
+  SortedRange longer = a.size() <= b.size() ? b : a;
+  std::vector<std::uint64_t> out;
+  if (shorter.empty()) {
+    return out;
+  }
+  out.reserve(shorter.size());
+
+  std::size_t i = 0;
+  std::size_t j = 0;
+  if (longer.size() / shorter.size() >= kGallopRatio) {
+    for (;i < shorter.size();i++) {
+      j = gallop(longer,j,shorter[i]);
+      if (j == longer.size()) {
+        break;
+      }
+      if (longer[j] == shorter[i]) {
+        out.push_back(shorter[i]);
+      }
+    }
+    return out;
+  }
+
+  // Skip whole blocks of four that are below the current value, then probe the
+  // block that may hold it with one vector compare
+  const std::uint64_t* l = longer.begin();
+  while (i < shorter.size() && j + 4 <= longer.size()) {
+    if (l[j + 3] < shorter[i]) {
+      j += 4;
+      continue;
+    }
+    if (anyOfFourEqual(l + j,shorter[i])) {
+      out.push_back(shorter[i]);
+    }
+    i++;
+  }
+  // Remaining short tail
+  while (i < shorter.size() && j < longer.size()) {
+    if (shorter[i] < l[j]) {
+      i++;
+    } else if (l[j] < shorter[i]) {
+      j++;
+    } else {
+      out.push_back(shorter[i]);
+      i++;
+      j++;
+    }
+  }
+  return out;
+}
+
+std::vector<std::uint64_t>
+unionSorted(SortedRange a,SortedRange b)
+{
+  std::vector<std::uint64_t> out;
+  out.reserve(a.size() + b.size());
+  std::set_union(a.begin(),a.end(),b.begin(),b.end(),std::back_inserter(out));
+  return out;
+}
+
+std::vector<std::uint64_t>
+differenceSorted(SortedRange from,SortedRange excluded)
+{
+  std::vector<std::uint64_t> out;
+  out.reserve(from.size());
+  if (!from.empty() && excluded.size() / from.size() >= kGallopRatio) {
+    std::size_t j = 0;
+    for (auto value : from) {
+      j = gallop(excluded,j,value);
+      if (j == excluded.size() || excluded[j] != value) {
+        out.push_back(value);
+      }
+    }
+    return out;
+  }
+  std::set_difference(from.begin(),from.end(),excluded.begin(),excluded.end(),std::back_inserter(out));
+  return out;
+}
+
+} // end namespace
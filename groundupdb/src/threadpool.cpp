@@ -0,0 +1,167 @@
+/*
+See the NOTICE file
+distributed with this work for additional information
+regarding copyright ownership.  Adam Fowler licenses this file
+to you under the Apache License, Version 2.0 (the
+"License"); you may not use this file except in compliance
+with the License.  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the License is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied.  See the License for the
+specific language governing permissions and limitations
+under the License.
+*/
+#include "extensions/threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace groundupdbext {
+
+class ThreadPool::Impl {
+public:
+  Impl(std::size_t threads);
+  ~Impl();
+
+  void work();
+
+  std::size_t m_size;
+  std::vector<std::thread> m_workers;
+  std::deque<std::function<void()>> m_jobs;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  bool m_stopping;
+};
+
+ThreadPool::Impl::Impl(std::size_t threads)
+  : m_size(0 == threads ? std::max(1u,std::thread::hardware_concurrency()) : threads),
+    m_workers(),
+    m_jobs(),
+    m_mutex(),
+    m_wake(),
+    m_stopping(false)
+{
+  // The calling thread is the last of the pool
+  for (std::size_t i = 1;i < m_size;i++) {
+    m_workers.emplace_back([this] { work(); });
+  }
+}
+
+ThreadPool::Impl::~Impl()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+}
+
+void
+ThreadPool::Impl::work()
+{
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock,[this] { return m_stopping || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        return; // stopping
+      }
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    job();
+  }
+}
+
+ThreadPool::ThreadPool(std::size_t threads)
+  : mImpl(std::make_unique<Impl>(threads))
+{
+  ;
+}
+
+ThreadPool::~ThreadPool()
+{
+  ;
+}
+
+std::size_t
+ThreadPool::size() const
+{
+  return mImpl->m_size;
+}
+
+void
+ThreadPool::parallelFor(std::size_t count,const std::function<void(std::size_t)>& task)
+{
+  if (count <= 1 || mImpl->m_workers.empty()) {
+    for (std::size_t i = 0;i < count;i++) {
+      task(i);
+    }
+    return;
+  }
+
+  // Each thread takes the next part until none are left. A helper that only starts once
+  // every part has been taken does nothing, so it never uses task after this returns.
+  struct State {
+    std::atomic<std::size_t> next{0};
+    std::size_t count = 0;
+    std::size_t finished = 0;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto state = std::make_shared<State>();
+  state->count = count;
+  auto run = [state,&task] {
+    std::size_t ran = 0;
+    for (std::size_t i = state->next++;i < state->count;i = state->next++) {
+      try {
+        task(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      ran++;
+    }
+    if (ran > 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->finished += ran;
+      if (state->finished == state->count) {
+        state->done.notify_all();
+      }
+    }
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mImpl->m_mutex);
+    for (std::size_t i = 0;i < std::min(count - 1,mImpl->m_workers.size());i++) {
+      mImpl->m_jobs.emplace_back(run);
+    }
+  }
+  mImpl->m_wake.notify_all();
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done.wait(lock,[&state] { return state->finished == state->count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+}
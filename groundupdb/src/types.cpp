@@ -16,9 +16,11 @@ specific language governing permissions and limitations
 under the License.
 */
 #include "types.h"
+#include "integerlist.h"
 #include "extensions/highwayhash.h"
 
 #include <algorithm>
+#include <cstring>
 #include <type_traits>
 #include <typeinfo>
 
@@ -28,7 +30,31 @@ HashedValue::HashedValue(const Bytes& data,std::size_t length,std::size_t hash)
   : m_has_value(true),
     m_data(data),
     m_length(length),
-    m_hash(hash)
+    m_hash(hash),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  ;
+}
+
+HashedValue::HashedValue(Bytes&& data,std::size_t length,std::size_t hash)
+  : m_has_value(true),
+    m_data(std::move(data)),
+    m_length(length),
+    m_hash(hash),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  ;
+}
+
+HashedValue::HashedValue(Bytes&& data,std::size_t length,const Fingerprint& fingerprint)
+  : m_has_value(true),
+    m_data(std::move(data)),
+    m_length(length),
+    m_hash(DefaultHash::narrow(fingerprint.low)),
+    m_fingerprint(fingerprint),
+    m_has_fingerprint(true)
 {
   ;
 }
@@ -37,17 +63,30 @@ HashedValue::HashedValue()
   : m_has_value(false),
     m_data(),
     m_length(0),
-    m_hash(0)
+    m_hash(0),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
 {
   ;
 }
 
+void
+HashedValue::computeHash()
+{
+  KeyView view(m_data.data(),m_data.size());
+  m_hash = view.hash();
+  m_fingerprint = view.fingerprint();
+  m_has_fingerprint = view.hasFingerprint();
+}
+
 /** Copy/move constuctors and operators **/
 HashedValue::HashedValue(const HashedValue& from)
   : m_has_value(from.m_has_value),
     m_data(from.m_data),
     m_length(from.m_length),
-    m_hash(from.m_hash)
+    m_hash(from.m_hash),
+    m_fingerprint(from.m_fingerprint),
+    m_has_fingerprint(from.m_has_fingerprint)
 {
   ;
 }
@@ -56,7 +95,9 @@ HashedValue::HashedValue(const HashedValue&& from)
   : m_has_value(from.m_has_value),
     m_data(std::move(from.m_data)),
     m_length(from.m_length),
-    m_hash(from.m_hash)
+    m_hash(from.m_hash),
+    m_fingerprint(from.m_fingerprint),
+    m_has_fingerprint(from.m_has_fingerprint)
 {
   //std::cout << "HashedValue::move-ctor" << std::endl;
   ;
@@ -69,6 +110,8 @@ HashedValue::operator=(const HashedValue& other)
   m_length = other.m_length;
   m_data = other.m_data;
   m_hash = other.m_hash;
+  m_fingerprint = other.m_fingerprint;
+  m_has_fingerprint = other.m_has_fingerprint;
   return *this;
 }
 
@@ -77,21 +120,53 @@ HashedValue::HashedValue(const EncodedValue& from)
   : m_has_value(from.hasValue()),
     m_data(from.data()),
     m_length(from.length()),
-    m_hash(from.hash())
+    m_hash(from.hash()),
+    m_fingerprint(from.m_value.m_fingerprint),
+    m_has_fingerprint(from.m_value.m_has_fingerprint)
 {
   ;
 }
 
 HashedValue::HashedValue(EncodedValue&& from)
   : m_has_value(from.hasValue()),
-    m_data(std::move(from.data())),
+    m_data(std::move(from.m_value.m_data)),
     m_length(from.length()),
-    m_hash(from.hash())
+    m_hash(from.hash()),
+    m_fingerprint(from.m_value.m_fingerprint),
+    m_has_fingerprint(from.m_value.m_has_fingerprint)
+{
+  ;
+}
+
+HashedValue::HashedValue(std::string_view from)
+  : HashedValue(reinterpret_cast<const std::byte*>(from.data()),from.length())
 {
   ;
 }
 
-const Bytes
+HashedValue::HashedValue(const std::byte* data,std::size_t length)
+  : m_has_value(true),
+    m_data(data,data + length),
+    m_length(length),
+    m_hash(0),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  computeHash();
+}
+
+HashedValue::HashedValue(Bytes&& from)
+  : m_has_value(true),
+    m_data(std::move(from)),
+    m_length(m_data.size()),
+    m_hash(0),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  computeHash();
+}
+
+const Bytes&
 HashedValue::data() const { return m_data; }
 
 std::size_t
@@ -103,12 +178,39 @@ HashedValue::hash() const { return m_hash; }
 bool
 HashedValue::hasValue() const { return m_has_value; }
 
+bool
+HashedValue::hasFingerprint() const { return m_has_fingerprint; }
+
+Fingerprint
+HashedValue::fingerprint() const { return m_fingerprint; }
+
+HashedValue
+HashedValue::fingerprintOnly() const
+{
+  if (!m_has_fingerprint) {
+    return *this; // need the bytes to tell colliding keys apart
+  }
+  HashedValue copy;
+  copy.m_has_value = m_has_value;
+  copy.m_length = m_length;
+  copy.m_hash = m_hash;
+  copy.m_fingerprint = m_fingerprint;
+  copy.m_has_fingerprint = true;
+  return copy;
+}
+
 bool
 HashedValue::operator==(const HashedValue& other) const
 {
   if (m_hash != other.m_hash) {
     return false;
   }
+  if (m_has_fingerprint && other.m_has_fingerprint) {
+    // 128 bits is enough to treat a match as equal without the key bytes
+    return m_length == other.m_length &&
+           m_fingerprint.low == other.m_fingerprint.low &&
+           m_fingerprint.high == other.m_fingerprint.high;
+  }
   // compare hash first as generally it will be faster most often
   if (m_length != other.m_length) {
     return false;
@@ -124,6 +226,165 @@ HashedValue::operator!=(const HashedValue& other) const
   return !(*this==other);
 }
 
+KeyView::KeyView(std::string_view key)
+  : KeyView(reinterpret_cast<const std::byte*>(key.data()),key.length())
+{
+  ;
+}
+
+KeyView::KeyView(const std::byte* data,std::size_t length)
+  : m_data(data),
+    m_length(length),
+    m_hash(0),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  // TODO use correct hasher for current database connection, with correct initialisation settings
+  const DefaultHash& h1 = DefaultHash::standard();
+  const char* chars = reinterpret_cast<const char*>(data);
+  if (DefaultHash::fingerprintMode()) {
+    m_fingerprint = h1.fingerprint(chars,length);
+    m_has_fingerprint = true;
+    m_hash = DefaultHash::narrow(m_fingerprint.low);
+  } else {
+    m_hash = h1(chars,length);
+  }
+}
+
+KeyView::KeyView(const HashedValue& key)
+  : m_data(key.m_data.data()),
+    m_length(key.m_length),
+    m_hash(key.m_hash),
+    m_fingerprint(key.m_fingerprint),
+    m_has_fingerprint(key.m_has_fingerprint)
+{
+  ;
+}
+
+bool
+KeyView::matches(const HashedValue& key) const
+{
+  if (m_hash != key.m_hash || m_length != key.m_length) {
+    return false;
+  }
+  if (m_has_fingerprint && key.m_has_fingerprint) {
+    return m_fingerprint.low == key.m_fingerprint.low &&
+           m_fingerprint.high == key.m_fingerprint.high;
+  }
+  return 0 == m_length || 0 == std::memcmp(m_data,key.m_data.data(),m_length);
+}
+
+HashedValue
+KeyView::toHashedValue() const
+{
+  Bytes data(m_data,m_data + m_length);
+  if (m_has_fingerprint) {
+    return HashedValue(std::move(data),m_length,m_fingerprint);
+  }
+  return HashedValue(std::move(data),m_length,m_hash);
+}
+
+std::vector<HashedKey>
+hashKeys(const std::vector<std::string>& keys)
+{
+  std::vector<Bytes> data;
+  data.reserve(keys.size());
+  for (auto& key : keys) {
+    const std::byte* start = reinterpret_cast<const std::byte*>(key.data());
+    data.emplace_back(start,start + key.length());
+  }
+  return hashKeys(std::move(data));
+}
+
+std::vector<HashedKey>
+hashKeys(std::vector<Bytes>&& keys)
+{
+  // TODO use correct hasher for current database connection, with correct initialisation settings
+  const DefaultHash& h1 = DefaultHash::standard();
+  std::vector<HashedKey> hashed;
+  hashed.reserve(keys.size());
+  if (DefaultHash::fingerprintMode()) {
+    std::vector<const char*> data(keys.size());
+    std::vector<std::size_t> lengths(keys.size());
+    for (std::size_t i = 0;i < keys.size();i++) {
+      data[i] = reinterpret_cast<const char*>(keys[i].data());
+      lengths[i] = keys[i].size();
+    }
+    std::vector<Fingerprint> fingerprints(keys.size());
+    h1.batch(data.data(),lengths.data(),keys.size(),fingerprints.data());
+    for (std::size_t i = 0;i < keys.size();i++) {
+      hashed.emplace_back(std::move(keys[i]),lengths[i],fingerprints[i]);
+    }
+    return hashed;
+  }
+  std::vector<std::size_t> hashes = h1.batch(keys);
+  for (std::size_t i = 0;i < keys.size();i++) {
+    std::size_t length = keys[i].size();
+    hashed.emplace_back(std::move(keys[i]),length,hashes[i]);
+  }
+  return hashed;
+}
+
+HashedValue::HashedValue(const StaticKey& from)
+  : m_has_value(true),
+    m_data(reinterpret_cast<const std::byte*>(from.data()),reinterpret_cast<const std::byte*>(from.data()) + from.length()),
+    m_length(from.length()),
+    m_hash(DefaultHash::narrow(from.hash())),
+    m_fingerprint{0,0},
+    m_has_fingerprint(false)
+{
+  if (DefaultHash::fingerprintMode()) {
+    m_fingerprint = from.fingerprint();
+    m_has_fingerprint = true;
+    m_hash = DefaultHash::narrow(m_fingerprint.low);
+  }
+}
+
+HashedKey
+StaticKey::append(const std::string& suffix) const
+{
+  Bytes data;
+  data.reserve(m_length + suffix.length());
+  const std::byte* start = reinterpret_cast<const std::byte*>(m_data);
+  data.insert(data.end(),start,start + m_length);
+  start = reinterpret_cast<const std::byte*>(suffix.data());
+  data.insert(data.end(),start,start + suffix.length());
+  StaticHash state(m_state); // copy, so this literal can be reused
+  state.append(suffix.data(),suffix.length());
+  std::size_t length = data.size();
+  if (DefaultHash::fingerprintMode()) {
+    return HashedKey(std::move(data),length,state.finalize128());
+  }
+  return HashedKey(std::move(data),length,DefaultHash::narrow(state.finalize()));
+}
+
+ValueView
+EncodedValue::view() const
+{
+  return ValueView(m_has_value ? m_type : Type::UNKNOWN,m_value.m_data.data(),m_value.m_length);
+}
+
+std::optional<std::int32_t>
+EncodedValue::asInt32() const { return view().asInt32(); }
+
+std::optional<std::int64_t>
+EncodedValue::asInt64() const { return view().asInt64(); }
+
+std::optional<std::uint64_t>
+EncodedValue::asUInt64() const { return view().asUInt64(); }
+
+std::optional<double>
+EncodedValue::asDouble() const { return view().asDouble(); }
+
+std::optional<std::string>
+EncodedValue::asString() const { return view().asString(); }
+
+std::optional<ContainerView>
+EncodedValue::asContainer() const { return view().asContainer(); }
+
+std::optional<std::vector<std::uint64_t>>
+EncodedValue::asIntegers() const { return view().asIntegers(); }
+
 bool
 EncodedValue::operator==(const EncodedValue& other) const
 {
@@ -136,6 +397,216 @@ EncodedValue::operator!=(const EncodedValue& other) const
   return !(*this==other);
 }
 
+ValueView::ValueView(Type type,const std::byte* data,std::size_t length)
+  : m_type(type),
+    m_data(data),
+    m_length(length)
+{
+  ;
+}
+
+std::optional<std::int32_t>
+ValueView::asInt32() const
+{
+  if (Type::INT32 != m_type || sizeof(std::int32_t) != m_length) {
+    return {};
+  }
+  return decodeLittleEndian<std::int32_t>(m_data);
+}
+
+std::optional<std::int64_t>
+ValueView::asInt64() const
+{
+  if (Type::INT32 == m_type) {
+    return asInt32();
+  }
+  if (Type::INT64 != m_type || sizeof(std::int64_t) != m_length) {
+    return {};
+  }
+  return decodeLittleEndian<std::int64_t>(m_data);
+}
+
+std::optional<std::uint64_t>
+ValueView::asUInt64() const
+{
+  if (Type::UINT64 != m_type || sizeof(std::uint64_t) != m_length) {
+    return {};
+  }
+  return decodeLittleEndian<std::uint64_t>(m_data);
+}
+
+std::optional<double>
+ValueView::asDouble() const
+{
+  if (Type::DOUBLE != m_type || sizeof(double) != m_length) {
+    return {};
+  }
+  return decodeLittleEndian<double>(m_data);
+}
+
+std::optional<std::string>
+ValueView::asString() const
+{
+  if (Type::STRING != m_type && Type::CPP != m_type) {
+    return {};
+  }
+  return std::string(reinterpret_cast<const char*>(m_data),m_length);
+}
+
+std::optional<ContainerView>
+ValueView::asContainer() const
+{
+  // Only the header is checked here, so opening a large container is cheap. Each slot's
+  // offsets are checked as it is read.
+  const std::size_t word = sizeof(std::uint32_t);
+  if (Type::CONTAINER != m_type || m_length < 2 * word) {
+    return {};
+  }
+  std::size_t count = decodeLittleEndian<std::uint32_t>(m_data);
+  bool keyed = 0 != (decodeLittleEndian<std::uint32_t>(m_data + word) & 1);
+  std::size_t slots = keyed ? 2 * count : count;
+  std::size_t header = (2 + slots + 1 + (keyed ? count : 0)) * word;
+  if (m_length < header ||
+      m_length - header < decodeLittleEndian<std::uint32_t>(m_data + (2 + slots) * word)) {
+    return {};
+  }
+  return ContainerView(m_data,m_data + header,m_length - header,count,keyed);
+}
+
+std::optional<std::vector<std::uint64_t>>
+ValueView::asIntegers() const
+{
+  if (Type::INTEGERS != m_type) {
+    return {};
+  }
+  return IntegerList::decode(m_data,m_length);
+}
+
+EncodedValue
+ValueView::copy() const
+{
+  if (Type::UNKNOWN == m_type) {
+    return EncodedValue();
+  }
+  Bytes data(m_data,m_data + m_length);
+  const DefaultHash& h1 = DefaultHash::standard();
+  std::size_t hash = h1(data);
+  return EncodedValue(m_type,data,m_length,hash);
+}
+
+ContainerView::ContainerView(const std::byte* header,const std::byte* slots,std::size_t length,
+                             std::size_t count,bool keyed)
+  : m_header(header),
+    m_slots(slots),
+    m_length(length),
+    m_count(count),
+    m_keyed(keyed)
+{
+  ;
+}
+
+ValueView
+ContainerView::slot(std::size_t s) const
+{
+  const std::byte* offsets = m_header + 2 * sizeof(std::uint32_t);
+  std::size_t start = decodeLittleEndian<std::uint32_t>(offsets + s * sizeof(std::uint32_t));
+  std::size_t end = decodeLittleEndian<std::uint32_t>(offsets + (s + 1) * sizeof(std::uint32_t));
+  if (start >= end || end > m_length) {
+    return ValueView(Type::UNKNOWN,nullptr,0); // corrupt offsets, so nothing is read outside the value
+  }
+  return ValueView((Type)m_slots[start],m_slots + start + 1,end - start - 1);
+}
+
+ValueView
+ContainerView::operator[](std::size_t i) const
+{
+  if (i >= m_count) {
+    throw std::out_of_range("Container element out of range");
+  }
+  return slot(m_keyed ? 2 * i + 1 : i);
+}
+
+ValueView
+ContainerView::key(std::size_t i) const
+{
+  if (!m_keyed) {
+    throw std::logic_error("Container has no keys");
+  }
+  if (i >= m_count) {
+    throw std::out_of_range("Container element out of range");
+  }
+  return slot(2 * i);
+}
+
+// Orders encoded values by type tag, then by their bytes
+static int compareEncoded(const ValueView& a,const ValueView& b)
+{
+  if (a.type() != b.type()) {
+    return a.type() < b.type() ? -1 : 1;
+  }
+  int cmp = std::memcmp(a.data(),b.data(),std::min(a.length(),b.length()));
+  if (0 != cmp) {
+    return cmp;
+  }
+  return a.length() < b.length() ? -1 : (a.length() == b.length() ? 0 : 1);
+}
+
+std::optional<ValueView>
+ContainerView::find(const ValueView& key) const
+{
+  if (!m_keyed) {
+    return {};
+  }
+  const std::byte* order = m_header + (2 + 2 * m_count + 1) * sizeof(std::uint32_t);
+  // lower bound, so the first of several equal keys (E.g. in a multimap) is found
+  std::size_t low = 0;
+  std::size_t high = m_count;
+  while (low < high) {
+    std::size_t mid = low + (high - low) / 2;
+    std::size_t entry = decodeLittleEndian<std::uint32_t>(order + mid * sizeof(std::uint32_t));
+    if (entry >= m_count) {
+      return {}; // corrupt order table
+    }
+    if (compareEncoded(slot(2 * entry),key) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == m_count) {
+    return {};
+  }
+  std::size_t entry = decodeLittleEndian<std::uint32_t>(order + low * sizeof(std::uint32_t));
+  if (entry >= m_count || 0 != compareEncoded(slot(2 * entry),key)) {
+    return {};
+  }
+  return slot(2 * entry + 1);
+}
+
+std::optional<ValueView>
+ContainerView::find(const EncodedValue& key) const
+{
+  return find(key.view());
+}
+
+void
+indexContainerKeys(Bytes& out,std::size_t start)
+{
+  ValueView whole(Type::CONTAINER,out.data() + start,out.size() - start);
+  ContainerView container = whole.asContainer().value();
+  std::vector<std::uint32_t> order(container.size());
+  for (std::size_t i = 0;i < order.size();i++) {
+    order[i] = static_cast<std::uint32_t>(i);
+  }
+  std::stable_sort(order.begin(),order.end(),[&container] (std::uint32_t a,std::uint32_t b) {
+    return compareEncoded(container.key(a),container.key(b)) < 0;
+  });
+  std::byte* at = out.data() + start + (2 + 2 * order.size() + 1) * sizeof(std::uint32_t);
+  for (std::size_t i = 0;i < order.size();i++) {
+    writeLittleEndian(at + i * sizeof(std::uint32_t),order[i]);
+  }
+}
+
 std::ostream &
 operator<<(std::ostream &os, const Type t) {
   os << (int)t;